@@ -0,0 +1,117 @@
+// Measures the distribution of per-operation latencies for a few allocators under the same random
+// alloc/dealloc workload. The interesting numbers are the tail percentiles and the maximum, which
+// should stay flat for `tlsf_allocator` while the others occasionally stall on syscalls, new
+// spans, or new blocks.
+
+#include <vixen/allocator/allocators.hpp>
+#include <vixen/vec.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+using namespace vixen;
+
+constexpr usize SLOT_COUNT = 4096;
+constexpr usize OPERATION_COUNT = 500000;
+constexpr usize MIN_ALLOCATION_SIZE = 16;
+constexpr usize MAX_ALLOCATION_SIZE = 4096;
+
+struct slot {
+    void *ptr = nullptr;
+    heap::layout layout;
+};
+
+static u64 percentile(const vector<u64> &sorted, double p) {
+    usize index = std::min((usize)(p * (double)sorted.len()), sorted.len() - 1);
+    return sorted[index];
+}
+
+static void run_benchmark(const char *name, heap::allocator *alloc) {
+    std::mt19937_64 rng(0x5eed);
+    std::uniform_int_distribution<usize> slot_dist(0, SLOT_COUNT - 1);
+    std::uniform_int_distribution<usize> size_dist(MIN_ALLOCATION_SIZE, MAX_ALLOCATION_SIZE);
+
+    vector<slot> slots(heap::global_allocator());
+    for (usize i = 0; i < SLOT_COUNT; ++i) {
+        slots.push(slot{});
+    }
+    vector<u64> samples(heap::global_allocator());
+
+    // Each operation picks a random slot and fills it if it's empty or frees it if it's full, so
+    // the live set hovers around half the slots with a random mix of sizes.
+    for (usize i = 0; i < OPERATION_COUNT; ++i) {
+        slot &s = slots[slot_dist(rng)];
+        heap::layout layout = {size_dist(rng), 16};
+
+        auto start = std::chrono::steady_clock::now();
+        if (s.ptr) {
+            alloc->dealloc(s.layout, s.ptr);
+            s.ptr = nullptr;
+        } else {
+            s.ptr = alloc->alloc(layout);
+            s.layout = layout;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+        samples.push((u64)elapsed.count());
+    }
+
+    for (slot &s : slots) {
+        if (s.ptr) {
+            alloc->dealloc(s.layout, s.ptr);
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    VIXEN_INFO("{:<18} p50 {:>7}ns  p99 {:>7}ns  p99.9 {:>7}ns  p99.99 {:>7}ns  max {:>9}ns",
+        name,
+        percentile(samples, 0.5),
+        percentile(samples, 0.99),
+        percentile(samples, 0.999),
+        percentile(samples, 0.9999),
+        samples[samples.len() - 1]);
+}
+
+// Poisoning would add a memset of up to a whole allocation to every timed operation, so it's turned
+// off for every allocator being measured and for the page allocator under them.
+int main() {
+    // Results are logged at info, which release builds would otherwise leave out.
+    set_logger_verbosity(default_logger, logger_level::info);
+
+    heap::page_allocator pages;
+    pages.poison = heap::poison_policy::off;
+
+    // Big enough for the whole live set even when it's badly fragmented.
+    heap::layout region_layout = {SLOT_COUNT * MAX_ALLOCATION_SIZE * 2, 16};
+    void *region = pages.alloc(region_layout);
+    // Fault the region in up front, so that first touches don't show up as allocator latency.
+    util::fill((u8)0, (u8 *)region, region_layout.size);
+    {
+        heap::tlsf_allocator tlsf(region, region_layout.size);
+        tlsf.poison = heap::poison_policy::off;
+        run_benchmark("tlsf_allocator", &tlsf);
+    }
+    pages.dealloc(region_layout, region);
+
+    heap::slab_allocator slab(&pages);
+    slab.poison = heap::poison_policy::off;
+    run_benchmark("slab_allocator", &slab);
+
+    heap::arena_allocator arena(&pages);
+    arena.poison = heap::poison_policy::off;
+    run_benchmark("arena_allocator", &arena);
+
+    run_benchmark("page_allocator", &pages);
+
+    // The allocators behind the global one aren't reachable from here, so they poison with whatever
+    // policy the library was built with.
+    heap::allocator *global = heap::global_allocator();
+    heap::poison_policy old_poison = global->poison;
+    global->poison = heap::poison_policy::off;
+    run_benchmark("global_allocator", global);
+    global->poison = old_poison;
+
+    return 0;
+}
@@ -0,0 +1,448 @@
+// Replays an allocation trace recorded with `heap::start_event_trace` against some of vixen's
+// allocators, and reports how each one coped with the same traffic: throughput, latency
+// percentiles, peak RSS, and how much memory it held beyond what was live.
+//
+// Usage: vixen-replay <trace> [--id <allocator id>] [allocator...]
+//
+// Allocators are named `page`, `arena`, `slab`, `buddy`, `tlsf`, `system` and `global`, and all of
+// them are run when none are named. Traces of nested allocators contain both the child's requests
+// and the parent's requests for blocks to carve them from, so `--id` picks out a single allocator.
+//
+// Events from every thread are merged by timestamp and replayed on one thread, so the numbers show
+// what each allocator costs by itself rather than how it holds up under contention.
+
+#include <vixen/allocator/allocators.hpp>
+#include <vixen/allocator/trace.hpp>
+#include <vixen/option.hpp>
+#include <vixen/vec.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vixen;
+
+// RSS is read every this many requests, since each read is a few system calls.
+constexpr usize RSS_SAMPLE_INTERVAL = 1024;
+constexpr usize ONE_MB = 1024 * 1024;
+
+enum class op_kind : u8 {
+    alloc,
+    dealloc,
+    realloc,
+};
+
+// A request from the trace, with the traced pointers swapped out for indices into the replay's
+// table of live blocks.
+struct replay_op {
+    op_kind kind;
+    usize slot;
+    heap::layout old_layout;
+    heap::layout new_layout;
+};
+
+struct replay_plan {
+    replay_plan() : ops(heap::global_allocator()) {}
+
+    vector<replay_op> ops;
+    usize slot_count = 0;
+    usize peak_live_bytes = 0;
+    // Frees and reallocations of blocks that were allocated before the trace started.
+    usize unmatched_count = 0;
+};
+
+// The same address can be live in a parent allocator and in the child that carved it up, so blocks
+// are keyed by both. Each allocator's keys sort together, in address order.
+static u64 block_key(const heap::trace_event &event, u64 ptr) {
+    return ptr | ((u64)(u16)event.allocator << 48);
+}
+
+static heap::layout replay_layout(usize size, usize align) {
+    return {size, std::max(align, (usize)1)};
+}
+
+struct plan_builder {
+    plan_builder()
+        : free_slots(heap::global_allocator())
+        , slot_layouts(heap::global_allocator()) {}
+
+    replay_plan plan;
+    // Ordered, so that a reset or a restore can find the blocks it freed without looking at every
+    // other live block.
+    std::map<u64, usize> slots_by_key;
+    vector<usize> free_slots;
+    vector<heap::layout> slot_layouts;
+    usize live_bytes = 0;
+
+    usize take_slot(heap::layout layout) {
+        usize slot;
+        if (auto freed = free_slots.pop()) {
+            slot = *freed;
+            slot_layouts[slot] = layout;
+        } else {
+            slot = plan.slot_count++;
+            slot_layouts.push(layout);
+        }
+        live_bytes += layout.size;
+        plan.peak_live_bytes = std::max(plan.peak_live_bytes, live_bytes);
+        return slot;
+    }
+
+    void alloc(u64 key, heap::layout layout) {
+        usize slot = take_slot(layout);
+        slots_by_key[key] = slot;
+        plan.ops.push(replay_op{op_kind::alloc, slot, layout, layout});
+    }
+
+    void dealloc(usize slot) {
+        live_bytes -= slot_layouts[slot].size;
+        free_slots.push(slot);
+        plan.ops.push(replay_op{op_kind::dealloc, slot, slot_layouts[slot], slot_layouts[slot]});
+    }
+
+    // Blocks freed all at once by a reset or a restore have to be spelled out as individual frees
+    // for allocators that can't do either. Frees every live block of the event's allocator whose
+    // address is in `[first, last]`.
+    void dealloc_range(const heap::trace_event &event, u64 first, u64 last) {
+        auto begin = slots_by_key.lower_bound(block_key(event, first));
+        auto end = slots_by_key.upper_bound(block_key(event, last));
+        for (auto it = begin; it != end; ++it) {
+            dealloc(it->second);
+        }
+        slots_by_key.erase(begin, end);
+    }
+
+    option<usize> take_key(u64 key) {
+        auto it = slots_by_key.find(key);
+        if (it == slots_by_key.end()) {
+            return nullptr;
+        }
+        usize slot = it->second;
+        slots_by_key.erase(it);
+        return slot;
+    }
+
+    void add(const heap::trace_event &event) {
+        heap::layout new_layout = replay_layout(event.size, event.align);
+        switch (event.kind) {
+        case heap::trace_event_kind::alloc:
+            if (event.size > 0) {
+                alloc(block_key(event, event.ptr), new_layout);
+            }
+            break;
+        case heap::trace_event_kind::dealloc:
+            if (auto slot = take_key(block_key(event, event.ptr))) {
+                dealloc(*slot);
+            } else {
+                plan.unmatched_count += 1;
+            }
+            break;
+        case heap::trace_event_kind::realloc:
+            if (auto slot = take_key(block_key(event, event.old_ptr))) {
+                heap::layout old_layout = slot_layouts[*slot];
+                live_bytes = live_bytes - old_layout.size + new_layout.size;
+                plan.peak_live_bytes = std::max(plan.peak_live_bytes, live_bytes);
+                slot_layouts[*slot] = new_layout;
+                slots_by_key[block_key(event, event.ptr)] = *slot;
+                plan.ops.push(replay_op{op_kind::realloc, *slot, old_layout, new_layout});
+            } else {
+                plan.unmatched_count += 1;
+                alloc(block_key(event, event.ptr), new_layout);
+            }
+            break;
+        case heap::trace_event_kind::reset:
+            // Addresses only take up the low 48 bits of a key, above which is the allocator's ID.
+            dealloc_range(event, 0, (1ull << 48) - 1);
+            break;
+        case heap::trace_event_kind::restore:
+            if (event.size > 0) {
+                dealloc_range(event, event.ptr, event.ptr + event.size - 1);
+            }
+            break;
+        case heap::trace_event_kind::stack_frame:
+            break;
+        }
+    }
+};
+
+// Only keeps the events of the allocator `only_id` names, when `has_id` is set.
+static replay_plan build_plan(slice<const heap::trace_event> events, bool has_id, i32 only_id) {
+    vector<const heap::trace_event *> ordered(heap::global_allocator());
+    for (usize i = 0; i < events.len; ++i) {
+        const heap::trace_event &event = events[i];
+        // Zeroed events were reserved by a thread that never got to write them.
+        if (event.timestamp != 0 && (!has_id || event.allocator == only_id)) {
+            ordered.push(&event);
+        }
+    }
+    std::stable_sort(ordered.begin(), ordered.end(), [](const auto *lhs, const auto *rhs) {
+        return lhs->timestamp < rhs->timestamp;
+    });
+
+    plan_builder builder;
+    for (const heap::trace_event *event : ordered) {
+        builder.add(*event);
+    }
+    return mv(builder.plan);
+}
+
+// The kernel batches its RSS counters, so this can be off by a few hundred KiB. That only matters
+// for traces too small to be worth comparing allocators on.
+static usize resident_bytes() {
+    int fd = open("/proc/self/statm", O_RDONLY);
+    char buf[128] = {};
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return 0;
+    }
+
+    // The second field is the number of resident pages.
+    char *resident = strchr(buf, ' ');
+    return resident ? (usize)strtoull(resident + 1, nullptr, 10) * heap::page_size() : 0;
+}
+
+// Writes to every page of a block, like a program using it would, so that it counts toward RSS.
+static void touch_block(void *ptr, usize size) {
+    for (usize offset = 0; offset < size; offset += heap::page_size()) {
+        ((volatile u8 *)ptr)[offset] = 1;
+    }
+}
+
+static u64 percentile(const vector<u64> &sorted, double p) {
+    usize index = std::min((usize)(p * (double)sorted.len()), sorted.len() - 1);
+    return sorted[index];
+}
+
+// Per-slot state and latency samples for a replay. Everything is allocated before the baseline RSS
+// is taken, so that none of it shows up as allocator overhead.
+struct replay_buffers {
+    explicit replay_buffers(const replay_plan &plan)
+        : blocks(heap::global_allocator()),
+          layouts(heap::global_allocator()),
+          samples(heap::global_allocator()) {
+        for (usize i = 0; i < plan.slot_count; ++i) {
+            this->blocks.push(nullptr);
+            this->layouts.push(heap::layout{0, 1});
+        }
+        for (usize i = 0; i < plan.ops.len(); ++i) {
+            this->samples.push(0);
+        }
+    }
+
+    vector<void *> blocks;
+    vector<heap::layout> layouts;
+    vector<u64> samples;
+};
+
+static void run_replay(const char *name,
+    heap::allocator *alloc,
+    const replay_plan &plan,
+    replay_buffers &buffers,
+    usize base_rss) {
+    vector<void *> &blocks = buffers.blocks;
+    vector<heap::layout> &layouts = buffers.layouts;
+    vector<u64> &samples = buffers.samples;
+
+    usize done = 0;
+    usize peak_rss = base_rss;
+    u64 total_ns = 0;
+    try {
+        for (usize i = 0; i < plan.ops.len(); ++i) {
+            const replay_op &op = plan.ops[i];
+            void *&block = blocks[op.slot];
+
+            auto start = std::chrono::steady_clock::now();
+            switch (op.kind) {
+            case op_kind::alloc: block = alloc->alloc(op.new_layout); break;
+            case op_kind::dealloc: alloc->dealloc(op.old_layout, block); break;
+            case op_kind::realloc:
+                block = alloc->realloc(op.old_layout, op.new_layout, block);
+                break;
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            u64 ns = (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            samples[i] = ns;
+            total_ns += ns;
+            done += 1;
+
+            if (op.kind == op_kind::dealloc) {
+                block = nullptr;
+            } else {
+                layouts[op.slot] = op.new_layout;
+                touch_block(block, op.new_layout.size);
+            }
+            if (i % RSS_SAMPLE_INTERVAL == 0) {
+                peak_rss = std::max(peak_rss, resident_bytes());
+            }
+        }
+    } catch (heap::allocation_exception &ex) {
+        VIXEN_INFO("{:<18} ran out of memory after {} of {} requests",
+            name,
+            done,
+            plan.ops.len());
+    }
+    peak_rss = std::max(peak_rss, resident_bytes());
+
+    for (usize i = 0; i < plan.slot_count; ++i) {
+        if (blocks[i]) {
+            alloc->dealloc(layouts[i], blocks[i]);
+        }
+    }
+    if (done == 0) {
+        return;
+    }
+    samples.truncate(done);
+
+    std::sort(samples.begin(), samples.end());
+    usize rss_growth = peak_rss - base_rss;
+    VIXEN_INFO("{:<18} {:>10.0f} req/s  p50 {:>6}ns  p99 {:>6}ns  p99.9 {:>7}ns  max {:>9}ns  "
+               "peak rss {:>8} KiB  rss/live {:.2f}",
+        name,
+        (double)samples.len() * 1e9 / (double)std::max(total_ns, (u64)1),
+        percentile(samples, 0.5),
+        percentile(samples, 0.99),
+        percentile(samples, 0.999),
+        samples[samples.len() - 1],
+        rss_growth / 1024,
+        (double)rss_growth / (double)std::max(plan.peak_live_bytes, (usize)1));
+}
+
+static usize next_power_of_two(usize n) {
+    usize power = 1;
+    while (power < n) {
+        power <<= 1;
+    }
+    return power;
+}
+
+// Poisoning would add a memset to every timed request, and would fault in whole regions up front,
+// so it's turned off for every allocator being measured and for the page allocator under it.
+static bool run_named(const char *name, const replay_plan &plan) {
+    replay_buffers buffers(plan);
+    usize base_rss = resident_bytes();
+
+    heap::page_allocator pages;
+    pages.poison = heap::poison_policy::off;
+    if (strcmp(name, "page") == 0) {
+        run_replay("page_allocator", &pages, plan, buffers, base_rss);
+    } else if (strcmp(name, "arena") == 0) {
+        heap::arena_allocator arena(&pages);
+        arena.poison = heap::poison_policy::off;
+        run_replay("arena_allocator", &arena, plan, buffers, base_rss);
+    } else if (strcmp(name, "slab") == 0) {
+        heap::slab_allocator slab(&pages);
+        slab.poison = heap::poison_policy::off;
+        run_replay("slab_allocator", &slab, plan, buffers, base_rss);
+    } else if (strcmp(name, "buddy") == 0) {
+        usize region_size = next_power_of_two(std::max(plan.peak_live_bytes * 2, 64 * ONE_MB));
+        heap::buddy_allocator buddy(&pages, region_size);
+        buddy.poison = heap::poison_policy::off;
+        run_replay("buddy_allocator", &buddy, plan, buffers, base_rss);
+    } else if (strcmp(name, "tlsf") == 0) {
+        // TLSF only manages the region it's given, so give it room for a badly fragmented heap.
+        heap::layout region_layout = {plan.peak_live_bytes * 2 + 64 * ONE_MB, 16};
+        void *region = pages.alloc(region_layout);
+        {
+            heap::tlsf_allocator tlsf(region, region_layout.size);
+            tlsf.poison = heap::poison_policy::off;
+            run_replay("tlsf_allocator", &tlsf, plan, buffers, base_rss);
+        }
+        pages.dealloc(region_layout, region);
+    } else if (strcmp(name, "system") == 0) {
+        heap::system_allocator system;
+        system.poison = heap::poison_policy::off;
+        run_replay("system_allocator", &system, plan, buffers, base_rss);
+    } else if (strcmp(name, "global") == 0) {
+        // The allocators behind the global one aren't reachable from here, so they poison with
+        // whatever policy the library was built with.
+        heap::allocator *global = heap::global_allocator();
+        heap::poison_policy old_poison = global->poison;
+        global->poison = heap::poison_policy::off;
+        run_replay("global_allocator", global, plan, buffers, base_rss);
+        global->poison = old_poison;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    // The report is logged at info, which release builds would otherwise leave out.
+    set_logger_verbosity(default_logger, logger_level::info);
+
+    if (argc < 2) {
+        VIXEN_ERROR("usage: {} <trace> [--id <allocator id>] [allocator...]", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || (usize)info.st_size < sizeof(heap::trace_file_header)) {
+        VIXEN_ERROR("Could not read trace '{}'.", argv[1]);
+        return 1;
+    }
+    void *base = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        VIXEN_ERROR("Could not map trace '{}'.", argv[1]);
+        return 1;
+    }
+
+    const heap::trace_file_header *header = (const heap::trace_file_header *)base;
+    if (header->magic != heap::TRACE_MAGIC || header->version != heap::TRACE_VERSION
+        || header->event_size != sizeof(heap::trace_event))
+    {
+        VIXEN_ERROR("'{}' is not a trace, or was written by another version.", argv[1]);
+        return 1;
+    }
+    usize stored_events = (info.st_size - sizeof(heap::trace_file_header))
+        / sizeof(heap::trace_event);
+    slice<const heap::trace_event> events = {
+        (const heap::trace_event *)(header + 1),
+        std::min((usize)header->event_count, stored_events),
+    };
+
+    bool has_id = false;
+    i32 only_id = 0;
+    vector<const char *> names(heap::global_allocator());
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--id") == 0 && i + 1 < argc) {
+            has_id = true;
+            only_id = (i32)atoi(argv[++i]);
+        } else {
+            names.push(argv[i]);
+        }
+    }
+    if (names.len() == 0) {
+        for (const char *name : {"page", "arena", "slab", "buddy", "tlsf", "system", "global"}) {
+            names.push(name);
+        }
+    }
+
+    replay_plan plan = build_plan(events, has_id, only_id);
+    VIXEN_INFO("replaying {} requests over {} slots, peaking at {} KiB live ({} events dropped "
+               "while tracing, {} requests on blocks from before the trace)",
+        plan.ops.len(),
+        plan.slot_count,
+        plan.peak_live_bytes / 1024,
+        header->dropped_count,
+        plan.unmatched_count);
+
+    for (const char *name : names) {
+        if (!run_named(name, plan)) {
+            VIXEN_ERROR("Unknown allocator '{}'.", name);
+            return 1;
+        }
+    }
+
+    munmap(base, info.st_size);
+    return 0;
+}
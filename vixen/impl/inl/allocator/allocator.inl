@@ -9,6 +9,7 @@
 #include <algorithm>
 #include <cstring>
 #include <new>
+#include <type_traits>
 
 namespace vixen::heap {
 
@@ -43,6 +44,45 @@ constexpr layout layout::add_alignment(usize align) const {
     return {size, align > this->align ? this->align : align};
 }
 
+inline void poison_memory_from(
+    poison_policy policy, u8 pattern, void *ptr, usize offset, usize size) {
+    switch (policy) {
+    case poison_policy::off: return;
+    case poison_policy::sampled:
+        // Fibonacci hash of the allocation's start address, so that every part of one allocation
+        // makes the same choice. Only the high bits of the product are well mixed, since the low
+        // bits of addresses are mostly alignment.
+        if (((((usize)ptr >> 4) * 0x9e3779b97f4a7c15ull) >> 40) % POISON_SAMPLE_RATE != 0) {
+            return;
+        }
+        break;
+    case poison_policy::prefix: size = std::min(size, POISON_PREFIX_SIZE); break;
+    case poison_policy::full: break;
+    }
+    if (offset < size) {
+        std::memset(util::offset_rawptr(ptr, offset), pattern, size - offset);
+    }
+}
+
+inline void poison_memory(poison_policy policy, u8 pattern, void *ptr, usize size) {
+    poison_memory_from(policy, pattern, ptr, 0, size);
+}
+
+// Checked before every request, so that allocators that aren't profiled never call into the
+// profiler. This folds away completely when profiling is compiled out.
+inline bool is_profiled(const allocator *alloc) {
+    return MAX_PROFILING_TIER != profiling_tier::off && alloc->profiling != profiling_tier::off;
+}
+
+// Rounds a usable size reported by an allocator down to a multiple of `granularity`, without going
+// below the `minimum` that was asked for. 0 stays 0, since it means the request failed.
+inline usize round_usable_size(usize usable, usize minimum, usize granularity) {
+    if (usable == 0 || granularity <= 1) {
+        return usable;
+    }
+    return std::max(minimum, usable - usable % granularity);
+}
+
 inline void *general_realloc(
     allocator *alloc, const layout &old_layout, const layout &new_layout, void *old_ptr) {
     void *new_ptr = alloc->alloc(new_layout);
@@ -50,22 +90,206 @@ inline void *general_realloc(
         util::copy_nonoverlapping((u8 *)old_ptr,
             (u8 *)new_ptr,
             std::min(new_layout.size, old_layout.size));
-        util::fill(DEALLOCATION_PATTERN, (u8 *)old_ptr, old_layout.size);
-        if (new_layout.size > old_layout.size) {
-            util::fill(ALLOCATION_PATTERN,
-                (u8 *)util::offset_rawptr(new_ptr, old_layout.size),
-                new_layout.size - old_layout.size);
+        if constexpr (MAX_PROFILING_TIER != profiling_tier::off) {
+            record_realloc_move(old_ptr, new_ptr);
         }
         alloc->dealloc(old_layout, old_ptr);
     }
     return new_ptr;
 }
 
+// Unprofiled allocators skip straight to the implementation, since there is no profiler
+// bookkeeping to wrap it in. The virtual call is avoided by naming the
+// implementation explicitly, which is only correct when nothing can override it.
+template <typename A>
+inline void *alloc_with(A *alloc, const layout &layout) {
+    if constexpr (std::is_final_v<A>) {
+        VIXEN_DEBUG_ASSERT(alloc != nullptr,
+            "Tried to allocate {}, but the allocator pointer was null.",
+            layout);
+        if (likely(!is_profiled(alloc))) {
+            void *ptr = alloc->A::internal_alloc(layout);
+            poison_memory(alloc->poison, ALLOCATION_PATTERN, ptr, layout.size);
+            return ptr;
+        }
+    }
+    return alloc->alloc(layout);
+}
+
+template <typename A>
+inline void dealloc_with(A *alloc, const layout &layout, void *ptr) {
+    if constexpr (std::is_final_v<A>) {
+        VIXEN_DEBUG_ASSERT(alloc != nullptr,
+            "Tried to deallocate {} ({}), but the allocator pointer was null.",
+            ptr,
+            layout);
+        if (likely(!is_profiled(alloc))) {
+            poison_memory(alloc->poison, DEALLOCATION_PATTERN, ptr, layout.size);
+            alloc->A::internal_dealloc(layout, ptr);
+            return;
+        }
+    }
+    alloc->dealloc(layout, ptr);
+}
+
+template <typename A>
+inline void *realloc_with(
+    A *alloc, const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    if constexpr (std::is_final_v<A>) {
+        VIXEN_DEBUG_ASSERT(alloc != nullptr,
+            "Tried to reallocate {} ({}) -> {}, but the allocator pointer was null.",
+            old_ptr,
+            old_layout,
+            new_layout);
+        if (likely(!is_profiled(alloc))) {
+            void *ptr = alloc->A::internal_realloc(old_layout, new_layout, old_ptr);
+            // Moved blocks were poisoned by `alloc`, but a block that grew where it was wasn't.
+            if (ptr == old_ptr && new_layout.size > old_layout.size) {
+                poison_memory_from(alloc->poison,
+                    ALLOCATION_PATTERN,
+                    ptr,
+                    old_layout.size,
+                    new_layout.size);
+            }
+            return ptr;
+        }
+    }
+    return alloc->realloc(old_layout, new_layout, old_ptr);
+}
+
+// Allocators that don't override these only inherit the protected defaults from `allocator`, which
+// can't be named from outside, so the helpers below do what those defaults do instead.
+template <typename A, typename = void>
+struct overrides_alloc_at_least : std::false_type {};
+
+template <typename A>
+struct overrides_alloc_at_least<A,
+    std::void_t<decltype(std::declval<A &>().A::internal_alloc_at_least(
+        std::declval<const layout &>()))>> : std::true_type {};
+
+template <typename A, typename = void>
+struct overrides_resize_in_place : std::false_type {};
+
+template <typename A>
+struct overrides_resize_in_place<A,
+    std::void_t<decltype(std::declval<A &>().A::internal_try_grow_in_place(
+                    std::declval<const layout &>(), usize{}, nullptr)),
+        decltype(std::declval<A &>().A::internal_try_shrink_in_place(
+            std::declval<const layout &>(), usize{}, nullptr))>> : std::true_type {};
+
+template <typename A>
+inline allocation alloc_at_least_with(A *alloc, const layout &layout, usize granularity) {
+    if constexpr (std::is_final_v<A>) {
+        VIXEN_DEBUG_ASSERT(alloc != nullptr,
+            "Tried to allocate at least {}, but the allocator pointer was null.",
+            layout);
+        if (likely(!is_profiled(alloc) && layout.size != 0)) {
+            allocation block;
+            if constexpr (overrides_alloc_at_least<A>::value) {
+                block = alloc->A::internal_alloc_at_least(layout);
+            } else {
+                block = {alloc->A::internal_alloc(layout), layout.size};
+            }
+            block.size = round_usable_size(block.size, layout.size, granularity);
+            poison_memory(alloc->poison, ALLOCATION_PATTERN, block.ptr, block.size);
+            return block;
+        }
+    }
+    return alloc->alloc_at_least(layout, granularity);
+}
+
+template <typename A>
+inline usize try_grow_in_place_with(
+    A *alloc, const layout &old_layout, usize new_size, void *ptr, usize granularity) {
+    if constexpr (std::is_final_v<A>) {
+        VIXEN_DEBUG_ASSERT(alloc != nullptr,
+            "Tried to grow {} ({}) to {} bytes, but the allocator pointer was null.",
+            ptr,
+            old_layout,
+            new_size);
+        if (likely(!is_profiled(alloc) && ptr != nullptr)) {
+            if constexpr (!overrides_resize_in_place<A>::value) {
+                return 0;
+            } else {
+                usize usable = round_usable_size(
+                    alloc->A::internal_try_grow_in_place(old_layout, new_size, ptr),
+                    new_size,
+                    granularity);
+                if (usable > old_layout.size) {
+                    poison_memory_from(alloc->poison,
+                        ALLOCATION_PATTERN,
+                        ptr,
+                        old_layout.size,
+                        usable);
+                }
+                return usable;
+            }
+        }
+    }
+    return alloc->try_grow_in_place(old_layout, new_size, ptr, granularity);
+}
+
+template <typename A>
+inline usize try_shrink_in_place_with(
+    A *alloc, const layout &old_layout, usize new_size, void *ptr, usize granularity) {
+    if constexpr (std::is_final_v<A>) {
+        VIXEN_DEBUG_ASSERT(alloc != nullptr,
+            "Tried to shrink {} ({}) to {} bytes, but the allocator pointer was null.",
+            ptr,
+            old_layout,
+            new_size);
+        if (likely(!is_profiled(alloc) && ptr != nullptr && new_size != 0)) {
+            if constexpr (!overrides_resize_in_place<A>::value) {
+                return 0;
+            } else {
+                return round_usable_size(
+                    alloc->A::internal_try_shrink_in_place(old_layout, new_size, ptr),
+                    new_size,
+                    granularity);
+            }
+        }
+    }
+    return alloc->try_shrink_in_place(old_layout, new_size, ptr, granularity);
+}
+
 inline void *allocator::internal_realloc(
     const layout &old_layout, const layout &new_layout, void *old_ptr) {
     return general_realloc(this, old_layout, new_layout, old_ptr);
 }
 
+inline allocation allocator::internal_alloc_at_least(const layout &layout) {
+    return {this->internal_alloc(layout), layout.size};
+}
+
+inline usize allocator::internal_try_grow_in_place(const layout &, usize, void *) {
+    return 0;
+}
+
+inline usize allocator::internal_try_shrink_in_place(const layout &, usize, void *) {
+    return 0;
+}
+
+inline void allocator::internal_alloc_batch(const layout &layout, usize count, void **out_ptrs) {
+    usize allocated = 0;
+    try {
+        for (; allocated < count; ++allocated) {
+            out_ptrs[allocated] = this->internal_alloc(layout);
+        }
+    } catch (allocation_exception &ex) {
+        if (allocated > 0) {
+            this->internal_dealloc_batch(layout, allocated, out_ptrs);
+        }
+        throw;
+    }
+}
+
+inline void allocator::internal_dealloc_batch(
+    const layout &layout, usize count, void *const *ptrs) {
+    for (usize i = 0; i < count; ++i) {
+        this->internal_dealloc(layout, ptrs[i]);
+    }
+}
+
 template <typename T>
 inline T *create_uninit(allocator *alloc) {
     return (T *)alloc->alloc(layout::of<T>());
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "vixen/allocator/allocators.hpp"
+
+// Hot paths of the bump allocators live here so that callers that know the concrete allocator type,
+// like containers using `alloc_with`, can inline them. So do remote free lists, which sit on the
+// free path of every allocator that has one.
+
+namespace vixen::heap {
+
+inline void *linear_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    void *base = util::align_pointer_up(this->cursor, layout.align);
+    void *next = util::offset_rawptr(base, layout.size);
+    if (next > this->end) {
+        throw allocation_exception{};
+    }
+    this->prev_cursor = base;
+    this->cursor = next;
+    return base;
+}
+
+inline void *arena_allocator::try_allocate_in(const layout &layout, block_descriptor &block) {
+    void *aligned_ptr = util::align_pointer_up(block.current, layout.align);
+    void *next_ptr = (void *)((usize)aligned_ptr + layout.size);
+    // Bail if the allocation won't fit in this block.
+    if (next_ptr > block.end) {
+        return nullptr;
+    }
+
+    block.last = block.current;
+    block.current = next_ptr;
+    return aligned_ptr;
+}
+
+inline void *arena_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    // Only the current block is ever tried, since every block before it has already been filled
+    // up.
+    if (likely(this->current_block != nullptr)) {
+        if (void *ptr = try_allocate_in(layout, *this->current_block)) {
+            return ptr;
+        }
+    }
+    return alloc_in_new_block(layout);
+}
+
+inline bool remote_free_list::push(void *first, void *last) {
+    void *old_head = this->head.load(std::memory_order_relaxed);
+    do {
+        *(void **)last = old_head;
+    } while (!this->head.compare_exchange_weak(old_head,
+        first,
+        std::memory_order_release,
+        std::memory_order_relaxed));
+    return old_head == nullptr;
+}
+
+inline void *remote_free_list::take_all() {
+    // Cheap to check first, since most of the time nobody has freed anything remotely.
+    if (is_empty()) {
+        return nullptr;
+    }
+    return this->head.exchange(nullptr, std::memory_order_acquire);
+}
+
+inline bool remote_free_list::is_empty() const {
+    return this->head.load(std::memory_order_relaxed) == nullptr;
+}
+
+} // namespace vixen::heap
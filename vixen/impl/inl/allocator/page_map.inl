@@ -0,0 +1,28 @@
+#pragma once
+
+#include "vixen/allocator/page_map.hpp"
+
+namespace vixen::heap {
+
+template <typename F>
+inline void page_map::for_each(F &&f) const {
+    for (usize i = 0; i < PAGE_MAP_LEVEL_SIZE; ++i) {
+        interior_node *interior = this->root[i].load(std::memory_order_acquire);
+        if (!interior) {
+            continue;
+        }
+        for (usize j = 0; j < PAGE_MAP_LEVEL_SIZE; ++j) {
+            leaf_node *leaf = interior->children[j].load(std::memory_order_acquire);
+            if (!leaf) {
+                continue;
+            }
+            for (usize k = 0; k < PAGE_MAP_LEVEL_SIZE; ++k) {
+                if (usize value = leaf->values[k].load(std::memory_order_relaxed)) {
+                    f(value);
+                }
+            }
+        }
+    }
+}
+
+} // namespace vixen::heap
@@ -8,15 +8,15 @@
 
 namespace vixen {
 
-bool open_mode::is_readonly() const {
+inline bool open_mode::is_readonly() const {
     return read && !write;
 }
 
-bool open_mode::is_writeonly() const {
+inline bool open_mode::is_writeonly() const {
     return write && !read;
 }
 
-bool open_mode::is_readwrite() const {
+inline bool open_mode::is_readwrite() const {
     return read && write;
 }
 
@@ -80,7 +80,7 @@ inline vector<char> file::read_all(allocator *alloc, usize chunk_size) {
 
 } // namespace vixen
 
-vixen::open_mode operator|(vixen::open_mode const &a, vixen::open_mode const &b) {
+inline vixen::open_mode operator|(vixen::open_mode const &a, vixen::open_mode const &b) {
     VIXEN_ASSERT(a.create_mode == b.create_mode, "");
 
     vixen::open_mode n = a;
@@ -15,29 +15,29 @@ namespace vixen {
 // | Initialization and Deinitialization                                          |
 // +------------------------------------------------------------------------------+
 
-template <typename T>
-inline vector<T>::vector() {
+template <typename T, typename A>
+inline vector<T, A>::vector() {
     alloc = nullptr;
     data = nullptr;
     length = 0;
     capacity = 0;
 }
 
-template <typename T>
-inline vector<T>::vector(allocator *alloc) {
+template <typename T, typename A>
+inline vector<T, A>::vector(A *alloc) {
     this->alloc = alloc;
     data = nullptr;
     length = 0;
     capacity = 0;
 }
 
-template <typename T>
-inline vector<T>::vector(allocator *alloc, usize default_capacity) : vector(alloc) {
+template <typename T, typename A>
+inline vector<T, A>::vector(A *alloc, usize default_capacity) : vector(alloc) {
     set_capacity(default_capacity);
 }
 
-template <typename T>
-inline vector<T>::vector(allocator *alloc, const vector<T> &other) : vector(alloc) {
+template <typename T, typename A>
+inline vector<T, A>::vector(A *alloc, const vector<T, A> &other) : vector(alloc) {
     set_capacity(other.capacity);
 
     for (usize i = 0; i < other.len(); ++i) {
@@ -45,15 +45,15 @@ inline vector<T>::vector(allocator *alloc, const vector<T> &other) : vector(allo
     }
 }
 
-template <typename T>
-inline vector<T>::vector(vector<T> &&other)
+template <typename T, typename A>
+inline vector<T, A>::vector(vector<T, A> &&other)
     : alloc(util::exchange(other.alloc, nullptr))
     , data(util::exchange(other.data, nullptr))
     , length(util::exchange(other.length, 0))
     , capacity(util::exchange(other.capacity, 0)) {}
 
-template <typename T>
-inline vector<T> &vector<T>::operator=(vector<T> &&other) {
+template <typename T, typename A>
+inline vector<T, A> &vector<T, A>::operator=(vector<T, A> &&other) {
     if (std::addressof(other) == this)
         return *this;
 
@@ -64,15 +64,15 @@ inline vector<T> &vector<T>::operator=(vector<T> &&other) {
     return *this;
 }
 
-template <typename T>
-inline vector<T> vector<T>::clone(allocator *alloc) const {
+template <typename T, typename A>
+inline vector<T, A> vector<T, A>::clone(A *alloc) const {
     return vector(alloc, *this);
 }
 
-template <typename T>
-inline vector<T>::~vector() {
+template <typename T, typename A>
+inline vector<T, A>::~vector() {
     if (capacity > 0) {
-        alloc->dealloc(heap::layout::array_of<T>(capacity), data);
+        heap::dealloc_with(alloc, heap::layout::array_of<T>(capacity), data);
     }
 }
 
@@ -82,29 +82,29 @@ inline vector<T>::~vector() {
 // | Insertion and Removal                                                        |
 // +------------------------------------------------------------------------------+
 
-template <typename T>
+template <typename T, typename A>
 template <typename U>
-inline void vector<T>::push(U &&value) {
+inline void vector<T, A>::push(U &&value) {
     try_grow(1);
     util::construct_in_place(&data[length++], std::forward<U>(value));
 }
 
-// template <typename T>
+// template <typename T, typename A>
 // inline void Vec<T>::extend(slice<const T> elements) {
 //     T *new_elems = reserve(elements.len);
 //     util::copy(elements.ptr, new_elems, elements.len);
 // }
 
-template <typename T>
-inline T *vector<T>::reserve(usize elements) {
+template <typename T, typename A>
+inline T *vector<T, A>::reserve(usize elements) {
     try_grow(elements);
     T *start = data + length;
     length += elements;
     return start;
 }
 
-template <typename T>
-inline void vector<T>::truncate(usize len) {
+template <typename T, typename A>
+inline void vector<T, A>::truncate(usize len) {
     VIXEN_DEBUG_ASSERT(len <= length,
         "tried to truncate vector to {} items, but the current length was {}",
         len,
@@ -115,13 +115,13 @@ inline void vector<T>::truncate(usize len) {
     length = len;
 }
 
-template <typename T>
-inline option<T> vector<T>::pop() {
+template <typename T, typename A>
+inline option<T> vector<T, A>::pop() {
     return length == 0 ? option<T>() : data[--length];
 }
 
-template <typename T>
-inline T vector<T>::remove(usize idx) {
+template <typename T, typename A>
+inline T vector<T, A>::remove(usize idx) {
     VIXEN_DEBUG_ASSERT(length > idx,
         "tried to remove element {} from a {}-element vector",
         idx,
@@ -131,8 +131,8 @@ inline T vector<T>::remove(usize idx) {
     return data[--length];
 }
 
-template <typename T>
-inline T vector<T>::shift_remove(usize idx) {
+template <typename T, typename A>
+inline T vector<T, A>::shift_remove(usize idx) {
     VIXEN_DEBUG_ASSERT(length > idx,
         "tried to remove element {} from a {}-element vector",
         idx,
@@ -144,14 +144,14 @@ inline T vector<T>::shift_remove(usize idx) {
     return mv(old_value);
 }
 
-template <typename T>
-inline void vector<T>::clear() {
+template <typename T, typename A>
+inline void vector<T, A>::clear() {
     truncate(0);
 }
 
-template <typename T>
+template <typename T, typename A>
 template <typename U>
-T &vector<T>::shift_insert(usize idx, U &&val) {
+T &vector<T, A>::shift_insert(usize idx, U &&val) {
     VIXEN_DEBUG_ASSERT(idx <= length,
         "tried to insert element at {}, but the length was {}",
         idx,
@@ -182,8 +182,8 @@ T &vector<T>::shift_insert(usize idx, U &&val) {
 // | Algorithms                                                                   |
 // +------------------------------------------------------------------------------+
 
-template <typename T>
-inline void vector<T>::dedup_unstable() {
+template <typename T, typename A>
+inline void vector<T, A>::dedup_unstable() {
     for (usize i = 0; i < len(); ++i) {
         for (usize j = i + 1; j < len(); ++j) {
             if (data[i] == data[j]) {
@@ -193,8 +193,8 @@ inline void vector<T>::dedup_unstable() {
     }
 }
 
-template <typename T>
-inline void vector<T>::dedup() {
+template <typename T, typename A>
+inline void vector<T, A>::dedup() {
     for (usize i = 0; i < len(); ++i) {
         for (usize j = i + 1; j < len(); ++j) {
             if (data[i] == data[j]) {
@@ -204,8 +204,8 @@ inline void vector<T>::dedup() {
     }
 }
 
-template <typename T>
-inline option<usize> vector<T>::index_of(const T &value) {
+template <typename T, typename A>
+inline option<usize> vector<T, A>::index_of(const T &value) {
     for (usize i = 0; i < len(); ++i) {
         if (data[i] == value) {
             return i;
@@ -214,8 +214,8 @@ inline option<usize> vector<T>::index_of(const T &value) {
     return {};
 }
 
-template <typename T>
-inline void vector<T>::swap(usize a, usize b) {
+template <typename T, typename A>
+inline void vector<T, A>::swap(usize a, usize b) {
     VIXEN_DEBUG_ASSERT((length > a) && (length > b),
         "Tried swapping elements {} and {} in a(n) {}-element vector.",
         a,
@@ -231,60 +231,60 @@ inline void vector<T>::swap(usize a, usize b) {
 // | Accessors                                                                    |
 // +------------------------------------------------------------------------------+
 
-template <typename T>
-inline option<T &> vector<T>::first() {
+template <typename T, typename A>
+inline option<T &> vector<T, A>::first() {
     return length == 0 ? option<T &>() : data[0];
 }
 
-template <typename T>
-inline option<T &> vector<T>::last() {
+template <typename T, typename A>
+inline option<T &> vector<T, A>::last() {
     return length == 0 ? option<T &>() : data[length - 1];
 }
 
-template <typename T>
-inline option<const T &> vector<T>::first() const {
+template <typename T, typename A>
+inline option<const T &> vector<T, A>::first() const {
     return length == 0 ? option<const T &>() : data[0];
 }
 
-template <typename T>
-inline option<const T &> vector<T>::last() const {
+template <typename T, typename A>
+inline option<const T &> vector<T, A>::last() const {
     return length == 0 ? option<const T &>() : data[length - 1];
 }
 
-template <typename T>
-inline T *vector<T>::begin() {
+template <typename T, typename A>
+inline T *vector<T, A>::begin() {
     return data;
 }
 
-template <typename T>
-inline T *vector<T>::end() {
+template <typename T, typename A>
+inline T *vector<T, A>::end() {
     return &data[length];
 }
 
-template <typename T>
-inline const T *vector<T>::begin() const {
+template <typename T, typename A>
+inline const T *vector<T, A>::begin() const {
     return data;
 }
 
-template <typename T>
-inline const T *vector<T>::end() const {
+template <typename T, typename A>
+inline const T *vector<T, A>::end() const {
     return &data[length];
 }
 
-template <typename T>
-inline const T &vector<T>::operator[](usize i) const {
+template <typename T, typename A>
+inline const T &vector<T, A>::operator[](usize i) const {
     _VIXEN_BOUNDS_CHECK(i, length);
     return data[i];
 }
 
-template <typename T>
-inline T &vector<T>::operator[](usize i) {
+template <typename T, typename A>
+inline T &vector<T, A>::operator[](usize i) {
     _VIXEN_BOUNDS_CHECK(i, length);
     return data[i];
 }
 
-template <typename T>
-inline usize vector<T>::len() const {
+template <typename T, typename A>
+inline usize vector<T, A>::len() const {
     return length;
 }
 
@@ -293,24 +293,24 @@ inline usize vector<T>::len() const {
 // +------------------------------------------------------------------------------+
 // | Conversions                                                                  |
 // +------------------------------------------------------------------------------+
-template <typename T>
-inline const vector<T> &vector<T>::as_const() const {
+template <typename T, typename A>
+inline const vector<T, A> &vector<T, A>::as_const() const {
     return *this;
 }
 
-template <typename T>
-inline vector<T>::operator slice<const T>() const {
+template <typename T, typename A>
+inline vector<T, A>::operator slice<const T>() const {
     return {data, length};
 }
 
-template <typename T>
-inline vector<T>::operator slice<T>() {
+template <typename T, typename A>
+inline vector<T, A>::operator slice<T>() {
     return {data, length};
 }
 
-template <typename T>
+template <typename T, typename A>
 template <typename S>
-S &vector<T>::operator<<(S &s) {
+S &vector<T, A>::operator<<(S &s) {
     s << "[";
     if (length > 0) {
         s << data[0];
@@ -328,26 +328,57 @@ S &vector<T>::operator<<(S &s) {
 // | Internal                                                                     |
 // +------------------------------------------------------------------------------+
 
-template <typename T>
-inline usize vector<T>::next_capacity() {
+template <typename T, typename A>
+inline usize vector<T, A>::next_capacity() {
     return capacity == 0 ? default_vec_capacity : 2 * capacity;
 }
 
-template <typename T>
-inline void vector<T>::try_grow(usize elements_needed) {
+template <typename T, typename A>
+inline void vector<T, A>::try_grow(usize elements_needed) {
     usize minimum_cap_needed = length + elements_needed;
     if (minimum_cap_needed >= capacity) {
         set_capacity(std::max(next_capacity(), minimum_cap_needed));
     }
 }
 
-template <typename T>
-inline void vector<T>::set_capacity(usize cap) {
+template <typename T, typename A>
+inline void vector<T, A>::set_capacity(usize cap) {
     VIXEN_ASSERT(alloc != nullptr, "Tried to grow a vector with no allocator.");
 
-    data = (T *)alloc->realloc(heap::layout::array_of<T>(capacity),
-        heap::layout::array_of<T>(cap),
-        (void *)data);
+    heap::layout old_layout = heap::layout::array_of<T>(capacity);
+    heap::layout new_layout = heap::layout::array_of<T>(cap);
+
+    // Allocators round blocks up to size classes or pages, so use whatever slack we get for free.
+    // Usable sizes are asked for in whole elements, so that the block is later freed with exactly
+    // the size it was reported to have.
+    if (capacity == 0 && cap > 0) {
+        heap::allocation block = heap::alloc_at_least_with(alloc, new_layout, sizeof(T));
+        data = (T *)block.ptr;
+        capacity = block.size / sizeof(T);
+        return;
+    }
+
+    // Resizing the block where it is saves copying every element over.
+    usize usable = 0;
+    if (cap > capacity) {
+        usable = heap::try_grow_in_place_with(alloc,
+            old_layout,
+            new_layout.size,
+            (void *)data,
+            sizeof(T));
+    } else if (cap > 0) {
+        usable = heap::try_shrink_in_place_with(alloc,
+            old_layout,
+            new_layout.size,
+            (void *)data,
+            sizeof(T));
+    }
+    if (usable != 0) {
+        capacity = usable / sizeof(T);
+        return;
+    }
+
+    data = (T *)heap::realloc_with(alloc, old_layout, new_layout, (void *)data);
     capacity = cap;
 }
 
@@ -357,8 +388,8 @@ inline void vector<T>::set_capacity(usize cap) {
 // | Traits                                                                       |
 // +------------------------------------------------------------------------------+
 
-template <typename T, typename H>
-inline void hash(const vector<T> &values, H &hasher) {
+template <typename T, typename A, typename H>
+inline void hash(const vector<T, A> &values, H &hasher) {
     for (const T &value : values) {
         hash(value, hasher);
     }
@@ -18,7 +18,7 @@ hash_map<K, V, H, C>::hash_map(allocator *alloc, const hash_map &other)
 template <typename K, typename V, typename H, typename C>
 constexpr option<V &> hash_map<K, V, H, C>::get(const K &key) {
     if (auto slot_opt = table.find_slot(make_hash<H>(key), key)) {
-        return table.get(*slot_opt);
+        return table.get(*slot_opt).template get<1>();
     }
     return nullptr;
 }
@@ -26,7 +26,7 @@ constexpr option<V &> hash_map<K, V, H, C>::get(const K &key) {
 template <typename K, typename V, typename H, typename C>
 constexpr option<V const &> hash_map<K, V, H, C>::get(const K &key) const {
     if (auto slot_opt = table.find_slot(make_hash<H>(key), key)) {
-        return table.get(*slot_opt);
+        return table.get(*slot_opt).template get<1>();
     }
     return nullptr;
 }
@@ -44,13 +44,14 @@ constexpr option<V> hash_map<K, V, H, C>::remove(const K &key) {
 template <typename K, typename V, typename H, typename C>
 template <typename OK, typename OV>
 option<V> hash_map<K, V, H, C>::insert(OK &&key, OV &&value) {
+    table.grow_if_needed();
+
     auto hash = make_hash<H>(key);
     auto slot = table.find_insert_slot(hash, key);
 
     option<V> old;
     if (table.is_occupied(slot)) {
-        auto old_entry = mv(table.get(slot));
-        old = mv(old_entry.template get<1>());
+        old = mv(table.get(slot).template get<1>());
     }
 
     table.insert(slot, hash, tuple<K, V>{std::forward<OK>(key), std::forward<OV>(value)});
@@ -53,8 +53,6 @@ hash_table<T, H, C>::hash_table(allocator *alloc, const hash_table &other)
                 copy_construct_maybe_allocator_aware(alloc, other.buckets[i]));
         }
     }
-
-    util::copy_nonoverlapping(other.control, control, capacity);
 }
 
 template <typename T, typename H, typename C>
@@ -71,6 +69,7 @@ constexpr hash_table<T, H, C> &hash_table<T, H, C>::operator=(hash_table<T, H, C
     if (std::addressof(other) == this)
         return *this;
 
+    release_storage();
     alloc = std::exchange(other.alloc, nullptr);
 
     capacity = std::exchange(other.capacity, 0);
@@ -85,20 +84,50 @@ constexpr hash_table<T, H, C> &hash_table<T, H, C>::operator=(hash_table<T, H, C
 
 template <typename T, typename H, typename C>
 hash_table<T, H, C>::~hash_table() {
-    // not calling clear means we won't reset all of the control bytes, but that's okay since we're
-    // not doing anything else with this table afterwards.
+    release_storage();
+}
+
+template <typename T, typename H, typename C>
+void hash_table<T, H, C>::release_storage() {
+    // Moved-from and never-allocated tables don't own any storage.
+    if (control == nullptr) {
+        return;
+    }
+
     if constexpr (!std::is_trivial_v<T>) {
         clear();
     }
 
     heap::destroy_array_uninit(alloc, control, capacity);
     heap::destroy_array_uninit(alloc, buckets, capacity);
+    control = nullptr;
+    buckets = nullptr;
+}
+
+template <typename T, typename H, typename C>
+void hash_table<T, H, C>::grow_if_needed() {
+    if (capacity != 0 && !does_table_need_resize()) {
+        return;
+    }
+
+    hash_table grown(alloc, capacity == 0 ? default_hash_table_capacity : capacity * 2);
+    for (usize i = 0; i < capacity; ++i) {
+        if (!impl::is_vacant(control[i])) {
+            auto hash = make_hash<H>(C::map_entry(buckets[i]));
+            usize idx = grown.find_insert_slot(hash, C::map_entry(buckets[i]));
+            grown.insert_no_resize(idx, hash, mv(buckets[i]));
+        }
+    }
+
+    *this = mv(grown);
 }
 
+// Slots must be found *after* calling `grow_if_needed`, since growing moves every entry.
 template <typename T, typename H, typename C>
 void hash_table<T, H, C>::insert(usize slot, u64 hash, T &&value) {
-    if (does_table_need_resize()) {
-        std::exchange(*this, hash_table(alloc, *this));
+    if (is_occupied(slot)) {
+        buckets[slot].~T();
+        items -= 1;
     }
 
     insert_no_resize(slot, hash, mv(value));
@@ -117,6 +146,7 @@ constexpr void hash_table<T, H, C>::insert_no_resize(usize slot, u64 hash, T &&v
 
 template <typename T, typename H, typename C>
 constexpr void hash_table<T, H, C>::remove(usize slot) {
+    buckets[slot].~T();
     items -= 1;
     bool is_next_free = impl::is_free(control[(slot + 1) % capacity]);
     occupied -= is_next_free;
@@ -140,17 +170,24 @@ constexpr bool hash_table<T, H, C>::is_occupied(usize slot) const {
 
 template <typename T, typename H, typename C>
 constexpr void hash_table<T, H, C>::clear() {
+    // Tombstones are dropped along with the entries, so the table starts over empty.
     for (usize i = 0; i < capacity; ++i) {
         if (!impl::is_vacant(control[i])) {
             buckets[i].~T();
-            control[i] = impl::control_free;
         }
+        control[i] = impl::control_free;
     }
+    items = 0;
+    occupied = 0;
 }
 
 template <typename T, typename H, typename C>
 template <typename OT>
 constexpr option<usize> hash_table<T, H, C>::find_slot(u64 hash, const OT &value) const {
+    if (capacity == 0) {
+        return nullptr;
+    }
+
     u64 hash1 = impl::extract_h1(hash) % capacity;
     u8 hash2 = impl::extract_h2(hash);
 
@@ -205,7 +242,7 @@ constexpr usize hash_table<T, H, C>::find_insert_slot(u64 hash, const OT &value)
 template <typename T, typename H, typename C>
 constexpr bool hash_table<T, H, C>::does_table_need_resize() const {
     // integer-only check for `occupied / capacity >= 0.7`
-    return 7 * occupied >= 10 * capacity;
+    return 10 * occupied >= 7 * capacity;
 }
 
 } // namespace vixen
\ No newline at end of file
@@ -2,18 +2,52 @@
 #include "vixen/allocator/profile.hpp"
 #include "vixen/assert.hpp"
 
+#include <cstdio>
+#include <new>
 #include <unistd.h>
 
 namespace vixen::heap {
 
+// Constructs a `T` in static storage that is never destroyed, for allocators that might still be
+// used by other static objects' destructors during program teardown.
+template <typename T, typename... Args>
+static T *make_immortal(Args &&...args) {
+    alignas(T) static u8 storage[sizeof(T)];
+    return new (storage) T(std::forward<Args>(args)...);
+}
+
+static allocator *global_page_allocator() {
+    static page_allocator *g_page_allocator = make_immortal<page_allocator>();
+    return g_page_allocator;
+}
+
+static slab_allocator *global_slab_allocator() {
+    static slab_allocator *g_slab_allocator
+        = make_immortal<slab_allocator>(global_page_allocator());
+    return g_slab_allocator;
+}
+
 allocator *global_allocator() {
-    static page_allocator g_global_allocator{};
-    return &g_global_allocator;
+#ifdef VIXEN_PAGE_GLOBAL_ALLOCATOR
+    return global_page_allocator();
+#else
+    static thread_cache_allocator *g_global_allocator
+        = make_immortal<thread_cache_allocator>(global_slab_allocator());
+    return g_global_allocator;
+#endif
 }
 
 legacy_allocator *legacy_global_allocator() {
-    static legacy_adapter_allocator g_global_adapter{global_allocator()};
-    return &g_global_adapter;
+    // Small blocks have to come out of a slab for their size to be found without a header, so they
+    // get a slab of their own when the global allocator only deals in pages.
+#ifdef VIXEN_PAGE_GLOBAL_ALLOCATOR
+    static slab_legacy_allocator *g_legacy_allocator
+        = make_immortal<slab_legacy_allocator>(global_slab_allocator(), global_page_allocator());
+#else
+    static slab_legacy_allocator *g_legacy_allocator
+        = make_immortal<slab_legacy_allocator>(global_allocator(), global_page_allocator());
+#endif
+    return g_legacy_allocator;
 }
 
 allocator *debug_allocator() {
@@ -26,15 +60,43 @@ usize page_size() {
     return g_page_size;
 }
 
+static usize read_huge_page_size() {
+    usize size = 2 * 1024 * 1024;
+    FILE *meminfo = std::fopen("/proc/meminfo", "r");
+    if (meminfo == nullptr) {
+        return size;
+    }
+
+    char line[128];
+    unsigned long kib;
+    while (std::fgets(line, sizeof(line), meminfo) != nullptr) {
+        if (std::sscanf(line, "Hugepagesize: %lu kB", &kib) == 1) {
+            size = kib * 1024;
+            break;
+        }
+    }
+    std::fclose(meminfo);
+    return size;
+}
+
+usize huge_page_size() {
+    static usize g_huge_page_size = read_huge_page_size();
+    return g_huge_page_size;
+}
+
 void *allocator::alloc(const layout &layout) {
     VIXEN_ASSERT(this != nullptr,
         "Tried to allocate {}, but the allocator pointer was null.",
         layout);
-    begin_transaction(id);
-    void *ptr = this->internal_alloc(layout);
-    record_alloc(id, layout, ptr);
-    end_transaction(id);
-    std::memset(ptr, ALLOCATION_PATTERN, layout.size);
+    void *ptr;
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        ptr = this->internal_alloc(layout);
+        record_alloc(id, layout, ptr);
+    } else {
+        ptr = this->internal_alloc(layout);
+    }
+    poison_memory(this->poison, ALLOCATION_PATTERN, ptr, layout.size);
     return ptr;
 }
 
@@ -43,11 +105,16 @@ void allocator::dealloc(const layout &layout, void *ptr) {
         "Tried to deallocate {} ({}), but the allocator pointer was null.",
         ptr,
         layout);
-    std::memset(ptr, DEALLOCATION_PATTERN, layout.size);
-    begin_transaction(id);
-    this->internal_dealloc(layout, ptr);
-    record_dealloc(id, layout, ptr);
-    end_transaction(id);
+    poison_memory(this->poison, DEALLOCATION_PATTERN, ptr, layout.size);
+    // The block is recorded as freed before it's given back, since another thread could be handed
+    // the same block and record allocating it as soon as it is.
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        record_dealloc(id, layout, ptr);
+        this->internal_dealloc(layout, ptr);
+    } else {
+        this->internal_dealloc(layout, ptr);
+    }
 }
 
 void *allocator::realloc(const layout &old_layout, const layout &new_layout, void *old_ptr) {
@@ -57,20 +124,179 @@ void *allocator::realloc(const layout &old_layout, const layout &new_layout, voi
         old_layout,
         new_layout);
 
-    begin_transaction(id);
-    void *ptr = this->internal_realloc(old_layout, new_layout, old_ptr);
-    record_realloc(id, old_layout, old_ptr, new_layout, ptr);
-    end_transaction(id);
+    void *ptr;
+    if (is_profiled(this)) {
+        // Like in `dealloc`, the old block has to stop being recorded before it can be freed.
+        transaction_scope scope(id);
+        record_realloc_start(id, old_layout, old_ptr, new_layout);
+        try {
+            ptr = this->internal_realloc(old_layout, new_layout, old_ptr);
+        } catch (allocation_exception &) {
+            record_realloc_failed(id, old_ptr);
+            throw;
+        }
+        record_realloc(id, old_layout, old_ptr, new_layout, ptr);
+    } else {
+        ptr = this->internal_realloc(old_layout, new_layout, old_ptr);
+    }
 
-    // TODO: debug memsetting!
+    // Moved blocks were poisoned by `alloc`, but a block that grew where it was wasn't.
+    if (ptr == old_ptr && new_layout.size > old_layout.size) {
+        poison_memory_from(this->poison, ALLOCATION_PATTERN, ptr, old_layout.size, new_layout.size);
+    }
     return ptr;
 }
 
+allocation allocator::alloc_at_least(const layout &layout, usize granularity) {
+    VIXEN_ASSERT(this != nullptr,
+        "Tried to allocate at least {}, but the allocator pointer was null.",
+        layout);
+    if (layout.size == 0) {
+        return {nullptr, 0};
+    }
+
+    allocation block;
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        block = this->internal_alloc_at_least(layout);
+        block.size = round_usable_size(block.size, layout.size, granularity);
+        record_alloc_at_least(id, layout, block.size, block.ptr);
+    } else {
+        block = this->internal_alloc_at_least(layout);
+        block.size = round_usable_size(block.size, layout.size, granularity);
+    }
+    poison_memory(this->poison, ALLOCATION_PATTERN, block.ptr, block.size);
+    return block;
+}
+
+usize allocator::try_grow_in_place(
+    const layout &old_layout, usize new_size, void *ptr, usize granularity) {
+    VIXEN_ASSERT(this != nullptr,
+        "Tried to grow {} ({}) to {} bytes, but the allocator pointer was null.",
+        ptr,
+        old_layout,
+        new_size);
+    VIXEN_DEBUG_ASSERT(new_size >= old_layout.size,
+        "Tried to grow {} ({}) to {} bytes, which is smaller.",
+        ptr,
+        old_layout,
+        new_size);
+    if (ptr == nullptr) {
+        return 0;
+    }
+
+    usize usable;
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        usable = this->internal_try_grow_in_place(old_layout, new_size, ptr);
+        usable = round_usable_size(usable, new_size, granularity);
+        if (usable != 0) {
+            record_resize_in_place(id, old_layout, new_size, usable, ptr);
+        }
+    } else {
+        usable = this->internal_try_grow_in_place(old_layout, new_size, ptr);
+        usable = round_usable_size(usable, new_size, granularity);
+    }
+
+    if (usable > old_layout.size) {
+        poison_memory_from(this->poison, ALLOCATION_PATTERN, ptr, old_layout.size, usable);
+    }
+    return usable;
+}
+
+usize allocator::try_shrink_in_place(
+    const layout &old_layout, usize new_size, void *ptr, usize granularity) {
+    VIXEN_ASSERT(this != nullptr,
+        "Tried to shrink {} ({}) to {} bytes, but the allocator pointer was null.",
+        ptr,
+        old_layout,
+        new_size);
+    VIXEN_DEBUG_ASSERT(new_size <= old_layout.size,
+        "Tried to shrink {} ({}) to {} bytes, which is bigger.",
+        ptr,
+        old_layout,
+        new_size);
+    if (ptr == nullptr || new_size == 0) {
+        return 0;
+    }
+
+    if (!is_profiled(this)) {
+        return round_usable_size(this->internal_try_shrink_in_place(old_layout, new_size, ptr),
+            new_size,
+            granularity);
+    }
+
+    transaction_scope scope(id);
+    usize usable = round_usable_size(this->internal_try_shrink_in_place(old_layout, new_size, ptr),
+        new_size,
+        granularity);
+    if (usable != 0) {
+        record_resize_in_place(id, old_layout, new_size, usable, ptr);
+    }
+    return usable;
+}
+
+void allocator::alloc_batch(const layout &layout, usize count, void **out_ptrs) {
+    VIXEN_ASSERT(this != nullptr,
+        "Tried to allocate {} blocks of {}, but the allocator pointer was null.",
+        count,
+        layout);
+    if (count == 0) {
+        return;
+    }
+    if (layout.size == 0) {
+        util::fill((void *)nullptr, out_ptrs, count);
+        return;
+    }
+
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        this->internal_alloc_batch(layout, count, out_ptrs);
+        record_alloc_batch(id, layout, count, out_ptrs);
+    } else {
+        this->internal_alloc_batch(layout, count, out_ptrs);
+    }
+
+    if (this->poison != poison_policy::off) {
+        for (usize i = 0; i < count; ++i) {
+            poison_memory(this->poison, ALLOCATION_PATTERN, out_ptrs[i], layout.size);
+        }
+    }
+}
+
+void allocator::dealloc_batch(const layout &layout, usize count, void *const *ptrs) {
+    VIXEN_ASSERT(this != nullptr,
+        "Tried to deallocate {} blocks of {}, but the allocator pointer was null.",
+        count,
+        layout);
+    if (count == 0 || layout.size == 0) {
+        return;
+    }
+
+    if (this->poison != poison_policy::off) {
+        for (usize i = 0; i < count; ++i) {
+            poison_memory(this->poison, DEALLOCATION_PATTERN, ptrs[i], layout.size);
+        }
+    }
+
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        record_dealloc_batch(id, layout, count, ptrs);
+        this->internal_dealloc_batch(layout, count, ptrs);
+    } else {
+        this->internal_dealloc_batch(layout, count, ptrs);
+    }
+}
+
 void resettable_allocator::reset() {
-    begin_transaction(id);
+    if (!is_profiled(this)) {
+        internal_reset();
+        return;
+    }
+
+    transaction_scope scope(id);
     internal_reset();
     record_reset(id);
-    end_transaction(id);
 }
 
 void *legacy_allocator::internal_alloc(const layout &layout) {
@@ -96,11 +322,15 @@ void *legacy_allocator::legacy_alloc(usize size) {
     VIXEN_ASSERT(this != nullptr,
         "Tried to legacy allocate {} bytes, but the allocator pointer was null.",
         size);
-    begin_transaction(id);
-    void *ptr = this->internal_legacy_alloc(size);
-    record_legacy_alloc(id, size, ptr);
-    end_transaction(id);
-    std::memset(ptr, ALLOCATION_PATTERN, size);
+    void *ptr;
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        ptr = this->internal_legacy_alloc(size);
+        record_legacy_alloc(id, size, ptr);
+    } else {
+        ptr = this->internal_legacy_alloc(size);
+    }
+    poison_memory(this->poison, ALLOCATION_PATTERN, ptr, size);
     return ptr;
 }
 
@@ -108,10 +338,14 @@ void legacy_allocator::legacy_dealloc(void *ptr) {
     VIXEN_ASSERT(this != nullptr,
         "Tried to legacy deallocate {}, but the allocator pointer was null.",
         ptr);
-    begin_transaction(id);
-    this->internal_legacy_dealloc(ptr);
-    record_legacy_dealloc(id, ptr);
-    end_transaction(id);
+    // Recorded before the block is given back, like in `allocator::dealloc`.
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        record_legacy_dealloc(id, ptr);
+        this->internal_legacy_dealloc(ptr);
+    } else {
+        this->internal_legacy_dealloc(ptr);
+    }
 }
 
 void *legacy_allocator::legacy_realloc(usize new_size, void *old_ptr) {
@@ -119,11 +353,24 @@ void *legacy_allocator::legacy_realloc(usize new_size, void *old_ptr) {
         "Tried to legacy reallocate {} to new size of {} bytes, but the allocator pointer was null.",
         old_ptr,
         new_size);
-    begin_transaction(id);
-    void *ptr = this->internal_legacy_realloc(new_size, old_ptr);
-    record_legacy_realloc(id, old_ptr, new_size, ptr);
-    end_transaction(id);
-    // TODO: debug memsetting!
+    // Only the part past the old block is new, and its size has to be read before it can move.
+    usize old_size = 0;
+    if (this->poison != poison_policy::off && old_ptr != nullptr) {
+        old_size = this->internal_legacy_size(old_ptr);
+    }
+
+    void *ptr;
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        ptr = this->internal_legacy_realloc(new_size, old_ptr);
+        record_legacy_realloc(id, old_ptr, new_size, ptr);
+    } else {
+        ptr = this->internal_legacy_realloc(new_size, old_ptr);
+    }
+
+    if (ptr != nullptr && new_size > old_size) {
+        poison_memory_from(this->poison, ALLOCATION_PATTERN, ptr, old_size, new_size);
+    }
     return ptr;
 }
 
@@ -2,30 +2,12 @@
 #include "vixen/allocator/profile.hpp"
 
 namespace vixen::heap {
-void *arena_allocator::try_allocate_in(const layout &layout, block_descriptor &block) {
-    void *aligned_ptr = util::align_pointer_up(block.current, layout.align);
-    void *next_ptr = (void *)((usize)aligned_ptr + layout.size);
-    // Bail if the allocation won't fit in this block.
-    if (next_ptr > block.end) {
-        return nullptr;
-    }
-
-    block.last = block.current;
-    block.current = next_ptr;
-    return aligned_ptr;
+static usize log2_floor(usize n) {
+    return (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(n);
 }
 
-void *arena_allocator::try_allocate_in_chain(const layout &layout, block_descriptor &block) {
-    arena_allocator::block_descriptor *current_block = &block;
-    while (current_block) {
-        void *allocated = try_allocate_in(layout, *current_block);
-        if (allocated) {
-            return allocated;
-        } else {
-            current_block = current_block->next;
-        }
-    }
-    return nullptr;
+static usize block_size(const arena_allocator::block_descriptor *block) {
+    return (usize)block->end - (usize)block->start;
 }
 
 arena_allocator::block_descriptor *arena_allocator::allocate_block(const layout &required_layout) {
@@ -34,80 +16,226 @@ arena_allocator::block_descriptor *arena_allocator::allocate_block(const layout
     if (!block) {
         return nullptr;
     }
-    usize new_size = std::max(this->last_size * 2, required_layout.size);
+    usize new_size = std::max(std::min(this->last_size * 2, this->max_block_size),
+        required_layout.size);
     void *ptr = this->parent->alloc(required_layout.with_size(new_size));
     if (!ptr) {
         this->parent->dealloc(layout::of<block_descriptor>(), (void *)block);
         return nullptr;
     }
 
+    // Oversized blocks don't count towards growth, so one big allocation doesn't make every block
+    // after it just as big.
+    this->last_size = std::max(this->last_size, std::min(new_size, this->max_block_size));
+
     block->next = nullptr;
     block->start = ptr;
     block->current = block->start;
     block->end = (void *)((usize)ptr + new_size);
     block->last = ptr;
     block->block_layout = required_layout.with_size(new_size);
+    block->used_this_cycle = true;
     return block;
 }
 
+void arena_allocator::free_block(block_descriptor *block) {
+    this->parent->dealloc(block->block_layout, block->start);
+    this->parent->dealloc(layout::of<block_descriptor>(), block);
+}
+
+void arena_allocator::push_spare(block_descriptor *block) {
+    usize bucket = log2_floor(block_size(block));
+    block->current = block->start;
+    block->last = block->start;
+    block->next = this->spare_blocks[bucket];
+    this->spare_blocks[bucket] = block;
+    this->spare_bitmap |= (u64)1 << bucket;
+}
+
+// Finds a spare block that is big enough for `required_layout` no matter where its alignment
+// padding lands, by only looking in buckets whose smallest block is big enough.
+arena_allocator::block_descriptor *arena_allocator::take_spare(const layout &required_layout) {
+    usize required_size = required_layout.size + required_layout.align - 1;
+    usize bucket = log2_floor(required_size);
+    if (((usize)1 << bucket) < required_size) {
+        bucket += 1;
+    }
+    if (bucket >= ARENA_SPARE_BUCKET_COUNT) {
+        return nullptr;
+    }
+
+    u64 candidates = this->spare_bitmap & (~(u64)0 << bucket);
+    if (!candidates) {
+        return nullptr;
+    }
+    bucket = __builtin_ctzll(candidates);
+
+    block_descriptor *block = this->spare_blocks[bucket];
+    this->spare_blocks[bucket] = block->next;
+    if (!block->next) {
+        this->spare_bitmap &= ~((u64)1 << bucket);
+    }
+    block->next = nullptr;
+    block->used_this_cycle = true;
+    return block;
+}
+
+void arena_allocator::release_spares() {
+    for (usize i = 0; i < ARENA_SPARE_BUCKET_COUNT; ++i) {
+        block_descriptor *block = this->spare_blocks[i];
+        while (block) {
+            block_descriptor *next = block->next;
+            free_block(block);
+            block = next;
+        }
+        this->spare_blocks[i] = nullptr;
+    }
+    this->spare_bitmap = 0;
+}
+
 void arena_allocator::internal_reset() {
-    this->current_block = this->blocks;
+    // Take every spare out of the buckets, so they can be sorted into the ones this cycle used and
+    // the ones that went unused for a whole cycle, which are above the high-water mark.
+    block_descriptor *old_spares = nullptr;
+    for (usize i = 0; i < ARENA_SPARE_BUCKET_COUNT; ++i) {
+        block_descriptor *block = this->spare_blocks[i];
+        while (block) {
+            block_descriptor *next = block->next;
+            block->next = old_spares;
+            old_spares = block;
+            block = next;
+        }
+        this->spare_blocks[i] = nullptr;
+    }
+    this->spare_bitmap = 0;
+
+    usize retained = 0;
+    auto retain_or_free = [&](block_descriptor *block) {
+        usize size = block_size(block);
+        if (block->used_this_cycle && retained + size <= this->retain_size) {
+            retained += size;
+            block->used_this_cycle = false;
+            push_spare(block);
+        } else {
+            free_block(block);
+        }
+    };
+
     block_descriptor *current_block = this->blocks;
     while (current_block) {
-        current_block->current = current_block->start;
-        current_block = current_block->next;
+        block_descriptor *next_block = current_block->next;
+        retain_or_free(current_block);
+        current_block = next_block;
     }
+    while (old_spares) {
+        block_descriptor *next_block = old_spares->next;
+        retain_or_free(old_spares);
+        old_spares = next_block;
+    }
+
+    this->blocks = nullptr;
+    this->current_block = nullptr;
+}
+
+arena_allocator::savepoint arena_allocator::save() const {
+    if (!this->current_block) {
+        return {nullptr, nullptr, nullptr};
+    }
+    return {this->current_block, this->current_block->current, this->current_block->last};
 }
 
-arena_allocator::arena_allocator(allocator *alloc) {
+void arena_allocator::restore(const savepoint &point) {
+    // Every block after the saved one was started after the savepoint, so it goes back to the
+    // spares. A savepoint taken before the first block was started empties out every block.
+    block_descriptor *first_empty = point.block ? point.block->next : this->blocks;
+
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        if (point.block) {
+            record_restore(id, point.current, point.block->end);
+        }
+        for (block_descriptor *block = first_empty; block; block = block->next) {
+            record_restore(id, block->start, block->end);
+        }
+    }
+
+    while (first_empty) {
+        block_descriptor *next = first_empty->next;
+        push_spare(first_empty);
+        first_empty = next;
+    }
+
+    if (point.block) {
+        point.block->current = point.current;
+        point.block->last = point.last;
+        point.block->next = nullptr;
+        this->current_block = point.block;
+    } else {
+        this->blocks = nullptr;
+        this->current_block = nullptr;
+    }
+}
+
+arena_allocator::arena_allocator(allocator *alloc, usize max_block_size, usize retain_size) {
     this->last_size = 32;
+    this->max_block_size = max_block_size;
+    this->retain_size = retain_size;
     this->blocks = nullptr;
     this->current_block = nullptr;
     this->parent = alloc;
 }
 
 arena_allocator::~arena_allocator() {
-    reset();
+    release_spares();
 
     block_descriptor *current_block = this->blocks;
     while (current_block) {
         block_descriptor *next_block = current_block->next;
-        this->parent->dealloc(current_block->block_layout, current_block->start);
-        this->parent->dealloc(layout::of<block_descriptor>(), current_block);
+        free_block(current_block);
         current_block = next_block;
     }
 }
 
+// Only the most recent allocation in the current block has room after it.
+usize arena_allocator::internal_try_grow_in_place(const layout &, usize new_size, void *ptr) {
+    if (!this->current_block || ptr != this->current_block->last) {
+        return 0;
+    }
+
+    void *new_current = util::offset_rawptr(ptr, new_size);
+    if (new_current > this->current_block->end) {
+        return 0;
+    }
+    this->current_block->current = new_current;
+    return new_size;
+}
+
+// Anything can shrink by just not using its tail, but only the most recent allocation can give
+// the tail back.
+usize arena_allocator::internal_try_shrink_in_place(const layout &, usize new_size, void *ptr) {
+    if (this->current_block && ptr == this->current_block->last) {
+        this->current_block->current = util::offset_rawptr(ptr, new_size);
+    }
+    return new_size;
+}
+
 void *arena_allocator::internal_realloc(
     const layout &old_layout, const layout &new_layout, void *old_ptr) {
     _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
 
     // Differing alignments probably won't happen, or will be exceedingly rare, so we shouldn't
     // burden ourselves with needing to think about alignment in the rest of this method.
-    bool are_alignments_same = new_layout.align == old_layout.align;
-    bool fits_in_block = util::offset_rawptr(old_ptr, new_layout.size) < this->current_block->end;
-
-    if (are_alignments_same && fits_in_block) {
-        // Optimize shrinking reallocs
-        if (new_layout.size < old_layout.size) {
-            // Actually shrink the current block if its the last one.
-            if (old_ptr == this->current_block->last) {
-                this->current_block->current = util::offset_rawptr(old_ptr, new_layout.size);
-                return this->current_block->current;
-            }
-            // Just hand back the old pointer, because shrinking a block will never trigger a
-            // relocation. If we can't shrink the block because it's not current, then we can just
-            // do nothing and say we shrank it.
-            return old_ptr;
-        }
-
-        // Optimize last-allocation grows
-        if (old_ptr == current_block->last) {
-            this->current_block->current = util::offset_rawptr(old_ptr, new_layout.size);
-            return old_ptr;
-        }
+    if (new_layout.align != old_layout.align) {
+        return general_realloc(this, old_layout, new_layout, old_ptr);
     }
 
+    if (new_layout.size <= old_layout.size) {
+        internal_try_shrink_in_place(old_layout, new_layout.size, old_ptr);
+        return old_ptr;
+    }
+    if (internal_try_grow_in_place(old_layout, new_layout.size, old_ptr) != 0) {
+        return old_ptr;
+    }
     return general_realloc(this, old_layout, new_layout, old_ptr);
 }
 
@@ -116,31 +244,46 @@ void arena_allocator::internal_dealloc(const layout &layout, void *ptr) {
 
     // Don't grow if we can rewind the last allocation. Very good for loops that push a bunch of
     // items to a vector, since the entire thing will just grow in place.
-    if (ptr == this->current_block->last) {
+    if (this->current_block && ptr == this->current_block->last) {
         this->current_block->current = this->current_block->last;
     }
 }
 
-void *arena_allocator::internal_alloc(const layout &layout) {
-    _VIXEN_ALLOC_PROLOGUE(layout)
+void arena_allocator::internal_alloc_batch(const layout &layout, usize count, void **out_ptrs) {
+    // Carve the whole batch out of one run, so that there's only one check for room.
+    usize stride = util::align_pointer_up(layout.size, layout.align);
+    usize run_size;
+    if (__builtin_mul_overflow(stride, count - 1, &run_size)
+        || __builtin_add_overflow(run_size, layout.size, &run_size))
+    {
+        throw allocation_exception{};
+    }
 
-    void *ptr = try_allocate_in_chain(layout, *this->current_block);
-    if (!ptr) {
-        block_descriptor *new_block = allocate_block(layout);
-        this->last_size = (usize)new_block->end - (usize)new_block->start;
-        // Note that the call to `try_allocate_in_chain` changes `this->current_block`, so
-        // if we get to this point, then `this->current_block` is the last block.
-        if (!this->blocks) {
-            this->blocks = new_block;
-            this->current_block = new_block;
-        } else {
-            this->current_block->next = new_block;
-            this->current_block = new_block;
-        }
+    void *base = internal_alloc({run_size, layout.align});
+    for (usize i = 0; i < count; ++i) {
+        out_ptrs[i] = util::offset_rawptr(base, i * stride);
+    }
+
+    // Make the last block of the batch look like the last allocation, so it can still be rewound
+    // or grown in place.
+    this->current_block->last = out_ptrs[count - 1];
+}
+
+void *arena_allocator::alloc_in_new_block(const layout &layout) {
+    // Prefer reusing a spare block to asking the parent for a new one.
+    block_descriptor *new_block = take_spare(layout);
+    if (!new_block) {
+        new_block = allocate_block(layout);
+    }
 
-        ptr = try_allocate_in(layout, *new_block);
+    if (!this->blocks) {
+        this->blocks = new_block;
+    } else {
+        this->current_block->next = new_block;
     }
+    this->current_block = new_block;
 
+    void *ptr = try_allocate_in(layout, *new_block);
     if (ptr == nullptr) {
         throw allocation_exception{};
     }
@@ -0,0 +1,221 @@
+#include "vixen/allocator/allocators.hpp"
+
+namespace vixen::heap {
+
+constexpr u8 BLOCK_FREE_BIT = 0x80;
+
+static usize log2_floor(usize n) {
+    return (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(n);
+}
+
+static usize log2_ceil(usize n) {
+    return n <= 1 ? 0 : log2_floor(n - 1) + 1;
+}
+
+buddy_allocator::buddy_allocator(allocator *parent, usize region_size, usize min_block_size)
+    : parent(parent) {
+    // Blocks need room for their free list links, and the state byte only has room for orders
+    // below the free bit.
+    this->min_order = std::max(log2_ceil(min_block_size), log2_ceil(sizeof(free_block)));
+    this->max_order = std::max(log2_ceil(region_size), this->min_order);
+    VIXEN_ASSERT(this->max_order - this->min_order < BUDDY_MAX_ORDER_COUNT
+            && this->max_order < BLOCK_FREE_BIT,
+        "Buddy allocator region of {} bytes has too many orders.",
+        region_size);
+
+    // Aligning the region to its own size means that every block is aligned to its size too.
+    usize size = (usize)1 << this->max_order;
+    this->start = parent->alloc({size, size});
+    this->block_states = (u8 *)parent->alloc(layout::array_of<u8>(size >> this->min_order));
+    util::fill((u8)0, this->block_states, size >> this->min_order);
+
+    push_free(this->max_order, 0);
+}
+
+buddy_allocator::~buddy_allocator() {
+    usize size = (usize)1 << this->max_order;
+    this->parent->dealloc(layout::array_of<u8>(size >> this->min_order), this->block_states);
+    this->parent->dealloc({size, size}, this->start);
+}
+
+bool buddy_allocator::owns(const void *ptr) const {
+    usize offset = (usize)ptr - (usize)this->start;
+    return ptr >= this->start && offset < ((usize)1 << this->max_order);
+}
+
+usize buddy_allocator::order_of(const layout &layout) const {
+    return std::max(log2_ceil(std::max(layout.size, layout.align)), this->min_order);
+}
+
+void buddy_allocator::push_free(usize order, usize offset) {
+    auto *block = (free_block *)util::offset_rawptr(this->start, offset);
+    free_block *&head = this->free_lists[order - this->min_order];
+    block->prev = nullptr;
+    block->next = head;
+    if (head) {
+        head->prev = block;
+    }
+    head = block;
+    this->block_states[offset >> this->min_order] = BLOCK_FREE_BIT | (u8)order;
+}
+
+void buddy_allocator::remove_free(usize order, usize offset) {
+    auto *block = (free_block *)util::offset_rawptr(this->start, offset);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        this->free_lists[order - this->min_order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    this->block_states[offset >> this->min_order] = 0;
+}
+
+void *buddy_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    usize order = order_of(layout);
+    if (order > this->max_order) {
+        return this->parent->alloc(layout);
+    }
+
+    usize found = order;
+    while (found <= this->max_order && !this->free_lists[found - this->min_order]) {
+        ++found;
+    }
+    if (found > this->max_order) {
+        return this->parent->alloc(layout);
+    }
+
+    usize offset = (usize)this->free_lists[found - this->min_order] - (usize)this->start;
+    remove_free(found, offset);
+
+    // Split the block in half until it's the right size, freeing the upper halves.
+    while (found > order) {
+        --found;
+        push_free(found, offset + ((usize)1 << found));
+    }
+
+    this->block_states[offset >> this->min_order] = (u8)order;
+    return util::offset_rawptr(this->start, offset);
+}
+
+void buddy_allocator::internal_dealloc(const layout &layout, void *ptr) {
+    _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
+
+    if (!owns(ptr)) {
+        this->parent->dealloc(layout, ptr);
+        return;
+    }
+
+    usize offset = (usize)ptr - (usize)this->start;
+    usize order = this->block_states[offset >> this->min_order];
+    VIXEN_DEBUG_ASSERT(order >= this->min_order && order <= this->max_order,
+        "Tried to deallocate {}, which is not the start of a used block.",
+        ptr);
+
+    // Keep merging with our buddy for as long as it's free and hasn't been split.
+    while (order < this->max_order) {
+        usize buddy = offset ^ ((usize)1 << order);
+        if (this->block_states[buddy >> this->min_order] != (BLOCK_FREE_BIT | order)) {
+            break;
+        }
+        remove_free(order, buddy);
+        this->block_states[offset >> this->min_order] = 0;
+        offset = std::min(offset, buddy);
+        ++order;
+    }
+
+    push_free(order, offset);
+}
+
+bool buddy_allocator::resize_in_place(usize offset, usize new_order) {
+    usize order = this->block_states[offset >> this->min_order];
+
+    // Shrink by handing back upper halves. Their buddies are the lower halves we keep using, so
+    // there is nothing to merge with.
+    if (new_order <= order) {
+        while (order > new_order) {
+            --order;
+            push_free(order, offset + ((usize)1 << order));
+        }
+        this->block_states[offset >> this->min_order] = (u8)order;
+        return true;
+    }
+
+    // We can only grow in place if we are the lower buddy at every order on the way up, and
+    // every upper buddy is free and whole. Check everything before touching anything.
+    for (usize o = order; o < new_order; ++o) {
+        usize buddy = offset + ((usize)1 << o);
+        if ((offset & ((usize)1 << o)) != 0
+            || this->block_states[buddy >> this->min_order] != (BLOCK_FREE_BIT | o))
+        {
+            return false;
+        }
+    }
+
+    for (usize o = order; o < new_order; ++o) {
+        remove_free(o, offset + ((usize)1 << o));
+    }
+    this->block_states[offset >> this->min_order] = (u8)new_order;
+    return true;
+}
+
+void *buddy_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    usize new_order = order_of(new_layout);
+    if (!owns(old_ptr)) {
+        if (new_order > this->max_order) {
+            return this->parent->realloc(old_layout, new_layout, old_ptr);
+        }
+        return general_realloc(this, old_layout, new_layout, old_ptr);
+    }
+
+    usize offset = (usize)old_ptr - (usize)this->start;
+    if (new_order > this->max_order || !resize_in_place(offset, new_order)) {
+        return general_realloc(this, old_layout, new_layout, old_ptr);
+    }
+    return old_ptr;
+}
+
+// Blocks are always a power of two, so requests get rounded up to the whole block.
+allocation buddy_allocator::internal_alloc_at_least(const layout &layout) {
+    usize order = order_of(layout);
+    if (order > this->max_order) {
+        return this->parent->alloc_at_least(layout);
+    }
+
+    void *ptr = internal_alloc(layout);
+    return {ptr, owns(ptr) ? (usize)1 << order : layout.size};
+}
+
+// Blocks that don't live in the region belong to the parent, which resizes them however it can.
+usize buddy_allocator::internal_try_grow_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    if (!owns(ptr)) {
+        return this->parent->try_grow_in_place(old_layout, new_size, ptr);
+    }
+
+    usize new_order = order_of(old_layout.with_size(new_size));
+    usize offset = (usize)ptr - (usize)this->start;
+    if (new_order > this->max_order || !resize_in_place(offset, new_order)) {
+        return 0;
+    }
+    return (usize)1 << new_order;
+}
+
+usize buddy_allocator::internal_try_shrink_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    if (!owns(ptr)) {
+        return this->parent->try_shrink_in_place(old_layout, new_size, ptr);
+    }
+
+    usize new_order = order_of(old_layout.with_size(new_size));
+    resize_in_place((usize)ptr - (usize)this->start, new_order);
+    return (usize)1 << new_order;
+}
+
+} // namespace vixen::heap
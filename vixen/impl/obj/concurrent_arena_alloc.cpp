@@ -0,0 +1,172 @@
+#include "vixen/allocator/allocators.hpp"
+
+#include <new>
+
+namespace vixen::heap {
+
+// Every bump is rounded up to a multiple of this, so that the cursor stays aligned to it and most
+// allocations can get away with a single fetch-add.
+constexpr usize GRANULE = 16;
+
+static usize block_data_offset() {
+    return util::align_pointer_up(sizeof(concurrent_arena_allocator::block_descriptor), GRANULE);
+}
+
+static layout block_layout(usize data_size) {
+    return {block_data_offset() + data_size, GRANULE};
+}
+
+concurrent_arena_allocator::concurrent_arena_allocator(allocator *parent)
+    : current_block(nullptr), parent(parent) {}
+
+concurrent_arena_allocator::~concurrent_arena_allocator() {
+    reset();
+
+    block_descriptor *block = this->current_block.load(std::memory_order_acquire);
+    if (block) {
+        free_block(block);
+    }
+}
+
+concurrent_arena_allocator::block_descriptor *concurrent_arena_allocator::allocate_block(
+    usize min_size) {
+    block_descriptor *previous = this->current_block.load(std::memory_order_acquire);
+    usize size = std::max(previous ? previous->size * 2 : page_size(), min_size);
+    size = util::align_pointer_up(size, GRANULE);
+
+    void *raw = this->parent->alloc(block_layout(size));
+    auto *block = new (raw) block_descriptor;
+    block->cursor.store(0, std::memory_order_relaxed);
+    block->start = util::offset_rawptr(raw, block_data_offset());
+    block->size = size;
+    block->prev = nullptr;
+    return block;
+}
+
+void concurrent_arena_allocator::free_block(block_descriptor *block) {
+    this->parent->dealloc(block_layout(block->size), (void *)block);
+}
+
+void *concurrent_arena_allocator::try_allocate_in(const layout &layout, block_descriptor *block) {
+    usize size = util::align_pointer_up(layout.size, GRANULE);
+
+    if (layout.align <= GRANULE) {
+        usize offset = block->cursor.fetch_add(size, std::memory_order_relaxed);
+        if (offset + size > block->size) {
+            return nullptr;
+        }
+        return util::offset_rawptr(block->start, offset);
+    }
+
+    // Over-aligned requests need to know where the cursor is before they can bump it, so they
+    // have to go through a CAS loop instead.
+    usize offset = block->cursor.load(std::memory_order_relaxed);
+    loop {
+        if (offset >= block->size) {
+            return nullptr;
+        }
+        usize base = (usize)block->start;
+        usize aligned_offset = util::align_pointer_up(base + offset, layout.align) - base;
+        if (aligned_offset + size > block->size) {
+            return nullptr;
+        }
+        if (block->cursor.compare_exchange_weak(offset,
+                aligned_offset + size,
+                std::memory_order_relaxed))
+        {
+            return util::offset_rawptr(block->start, aligned_offset);
+        }
+    }
+}
+
+void *concurrent_arena_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    block_descriptor *block = this->current_block.load(std::memory_order_acquire);
+    loop {
+        if (block) {
+            if (void *ptr = try_allocate_in(layout, block)) {
+                return ptr;
+            }
+        }
+
+        // The block we saw is full, so build a new one privately, allocate out of it, and then
+        // try to publish it. If another thread beat us to it, throw ours away and go try theirs.
+        usize padding = layout.align > GRANULE ? layout.align : 0;
+        block_descriptor *new_block = allocate_block(layout.size + padding);
+        void *ptr = try_allocate_in(layout, new_block);
+        new_block->prev = block;
+
+        if (this->current_block.compare_exchange_strong(block,
+                new_block,
+                std::memory_order_acq_rel,
+                std::memory_order_acquire))
+        {
+            return ptr;
+        }
+        free_block(new_block);
+    }
+}
+
+void concurrent_arena_allocator::internal_dealloc(const layout &layout, void *ptr) {
+    _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
+
+    // Rewind the cursor if this was the most recent allocation and nobody has allocated since.
+    block_descriptor *block = this->current_block.load(std::memory_order_acquire);
+    if (!block) {
+        return;
+    }
+    usize offset = (usize)ptr - (usize)block->start;
+    usize end_offset = offset + util::align_pointer_up(layout.size, GRANULE);
+    if (ptr >= block->start && end_offset <= block->size) {
+        block->cursor.compare_exchange_strong(end_offset, offset, std::memory_order_relaxed);
+    }
+}
+
+void *concurrent_arena_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    if (new_layout.align <= old_layout.align) {
+        if (new_layout.size <= old_layout.size) {
+            return old_ptr;
+        }
+
+        // Grow in place if this is the most recent allocation in the current block. The CAS
+        // fails if anyone else allocated after us, in which case we just fall back to copying.
+        block_descriptor *block = this->current_block.load(std::memory_order_acquire);
+        if (block && old_ptr >= block->start) {
+            usize offset = (usize)old_ptr - (usize)block->start;
+            usize old_end = offset + util::align_pointer_up(old_layout.size, GRANULE);
+            usize new_end = offset + util::align_pointer_up(new_layout.size, GRANULE);
+            if (new_end <= block->size
+                && block->cursor.compare_exchange_strong(old_end,
+                    new_end,
+                    std::memory_order_relaxed))
+            {
+                return old_ptr;
+            }
+        }
+    }
+
+    return general_realloc(this, old_layout, new_layout, old_ptr);
+}
+
+void concurrent_arena_allocator::internal_reset() {
+    block_descriptor *block = this->current_block.load(std::memory_order_acquire);
+    if (!block) {
+        return;
+    }
+
+    block_descriptor *current = block->prev;
+    while (current) {
+        block_descriptor *prev = current->prev;
+        free_block(current);
+        current = prev;
+    }
+
+    block->prev = nullptr;
+    block->cursor.store(0, std::memory_order_relaxed);
+}
+
+} // namespace vixen::heap
@@ -51,4 +51,8 @@ void *legacy_adapter_allocator::internal_legacy_realloc(usize new_size, void *ol
     }
 }
 
+usize legacy_adapter_allocator::internal_legacy_size(const void *ptr) const {
+    return read_alloc_size(util::offset_rawptr((void *)ptr, -MAX_LEGACY_ALIGNMENT));
+}
+
 } // namespace vixen::heap
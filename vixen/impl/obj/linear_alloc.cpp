@@ -8,12 +8,45 @@ linear_allocator::linear_allocator(void *block, usize len) {
     this->prev_cursor = block;
 }
 
+linear_allocator::~linear_allocator() {}
+
+linear_allocator::savepoint linear_allocator::save() const {
+    return {this->cursor, this->prev_cursor};
+}
+
+void linear_allocator::restore(const savepoint &point) {
+    if (is_profiled(this)) {
+        transaction_scope scope(id);
+        record_restore(id, point.cursor, this->cursor);
+    }
+    this->cursor = point.cursor;
+    this->prev_cursor = point.prev_cursor;
+}
+
 void linear_allocator::internal_reset() {
     this->cursor = this->start;
     this->prev_cursor = this->start;
 }
 
-// NOTE: look at the implemntation of `ArenaAlloc::internal_realloc` for explanation!
+// Only the most recent allocation has room after it.
+usize linear_allocator::internal_try_grow_in_place(const layout &, usize new_size, void *ptr) {
+    void *new_cursor = util::offset_rawptr(ptr, new_size);
+    if (ptr != this->prev_cursor || new_cursor > this->end) {
+        return 0;
+    }
+    this->cursor = new_cursor;
+    return new_size;
+}
+
+// Anything can shrink by just not using its tail, but only the most recent allocation can give
+// the tail back.
+usize linear_allocator::internal_try_shrink_in_place(const layout &, usize new_size, void *ptr) {
+    if (ptr == this->prev_cursor) {
+        this->cursor = util::offset_rawptr(ptr, new_size);
+    }
+    return new_size;
+}
+
 void *linear_allocator::internal_realloc(
     const layout &old_layout, const layout &new_layout, void *old_ptr) {
     _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
@@ -22,38 +55,14 @@ void *linear_allocator::internal_realloc(
         return general_realloc(this, old_layout, new_layout, old_ptr);
     }
 
-    if (new_layout.size < old_layout.size) {
-        if (old_ptr == this->prev_cursor) {
-            this->cursor = util::offset_rawptr(old_ptr, new_layout.size);
-            return this->cursor;
-        }
+    if (new_layout.size <= old_layout.size) {
+        internal_try_shrink_in_place(old_layout, new_layout.size, old_ptr);
         return old_ptr;
     }
-
-    if (old_ptr != this->prev_cursor || util::offset_rawptr(old_ptr, new_layout.size) > this->end) {
-        return general_realloc(this, old_layout, new_layout, old_ptr);
-    }
-
-    // Grow in-place
-    if (new_layout.size > old_layout.size) {
-        this->cursor = util::offset_rawptr(old_ptr, new_layout.size);
+    if (internal_try_grow_in_place(old_layout, new_layout.size, old_ptr) != 0) {
         return old_ptr;
     }
-
-    VIXEN_UNREACHABLE("linear_allocator::internal_realloc got to end of function.");
-    return nullptr;
-}
-
-void *linear_allocator::internal_alloc(const layout &layout) {
-    _VIXEN_ALLOC_PROLOGUE(layout)
-
-    void *base = util::align_pointer_up(this->cursor, layout.align);
-    void *next = util::offset_rawptr(base, layout.size);
-    if (next > this->end) {
-        throw allocation_exception{};
-    }
-    this->cursor = next;
-    return base;
+    return general_realloc(this, old_layout, new_layout, old_ptr);
 }
 
 void linear_allocator::internal_dealloc(const layout &layout, void *ptr) {
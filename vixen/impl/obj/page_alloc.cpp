@@ -1,46 +1,222 @@
 #include "vixen/allocator/allocators.hpp"
+#include "vixen/allocator/trace.hpp"
 
 #include <sys/mman.h>
 
 namespace vixen::heap {
-static usize allocation_size(const layout &layout) {
-    // If this layout's alignment is less the the page alignment, then we know that the alignment
-    // requirements for layout will be satisfied in whatever is returned by mmap. However, if
-    // layout's alignment is larger than the page alignment, we need an extra alignment's worth
-    // of padding minus one page to play with to ensure that out allocation will be properly
-    // aligned.
-    usize size_with_align = layout.align > page_size() ? layout.size + layout.align : layout.size;
-    usize allocation_size = util::align_pointer_up(size_with_align, page_size());
+static usize allocation_size(const layout &layout, usize granularity) {
+    return util::align_pointer_up(layout.size, granularity);
+}
 
-    return allocation_size;
+// mmap only promises page alignment, or huge page alignment for `MAP_HUGETLB` mappings. Anything
+// above that, including the huge page granularity itself when we map regular pages, needs an extra
+// alignment's worth of padding minus one guaranteed alignment so that the aligned block still fits.
+static usize mapping_size(const layout &layout, usize granularity, int extra_flags) {
+    usize guaranteed = (extra_flags & MAP_HUGETLB) ? granularity : page_size();
+    usize target = std::max(layout.align, granularity);
+    usize padding = target > guaranteed ? target - guaranteed : 0;
+    return allocation_size(layout, granularity) + padding;
 }
 
-void *page_allocator::internal_alloc(const layout &layout) {
-    _VIXEN_ALLOC_PROLOGUE(layout);
+void *map_pages(void *address, usize size, int flags, int fd) {
+    void *ptr = mmap(address, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+    // Kernels that don't know about `MAP_FIXED_NOREPLACE` treat the address as a hint.
+    if ((flags & MAP_FIXED_NOREPLACE) && ptr != address) {
+        munmap(ptr, size);
+        return nullptr;
+    }
+    return ptr;
+}
 
-    usize size = allocation_size(layout);
-    void *base_ptr
-        = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (base_ptr == MAP_FAILED) {
-        throw allocation_exception{};
+// Maps enough pages of `granularity` bytes to hold `layout`, aligned to both the layout and the
+// granularity. Returns null instead of throwing so that callers can try again with other flags.
+static void *map_aligned(const layout &layout, usize granularity, int extra_flags) {
+    usize size = mapping_size(layout, granularity, extra_flags);
+    void *base_ptr = map_pages(nullptr, size, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags);
+    if (base_ptr == nullptr) {
+        return nullptr;
     }
-    void *aligned_ptr = util::align_pointer_up(base_ptr, layout.align);
+    void *aligned_ptr
+        = util::align_pointer_up(base_ptr, std::max(layout.align, granularity));
 
-    // Large alignments will often leave a bunch of padding before the usable allocation, so we
-    // just unmap that here so we don't have to keep track of anything for dealloc.
+    // Large alignments will often leave a bunch of padding on both sides of the usable allocation,
+    // so we just unmap that here so we don't have to keep track of anything for dealloc.
     if (base_ptr != aligned_ptr) {
         munmap(base_ptr, (usize)aligned_ptr - (usize)base_ptr);
     }
+    void *usable_end = util::offset_rawptr(aligned_ptr, allocation_size(layout, granularity));
+    void *mapping_end = util::offset_rawptr(base_ptr, size);
+    if (usable_end != mapping_end) {
+        munmap(usable_end, (usize)mapping_end - (usize)usable_end);
+    }
 
     return aligned_ptr;
 }
 
+page_allocator::page_allocator(huge_page_policy policy)
+    : page_allocator(policy, huge_page_size()) {}
+
+page_allocator::page_allocator(huge_page_policy policy, usize huge_page_threshold)
+    : policy(policy), huge_page_threshold(huge_page_threshold) {}
+
+bool page_allocator::wants_huge_pages(const layout &layout) const {
+    return policy != huge_page_policy::none && layout.size >= huge_page_threshold;
+}
+
+void *page_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout);
+
+    if (!wants_huge_pages(layout)) {
+        void *ptr = map_aligned(layout, page_size(), 0);
+        if (ptr == nullptr) {
+            throw allocation_exception{};
+        }
+        return ptr;
+    }
+
+    // Everything on the huge page path is sized and aligned in huge pages, even when we fall back
+    // to regular pages, so that dealloc doesn't need to know which path was taken.
+    usize granularity = huge_page_size();
+    page_mapping_kind requested = policy == huge_page_policy::transparent_huge
+        ? page_mapping_kind::transparent_huge
+        : page_mapping_kind::explicit_huge;
+
+    if (policy == huge_page_policy::explicit_huge || policy == huge_page_policy::automatic) {
+        if (void *ptr = map_aligned(layout, granularity, MAP_HUGETLB)) {
+            if (is_profiled(this)) {
+                record_page_mapping(id, requested, page_mapping_kind::explicit_huge);
+            }
+            return ptr;
+        }
+    }
+
+    void *ptr = map_aligned(layout, granularity, 0);
+    if (ptr == nullptr) {
+        throw allocation_exception{};
+    }
+
+    page_mapping_kind actual = page_mapping_kind::regular;
+    if (policy != huge_page_policy::explicit_huge
+        && madvise(ptr, allocation_size(layout, granularity), MADV_HUGEPAGE) == 0)
+    {
+        actual = page_mapping_kind::transparent_huge;
+    }
+    if (is_profiled(this)) {
+        record_page_mapping(id, requested, actual);
+    }
+    return ptr;
+}
+
+usize page_allocator::granularity_of(const layout &layout) const {
+    return wants_huge_pages(layout) ? huge_page_size() : page_size();
+}
+
+// The whole mapping is usable, unless reporting its full size would put it on the other side of
+// the huge page threshold, where it would be unmapped with the wrong granularity.
+usize page_allocator::usable_size(const layout &layout) const {
+    usize size = allocation_size(layout, granularity_of(layout));
+    bool same_granularity = wants_huge_pages(layout.with_size(size)) == wants_huge_pages(layout);
+    return same_granularity ? size : layout.size;
+}
+
+allocation page_allocator::internal_alloc_at_least(const layout &layout) {
+    return {internal_alloc(layout), usable_size(layout)};
+}
+
+// A mapping that just grew past the huge page threshold gets the same treatment that a fresh huge
+// allocation would have gotten, minus `MAP_HUGETLB`, which can't be applied after the fact.
+void page_allocator::advise_resized(const layout &old_layout, const layout &new_layout, void *ptr) {
+    bool profiled = is_profiled(this);
+    bool old_huge = wants_huge_pages(old_layout);
+    bool new_huge = wants_huge_pages(new_layout);
+
+    if (new_huge && policy != huge_page_policy::explicit_huge) {
+        usize new_size = allocation_size(new_layout, huge_page_size());
+        bool advised = madvise(ptr, new_size, MADV_HUGEPAGE) == 0;
+        if (!old_huge && profiled) {
+            page_mapping_kind requested = policy == huge_page_policy::transparent_huge
+                ? page_mapping_kind::transparent_huge
+                : page_mapping_kind::explicit_huge;
+            record_page_mapping(id,
+                requested,
+                advised ? page_mapping_kind::transparent_huge : page_mapping_kind::regular);
+        }
+    } else if (new_huge && !old_huge && profiled) {
+        record_page_mapping(id, page_mapping_kind::explicit_huge, page_mapping_kind::regular);
+    }
+}
+
+// Resizes the mapping without moving it, which only works if the pages after it are free when
+// growing, and never splits a huge page when shrinking.
+usize page_allocator::resize_in_place(const layout &old_layout, usize new_size, void *ptr) {
+    layout new_layout = old_layout.with_size(new_size);
+    usize old_mapped = allocation_size(old_layout, granularity_of(old_layout));
+    usize new_mapped = allocation_size(new_layout, granularity_of(new_layout));
+
+    if (old_mapped != new_mapped) {
+        if (mremap(ptr, old_mapped, new_mapped, 0) == MAP_FAILED) {
+            return 0;
+        }
+        advise_resized(old_layout, new_layout, ptr);
+    }
+    return usable_size(new_layout);
+}
+
+usize page_allocator::internal_try_grow_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    return resize_in_place(old_layout, new_size, ptr);
+}
+
+usize page_allocator::internal_try_shrink_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    return resize_in_place(old_layout, new_size, ptr);
+}
+
+void *page_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    // Try resizing the mapping where it is first, which keeps any alignment the old pointer had.
+    bool is_aligned = ((usize)old_ptr & (new_layout.align - 1)) == 0;
+    if (is_aligned && resize_in_place(old_layout, new_layout.size, old_ptr) != 0) {
+        return old_ptr;
+    }
+
+    // Otherwise, let the kernel move the pages somewhere with enough room. The new mapping is only
+    // guaranteed to be page-aligned, so over-aligned layouts have to be copied instead. The kernel
+    // frees the old pages before the move can be traced, so traced moves are copied too.
+    if (new_layout.align <= page_size() && !is_event_tracing()) {
+        usize old_size = allocation_size(old_layout, granularity_of(old_layout));
+        usize new_size = allocation_size(new_layout, granularity_of(new_layout));
+        void *new_ptr = mremap(old_ptr, old_size, new_size, MREMAP_MAYMOVE);
+        if (new_ptr != MAP_FAILED) {
+            advise_resized(old_layout, new_layout, new_ptr);
+            // The block moved without going through `alloc`, so its tail still needs poisoning.
+            if (new_ptr != old_ptr && new_layout.size > old_layout.size) {
+                poison_memory_from(this->poison,
+                    ALLOCATION_PATTERN,
+                    new_ptr,
+                    old_layout.size,
+                    new_layout.size);
+            }
+            return new_ptr;
+        }
+    }
+
+    return general_realloc(this, old_layout, new_layout, old_ptr);
+}
+
 void page_allocator::internal_dealloc(const layout &layout, void *ptr) {
     _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
 
+    usize granularity = granularity_of(layout);
+
     // Note that munmap should never fail here because we will never split a mapped region, only
     // unmap the entire range.
-    munmap(ptr, allocation_size(layout));
+    munmap(ptr, allocation_size(layout, granularity));
 }
 
 } // namespace vixen::heap
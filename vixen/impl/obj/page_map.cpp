@@ -0,0 +1,126 @@
+#include "vixen/allocator/page_map.hpp"
+
+#include "vixen/allocator/allocator.hpp"
+
+namespace vixen::heap {
+
+static usize page_number(const void *ptr) {
+    return (usize)ptr >> PAGE_MAP_PAGE_SHIFT;
+}
+
+static usize root_index(usize page) {
+    return page >> (2 * PAGE_MAP_LEVEL_BITS);
+}
+
+static usize interior_index(usize page) {
+    return (page >> PAGE_MAP_LEVEL_BITS) & (PAGE_MAP_LEVEL_SIZE - 1);
+}
+
+static usize leaf_index(usize page) {
+    return page & (PAGE_MAP_LEVEL_SIZE - 1);
+}
+
+// Allocates a node with every entry zeroed, which is a valid state for an array of atomics.
+template <typename N>
+static N *create_node(allocator *parent) {
+    N *node = (N *)parent->alloc(layout::of<N>());
+    util::fill((u8)0, (u8 *)node, sizeof(N));
+    return node;
+}
+
+page_map::page_map(allocator *parent) : parent(parent) {}
+
+page_map::~page_map() {
+    for (usize i = 0; i < PAGE_MAP_LEVEL_SIZE; ++i) {
+        interior_node *interior = this->root[i].load(std::memory_order_relaxed);
+        if (!interior) {
+            continue;
+        }
+        for (usize j = 0; j < PAGE_MAP_LEVEL_SIZE; ++j) {
+            leaf_node *leaf = interior->children[j].load(std::memory_order_relaxed);
+            if (leaf) {
+                this->parent->dealloc(layout::of<leaf_node>(), (void *)leaf);
+            }
+        }
+        this->parent->dealloc(layout::of<interior_node>(), (void *)interior);
+    }
+}
+
+usize page_map::get(const void *ptr) const {
+    usize page = page_number(ptr);
+    if (root_index(page) >= PAGE_MAP_LEVEL_SIZE) {
+        return 0;
+    }
+
+    interior_node *interior = this->root[root_index(page)].load(std::memory_order_acquire);
+    if (!interior) {
+        return 0;
+    }
+    leaf_node *leaf = interior->children[interior_index(page)].load(std::memory_order_acquire);
+    if (!leaf) {
+        return 0;
+    }
+    return leaf->values[leaf_index(page)].load(std::memory_order_acquire);
+}
+
+// Threads racing to create the same node both allocate one, and the loser gives its copy back.
+page_map::leaf_node *page_map::get_or_create_leaf(usize page) {
+    VIXEN_ASSERT(root_index(page) < PAGE_MAP_LEVEL_SIZE,
+        "Tried to map page {}, which is outside of the 48-bit address space.",
+        page);
+
+    std::atomic<interior_node *> &interior_slot = this->root[root_index(page)];
+    interior_node *interior = interior_slot.load(std::memory_order_acquire);
+    if (!interior) {
+        interior_node *fresh = create_node<interior_node>(this->parent);
+        if (interior_slot.compare_exchange_strong(interior,
+                fresh,
+                std::memory_order_acq_rel,
+                std::memory_order_acquire))
+        {
+            interior = fresh;
+        } else {
+            this->parent->dealloc(layout::of<interior_node>(), (void *)fresh);
+        }
+    }
+
+    std::atomic<leaf_node *> &leaf_slot = interior->children[interior_index(page)];
+    leaf_node *leaf = leaf_slot.load(std::memory_order_acquire);
+    if (!leaf) {
+        leaf_node *fresh = create_node<leaf_node>(this->parent);
+        if (leaf_slot.compare_exchange_strong(leaf,
+                fresh,
+                std::memory_order_acq_rel,
+                std::memory_order_acquire))
+        {
+            leaf = fresh;
+        } else {
+            this->parent->dealloc(layout::of<leaf_node>(), (void *)fresh);
+        }
+    }
+    return leaf;
+}
+
+void page_map::set(const void *ptr, usize value) {
+    usize page = page_number(ptr);
+    get_or_create_leaf(page)->values[leaf_index(page)].store(value, std::memory_order_release);
+}
+
+void page_map::set_range(const void *ptr, usize len, usize value) {
+    if (len == 0) {
+        return;
+    }
+
+    usize first = page_number(ptr);
+    usize last = page_number(util::offset_rawptr((rawptr)ptr, len - 1));
+    leaf_node *leaf = nullptr;
+    for (usize page = first; page <= last; ++page) {
+        // Only look the leaf up again when crossing into a new one.
+        if (!leaf || leaf_index(page) == 0) {
+            leaf = get_or_create_leaf(page);
+        }
+        leaf->values[leaf_index(page)].store(value, std::memory_order_release);
+    }
+}
+
+} // namespace vixen::heap
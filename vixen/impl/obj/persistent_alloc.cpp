@@ -0,0 +1,255 @@
+#include "vixen/allocator/allocators.hpp"
+#include "vixen/io/file.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace vixen::heap {
+// "VIXNHEAP"
+constexpr u64 PERSISTENT_MAGIC = 0x5649584e48454150;
+// Bumped whenever the layout of the header changes.
+constexpr u32 PERSISTENT_VERSION = 1;
+// Free blocks keep the next free block in their first bytes.
+constexpr usize PERSISTENT_MIN_BLOCK_SIZE = 16;
+
+struct persistent_header {
+    u64 magic;
+    u32 version;
+    // A build with a different allocator layout can't reuse the allocator in the file.
+    u32 allocator_size;
+
+    void *address;
+    usize capacity;
+    void *cursor;
+    void *root;
+    bool is_open;
+
+    void *free_lists[PERSISTENT_SIZE_CLASS_COUNT];
+};
+
+// The allocator object sits right after the header, and blocks start right after the allocator.
+constexpr usize PERSISTENT_ALLOCATOR_OFFSET = util::align_pointer_up(sizeof(persistent_header), 64);
+constexpr usize PERSISTENT_DATA_OFFSET
+    = util::align_pointer_up(PERSISTENT_ALLOCATOR_OFFSET + sizeof(persistent_allocator), 64);
+
+static usize log2_ceil(usize n) {
+    return n <= 1 ? 0 : (sizeof(unsigned long long) * 8) - __builtin_clzll(n - 1);
+}
+
+static usize size_class_of(const layout &layout) {
+    return log2_ceil(std::max({layout.size, layout.align, PERSISTENT_MIN_BLOCK_SIZE}));
+}
+
+static usize class_size(usize size_class) {
+    return (usize)1 << size_class;
+}
+
+// Every block of a class is aligned the same way, so that any free block can serve any request
+// that maps to its class.
+static usize class_align(usize size_class) {
+    return std::min(class_size(size_class), page_size());
+}
+
+static void *heap_end(const persistent_header *header) {
+    return util::offset_rawptr(header->address, header->capacity);
+}
+
+persistent_allocator::persistent_allocator(
+    persistent_header *header, bool reopened, bool closed_cleanly)
+    : header(header), reopened(reopened), closed_cleanly(closed_cleanly) {}
+
+persistent_allocator *persistent_allocator::open(const char *path, usize capacity, void *address) {
+    // `mode::create` can't be or'd with the others, since they have no create mode.
+    file backing(path, open_mode{true, true, true, false, false, 0644});
+    if (backing.fd < 0) {
+        throw allocation_exception{};
+    }
+
+    struct stat info;
+    if (fstat(backing.fd, &info) != 0) {
+        throw allocation_exception{};
+    }
+
+    bool is_new = info.st_size == 0;
+    if (is_new) {
+        capacity = util::align_pointer_up(std::max(capacity, PERSISTENT_DATA_OFFSET), page_size());
+        if (ftruncate(backing.fd, capacity) != 0) {
+            throw allocation_exception{};
+        }
+    } else {
+        persistent_header existing;
+        if (pread(backing.fd, &existing, sizeof(existing), 0) != sizeof(existing)
+            || existing.magic != PERSISTENT_MAGIC)
+        {
+            VIXEN_PANIC("Tried to open '{}' as a persistent heap, but it isn't one.", path);
+        }
+        if (existing.version != PERSISTENT_VERSION
+            || existing.allocator_size != sizeof(persistent_allocator))
+        {
+            VIXEN_PANIC("Tried to open persistent heap '{}', but it was made by another version.",
+                path);
+        }
+        if ((usize)info.st_size != existing.capacity) {
+            VIXEN_PANIC("Tried to open persistent heap '{}', but it was resized to {} bytes.",
+                path,
+                info.st_size);
+        }
+        capacity = existing.capacity;
+        address = existing.address;
+    }
+
+    // The mapping stays valid after `backing` closes the file.
+    void *base = map_pages(address, capacity, MAP_SHARED | MAP_FIXED_NOREPLACE, backing.fd);
+    if (base == nullptr) {
+        // Leaving the file at its new size would make every later `open` take it for a foreign
+        // file, since it has no header, so put it back to the empty file this call found.
+        if (is_new && ftruncate(backing.fd, 0) != 0) {
+            VIXEN_WARN("Could not empty '{}' after failing to map it.", path);
+        }
+        throw allocation_exception{};
+    }
+
+    persistent_header *header = (persistent_header *)base;
+    if (is_new) {
+        header->magic = PERSISTENT_MAGIC;
+        header->version = PERSISTENT_VERSION;
+        header->allocator_size = sizeof(persistent_allocator);
+        header->address = base;
+        header->capacity = capacity;
+        header->cursor = util::offset_rawptr(base, PERSISTENT_DATA_OFFSET);
+        header->root = nullptr;
+        header->is_open = false;
+        for (usize i = 0; i < PERSISTENT_SIZE_CLASS_COUNT; ++i) {
+            header->free_lists[i] = nullptr;
+        }
+    }
+
+    bool closed_cleanly = !header->is_open;
+    header->is_open = true;
+
+    // Constructing the allocator over the old one gives it this process's vtable, and a fresh
+    // profiler id, while keeping its address the same.
+    void *location = util::offset_rawptr(base, PERSISTENT_ALLOCATOR_OFFSET);
+    return new (location) persistent_allocator(header, !is_new, closed_cleanly);
+}
+
+bool persistent_allocator::close(persistent_allocator *alloc) {
+    persistent_header *header = alloc->header;
+    usize capacity = header->capacity;
+
+    header->is_open = false;
+    alloc->~persistent_allocator();
+    bool synced = msync(header, capacity, MS_SYNC) == 0;
+    munmap(header, capacity);
+    return synced;
+}
+
+bool persistent_allocator::flush() {
+    return msync(this->header, this->header->capacity, MS_SYNC) == 0;
+}
+
+void *persistent_allocator::root() const {
+    return this->header->root;
+}
+
+void persistent_allocator::set_root(void *root) {
+    this->header->root = root;
+}
+
+bool persistent_allocator::was_reopened() const {
+    return this->reopened;
+}
+
+bool persistent_allocator::was_closed_cleanly() const {
+    return this->closed_cleanly;
+}
+
+void *persistent_allocator::bump(usize size_class) {
+    void *base = util::align_pointer_up(this->header->cursor, class_align(size_class));
+    usize remaining = (usize)heap_end(this->header) - (usize)base;
+    if (base > heap_end(this->header) || class_size(size_class) > remaining) {
+        throw allocation_exception{};
+    }
+    this->header->cursor = util::offset_rawptr(base, class_size(size_class));
+    return base;
+}
+
+void *persistent_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    if (layout.align > page_size()) {
+        throw allocation_exception{};
+    }
+
+    usize size_class = size_class_of(layout);
+    if (void *block = this->header->free_lists[size_class]) {
+        this->header->free_lists[size_class] = *(void **)block;
+        return block;
+    }
+    return bump(size_class);
+}
+
+void persistent_allocator::internal_dealloc(const layout &layout, void *ptr) {
+    _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
+
+    usize size_class = size_class_of(layout);
+    if (util::offset_rawptr(ptr, class_size(size_class)) == this->header->cursor) {
+        this->header->cursor = ptr;
+        return;
+    }
+    *(void **)ptr = this->header->free_lists[size_class];
+    this->header->free_lists[size_class] = ptr;
+}
+
+allocation persistent_allocator::internal_alloc_at_least(const layout &layout) {
+    return {internal_alloc(layout), class_size(size_class_of(layout))};
+}
+
+// Moving within the block's class is free. Past that, only the most recent block can change class,
+// by moving the cursor, so that every block is always freed into the list of the class it really
+// has. Returns the size of the block's class afterwards, or 0 if it couldn't change.
+usize persistent_allocator::resize_in_place(void *ptr, usize old_class, usize new_class) {
+    if (new_class == old_class) {
+        return class_size(old_class);
+    }
+
+    void *old_end = util::offset_rawptr(ptr, class_size(old_class));
+    usize remaining = (usize)heap_end(this->header) - (usize)ptr;
+    if (old_end != this->header->cursor || (usize)ptr % class_align(new_class) != 0
+        || class_size(new_class) > remaining)
+    {
+        return 0;
+    }
+    this->header->cursor = util::offset_rawptr(ptr, class_size(new_class));
+    return class_size(new_class);
+}
+
+usize persistent_allocator::internal_try_grow_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    return resize_in_place(ptr,
+        size_class_of(old_layout),
+        size_class_of(old_layout.with_size(new_size)));
+}
+
+usize persistent_allocator::internal_try_shrink_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    return resize_in_place(ptr,
+        size_class_of(old_layout),
+        size_class_of(old_layout.with_size(new_size)));
+}
+
+// The block is described by `new_layout` afterwards, so its class has to be the one `new_layout`
+// maps to, which can be smaller than the old one even when only the alignment went down.
+void *persistent_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    if (new_layout.align <= old_layout.align
+        && resize_in_place(old_ptr, size_class_of(old_layout), size_class_of(new_layout)) != 0)
+    {
+        return old_ptr;
+    }
+    return general_realloc(this, old_layout, new_layout, old_ptr);
+}
+
+} // namespace vixen::heap
@@ -0,0 +1,252 @@
+#include "vixen/allocator/allocators.hpp"
+
+namespace vixen::heap {
+
+// Every slot has to be able to hold a free list link, and has to stay aligned when slots are laid
+// out back to back.
+static layout normalize_slot_layout(layout slot_layout) {
+    usize align = std::max(slot_layout.align, alignof(void *));
+    usize size = std::max(slot_layout.size, sizeof(void *));
+    return {util::align_pointer_up(size, align), align};
+}
+
+static usize chunk_data_offset(usize align) {
+    return util::align_pointer_up(sizeof(pool_allocator::chunk_header), align);
+}
+
+pool_allocator::pool_allocator(allocator *parent, layout slot_layout, usize slots_per_chunk)
+    : slot_layout(normalize_slot_layout(slot_layout)),
+      slots_per_chunk(std::max(slots_per_chunk, (usize)1)),
+      parent(parent) {}
+
+pool_allocator::~pool_allocator() {
+    chunk_header *current = this->chunks;
+    while (current) {
+        chunk_header *next = current->next;
+        this->parent->dealloc(chunk_layout(), (void *)current);
+        current = next;
+    }
+}
+
+layout pool_allocator::chunk_layout() const {
+    usize data_size = this->slot_layout.size * this->slots_per_chunk;
+    return {chunk_data_offset(this->slot_layout.align) + data_size,
+        std::max(this->slot_layout.align, alignof(chunk_header))};
+}
+
+bool pool_allocator::fits(const layout &layout) const {
+    return layout.size <= this->slot_layout.size && layout.align <= this->slot_layout.align;
+}
+
+query_info pool_allocator::occupancy() const {
+    query_info info;
+    info.bytes_in_use = this->slots_in_use * this->slot_layout.size;
+    info.active_allocations = this->slots_in_use;
+    info.maximum_bytes_in_use = this->maximum_slots_in_use * this->slot_layout.size;
+    info.maximum_active_allocations = this->maximum_slots_in_use;
+    info.reserved_bytes = this->chunk_count * this->slots_per_chunk * this->slot_layout.size;
+    return info;
+}
+
+void pool_allocator::grow() {
+    layout layout = chunk_layout();
+    auto *chunk = (chunk_header *)this->parent->alloc(layout);
+    chunk->next = this->chunks;
+    this->chunks = chunk;
+    this->chunk_count += 1;
+
+    this->bump = util::offset_rawptr(chunk, chunk_data_offset(this->slot_layout.align));
+    this->bump_end
+        = util::offset_rawptr(this->bump, this->slot_layout.size * this->slots_per_chunk);
+
+    if (is_profiled(this)) {
+        record_reserve(id, this->slot_layout.size * this->slots_per_chunk);
+    }
+}
+
+// Takes over every slot freed by other threads once our own free list is empty. Returns whether
+// there were any.
+bool pool_allocator::collect_remote_frees() {
+    void *remote = this->remote_frees.take_all();
+    if (!remote) {
+        return false;
+    }
+
+    usize count = 0;
+    for (void *slot = remote; slot; slot = *(void **)slot) {
+        count += 1;
+    }
+    this->free_list = remote;
+    this->slots_in_use -= count;
+    return true;
+}
+
+// Pools are often built on one thread and handed to another to use, so ownership is only decided
+// by who allocates first.
+void pool_allocator::claim_ownership() {
+    // Once claimed, only the owner gets this far, so the common case is a plain load.
+    std::thread::id owner = this->owner_thread.load(std::memory_order_acquire);
+    if (owner == std::thread::id()
+        && this->owner_thread.compare_exchange_strong(owner,
+            std::this_thread::get_id(),
+            std::memory_order_release,
+            std::memory_order_acquire)) {
+        owner = std::this_thread::get_id();
+    }
+    VIXEN_DEBUG_ASSERT(std::this_thread::get_id() == owner,
+        "Tried to allocate from a pool owned by another thread.");
+}
+
+void *pool_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    if (!fits(layout)) {
+        return this->parent->alloc(layout);
+    }
+    claim_ownership();
+
+    void *ptr;
+    if (this->free_list || collect_remote_frees()) {
+        ptr = this->free_list;
+        this->free_list = *(void **)ptr;
+    } else {
+        if (this->bump == this->bump_end) {
+            grow();
+        }
+        ptr = this->bump;
+        this->bump = util::offset_rawptr(this->bump, this->slot_layout.size);
+    }
+
+    this->slots_in_use += 1;
+    this->maximum_slots_in_use = std::max(this->maximum_slots_in_use, this->slots_in_use);
+    return ptr;
+}
+
+// Every slot is the same size, so anything that fits in a slot gets all of it, and can be resized
+// freely as long as it still fits.
+allocation pool_allocator::internal_alloc_at_least(const layout &layout) {
+    if (!fits(layout)) {
+        return this->parent->alloc_at_least(layout);
+    }
+    return {internal_alloc(layout), this->slot_layout.size};
+}
+
+usize pool_allocator::internal_try_grow_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    if (!fits(old_layout)) {
+        return this->parent->try_grow_in_place(old_layout, new_size, ptr);
+    }
+    return fits(old_layout.with_size(new_size)) ? this->slot_layout.size : 0;
+}
+
+usize pool_allocator::internal_try_shrink_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    if (fits(old_layout)) {
+        return this->slot_layout.size;
+    }
+    // Shrinking into a slot means moving into a slot.
+    if (fits(old_layout.with_size(new_size))) {
+        return 0;
+    }
+    return this->parent->try_shrink_in_place(old_layout, new_size, ptr);
+}
+
+void pool_allocator::internal_alloc_batch(const layout &layout, usize count, void **out_ptrs) {
+    if (!fits(layout)) {
+        allocator::internal_alloc_batch(layout, count, out_ptrs);
+        return;
+    }
+
+    claim_ownership();
+
+    if (!this->free_list) {
+        collect_remote_frees();
+    }
+
+    usize taken = 0;
+    while (taken < count && this->free_list) {
+        out_ptrs[taken++] = this->free_list;
+        this->free_list = *(void **)this->free_list;
+    }
+
+    // Carve whatever is left straight out of the bump region, a chunk at a time.
+    while (taken < count) {
+        if (this->bump == this->bump_end) {
+            try {
+                grow();
+            } catch (allocation_exception &ex) {
+                // None of the slots taken so far were counted as in use yet, so they go straight
+                // back onto the free list.
+                for (usize i = 0; i < taken; ++i) {
+                    *(void **)out_ptrs[i] = this->free_list;
+                    this->free_list = out_ptrs[i];
+                }
+                throw;
+            }
+        }
+
+        usize available = ((usize)this->bump_end - (usize)this->bump) / this->slot_layout.size;
+        usize carved = std::min(available, count - taken);
+        for (usize i = 0; i < carved; ++i) {
+            out_ptrs[taken++] = this->bump;
+            this->bump = util::offset_rawptr(this->bump, this->slot_layout.size);
+        }
+    }
+
+    this->slots_in_use += count;
+    this->maximum_slots_in_use = std::max(this->maximum_slots_in_use, this->slots_in_use);
+}
+
+void pool_allocator::internal_dealloc_batch(const layout &layout, usize count, void *const *ptrs) {
+    if (!fits(layout)) {
+        allocator::internal_dealloc_batch(layout, count, ptrs);
+        return;
+    }
+
+    // Link the batch up in order and splice it onto the front of the free list all at once.
+    for (usize i = 0; i + 1 < count; ++i) {
+        *(void **)ptrs[i] = ptrs[i + 1];
+    }
+    if (std::this_thread::get_id() != this->owner_thread.load(std::memory_order_acquire)) {
+        this->remote_frees.push(ptrs[0], ptrs[count - 1]);
+        return;
+    }
+    *(void **)ptrs[count - 1] = this->free_list;
+    this->free_list = ptrs[0];
+    this->slots_in_use -= count;
+}
+
+void pool_allocator::internal_dealloc(const layout &layout, void *ptr) {
+    _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
+
+    if (!fits(layout)) {
+        this->parent->dealloc(layout, ptr);
+        return;
+    }
+
+    if (std::this_thread::get_id() != this->owner_thread.load(std::memory_order_acquire)) {
+        this->remote_frees.push(ptr, ptr);
+        return;
+    }
+    *(void **)ptr = this->free_list;
+    this->free_list = ptr;
+    this->slots_in_use -= 1;
+}
+
+void *pool_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    // Every slot is the same size, so anything that still fits can stay where it is.
+    if (fits(old_layout) && fits(new_layout)) {
+        return old_ptr;
+    }
+
+    if (!fits(old_layout) && !fits(new_layout)) {
+        return this->parent->realloc(old_layout, new_layout, old_ptr);
+    }
+
+    return general_realloc(this, old_layout, new_layout, old_ptr);
+}
+
+} // namespace vixen::heap
@@ -1,21 +1,29 @@
 #include "vixen/allocator/profile.hpp"
 
+#include "vixen/allocator/page_map.hpp"
 #include "vixen/allocator/stacktrace.hpp"
+#include "vixen/allocator/trace.hpp"
 #include "vixen/common.hpp"
 #include "vixen/stream.hpp"
 #include "vixen/traits.hpp"
 #include "vixen/types.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
 #include <thread>
 
 namespace vixen::heap {
 
 struct allocation_info {
-    allocation_info(rawptr ptr, layout layout) : base(ptr), allocated_with(layout) {}
+    allocation_info(rawptr ptr, layout layout)
+        : allocated_with(layout), base(ptr), min_size(layout.size) {}
 
     allocation_info(allocator *alloc, const allocation_info &other)
-        : base(other.base)
-        , allocated_with(other.allocated_with)
+        : allocated_with(other.allocated_with)
+        , base(other.base)
+        , min_size(other.min_size)
         , realloc_count(other.realloc_count) {
         if (other.stack_trace) {
             stack_trace = other.stack_trace->clone(alloc);
@@ -24,305 +32,665 @@ struct allocation_info {
 
     layout allocated_with;
     rawptr base;
+    // Blocks that were rounded up to their usable size may be described by any size between what
+    // was asked for and `allocated_with.size`.
+    usize min_size;
 
     usize realloc_count{0};
     option<vector<void *>> stack_trace{};
 };
 
-#define BUCKET_SIZE 16384
-
-usize get_bucket_id(rawptr addr) {
-    return (usize)addr / BUCKET_SIZE;
-}
-
-struct allocation_range {
-    rawptr start, end;
+// The checker tracks pages with the same granularity as `page_map`.
+constexpr usize CHECKER_PAGE_SIZE = (usize)1 << PAGE_MAP_PAGE_SHIFT;
+constexpr usize CHECKER_PAGE_WORDS = CHECKER_PAGE_SIZE / 64;
+// Page map entries with this bit set are pages that one allocation covers completely, and hold the
+// start of that allocation in the rest of their bits. Any other entry that isn't 0 points to a
+// `checker_page`.
+constexpr usize FULL_PAGE_TAG = (usize)1 << 63;
+
+// A page that some allocation only covers part of.
+struct checker_page {
+    // One bit per byte of the page, set where an allocation starts.
+    u64 starts[CHECKER_PAGE_WORDS];
+    // Number of allocations overlapping the page, including one that started on an earlier page.
+    usize live;
 };
 
-struct allocation_bucket {
-    allocation_bucket(allocator *alloc, rawptr start, rawptr end)
-        : start(start), end(end), allocations(alloc) {}
+static rawptr page_base(rawptr ptr) {
+    return (rawptr)((usize)ptr & ~(CHECKER_PAGE_SIZE - 1));
+}
 
-    rawptr start, end;
-    vector<allocation_range> allocations;
-};
+static usize page_offset(rawptr ptr) {
+    return (usize)ptr & (CHECKER_PAGE_SIZE - 1);
+}
 
-rawptr range_start(const allocation_range &range) {
-    return range.start;
+// Offset of the last allocation that starts at or before `offset` in `page`.
+static option<usize> find_last_start(const checker_page *page, usize offset) {
+    usize word = offset / 64;
+    u64 bits = page->starts[word] & (~(u64)0 >> (63 - offset % 64));
+    loop {
+        if (bits) {
+            return word * 64 + (63 - __builtin_clzll(bits));
+        }
+        if (word == 0) {
+            return nullptr;
+        }
+        bits = page->starts[--word];
+    }
 }
 
-usize bucket_start(const allocation_bucket &bucket) {
-    return get_bucket_id(bucket.start);
+// Offset of the first allocation that starts in [first, last) in `page`.
+static option<usize> find_first_start(const checker_page *page, usize first, usize last) {
+    if (first >= last) {
+        return nullptr;
+    }
+    usize word = first / 64;
+    u64 bits = page->starts[word] & (~(u64)0 << (first % 64));
+    loop {
+        if (bits) {
+            usize offset = word * 64 + __builtin_ctzll(bits);
+            return offset < last ? option<usize>(offset) : nullptr;
+        }
+        if (++word * 64 >= last) {
+            return nullptr;
+        }
+        bits = page->starts[word];
+    }
 }
 
-// this is SO BAD
+// Live allocations are kept in a hash map by their start, and a page map over the address space
+// answers which allocation owns an address. Every lookup looks at no more than the page the
+// address is in and the one before it, and adding or removing an allocation touches each of its
+// pages once.
 struct allocation_checker {
     allocator *alloc;
-    vector<allocation_bucket> buckets;
+    page_map *pages = nullptr;
     hash_map<rawptr, allocation_info> infos;
 
-    allocation_checker(allocator *alloc) : alloc(alloc), buckets(alloc), infos(alloc) {}
+    allocation_checker(allocator *alloc) : alloc(alloc), infos(alloc) {}
+
+    allocation_checker(allocation_checker &&other)
+        : alloc(other.alloc)
+        , pages(util::exchange(other.pages, nullptr))
+        , infos(mv(other.infos)) {}
 
-    void add_range_at(rawptr addr, allocation_range range) {
-        auto bucket_idx
-            = binary_search(buckets.begin(), buckets.end(), get_bucket_id(addr), bucket_start);
-        if (bucket_idx.is_err()) {
-            allocation_bucket bucket_to_add(alloc, addr, addr + BUCKET_SIZE);
-            buckets.shift_insert(bucket_idx.unwrap_err(), mv(bucket_to_add));
+    allocation_checker &operator=(allocation_checker &&other) {
+        if (this != &other) {
+            release_pages();
+            this->alloc = other.alloc;
+            this->pages = util::exchange(other.pages, nullptr);
+            this->infos = mv(other.infos);
         }
+        return *this;
+    }
 
-        auto &bucket = buckets[unify_result(mv(bucket_idx))];
-        auto range_idx = binary_search(bucket.allocations.begin(),
-            bucket.allocations.end(),
-            range.start,
-            range_start);
-        VIXEN_ASSERT(range_idx.is_err(), "tried to insert already-existent range");
-        bucket.allocations.shift_insert(range_idx.unwrap_err(), range);
+    ~allocation_checker() {
+        release_pages();
     }
 
-    option<const allocation_info &> add(rawptr ptr, allocation_info &&info) {
-        rawptr start_addr = ptr;
-        rawptr end_addr = start_addr + info.allocated_with.size;
-        auto start_bucket_addr = get_bucket_id(start_addr);
-        auto end_bucket_addr = get_bucket_id(end_addr);
-        allocation_range range{start_addr, end_addr};
+    void release_pages() {
+        if (!this->pages) {
+            return;
+        }
+        this->pages->for_each([&](usize value) {
+            if (!(value & FULL_PAGE_TAG)) {
+                this->alloc->dealloc(layout::of<checker_page>(), (void *)value);
+            }
+        });
+        this->pages->~page_map();
+        this->alloc->dealloc(layout::of<page_map>(), (void *)this->pages);
+        this->pages = nullptr;
+    }
+
+    static rawptr block_end(rawptr start, const allocation_info &info) {
+        return util::offset_rawptr(start, std::max(info.allocated_with.size, (usize)1));
+    }
 
-        // VIXEN_WARN("adding {}-{} with layout {}", start_addr, end_addr, info.allocated_with);
+    // Start of the allocation that contains `addr`, if there is one.
+    option<rawptr> find_owner(rawptr addr) const {
+        if (!this->pages) {
+            return nullptr;
+        }
 
-        if (auto overlapping = get_overlapping_range(range)) {
-            // VIXEN_WARN("overlapping {}-{} ", overlapping->start, overlapping->end);
-            return infos[overlapping->start];
+        usize value = this->pages->get(addr);
+        if (value & FULL_PAGE_TAG) {
+            return (rawptr)(value & ~FULL_PAGE_TAG);
+        } else if (value == 0) {
+            return nullptr;
         }
 
-        add_range_at(start_addr, range);
-        if (start_bucket_addr != end_bucket_addr) {
-            add_range_at(end_addr, range);
+        // Allocations never overlap, so the only one that can contain `addr` is the last one to
+        // start before it. If it didn't start on this page, it started on the previous one.
+        rawptr candidate;
+        if (auto offset = find_last_start((const checker_page *)value, page_offset(addr))) {
+            candidate = util::offset_rawptr(page_base(addr), *offset);
+        } else {
+            rawptr prev_base = util::offset_rawptr(page_base(addr), -(isize)CHECKER_PAGE_SIZE);
+            usize prev_value = page_base(addr) ? this->pages->get(prev_base) : 0;
+            if (prev_value & FULL_PAGE_TAG) {
+                candidate = (rawptr)(prev_value & ~FULL_PAGE_TAG);
+            } else if (prev_value == 0) {
+                return nullptr;
+            } else if (auto offset = find_last_start((const checker_page *)prev_value,
+                           CHECKER_PAGE_SIZE - 1))
+            {
+                candidate = util::offset_rawptr(prev_base, *offset);
+            } else {
+                return nullptr;
+            }
         }
 
-        infos.insert(start_addr, mv(info));
+        if (addr < block_end(candidate, this->infos[candidate])) {
+            return candidate;
+        }
         return nullptr;
     }
 
-    struct removal_info {
-        option<allocation_info> info;
-        bool is_dealloc_start_misaligned;
-        bool is_dealloc_end_misaligned;
-    };
+    // Start of some allocation that overlaps [start, end), if there is one.
+    option<rawptr> find_overlapping(rawptr start, rawptr end) const {
+        if (auto owner = find_owner(start)) {
+            return owner;
+        }
 
-    removal_info remove(rawptr addr, layout layout, allocator *info_clone_alloc) {
-        rawptr start_addr = addr;
-        rawptr end_addr = util::offset_rawptr(start_addr, layout.size);
-        allocation_range range{start_addr, end_addr};
-
-        // VIXEN_WARN("removing {}", addr);
-
-        if (auto overlapping_range = get_overlapping_range(addr)) {
-            if (range.start == overlapping_range->start && range.end == overlapping_range->end) {
-                auto start_bucket_idx = get_bucket_index(range.start);
-                auto start_range_idx = get_range_index(*start_bucket_idx, range.start);
-                buckets[*start_bucket_idx].allocations.shift_remove(*start_range_idx);
-
-                auto end_bucket_idx = get_bucket_index(range.end);
-                if (start_bucket_idx != end_bucket_idx) {
-                    auto end_range_idx = get_range_index(*end_bucket_idx, range.start);
-                    buckets[*end_bucket_idx].allocations.shift_remove(*end_range_idx);
+        // Anything else that overlaps has to start somewhere inside the range.
+        for (rawptr base = page_base(start); base < end;
+             base = util::offset_rawptr(base, CHECKER_PAGE_SIZE))
+        {
+            usize value = this->pages->get(base);
+            if (value & FULL_PAGE_TAG) {
+                return (rawptr)(value & ~FULL_PAGE_TAG);
+            } else if (value != 0) {
+                usize first = base == page_base(start) ? page_offset(start) + 1 : 0;
+                usize last = std::min((usize)end - (usize)base, CHECKER_PAGE_SIZE);
+                if (auto offset = find_first_start((const checker_page *)value, first, last)) {
+                    return util::offset_rawptr(base, *offset);
                 }
-
-                return {infos.remove(overlapping_range->start), false};
-            } else {
-                return {allocation_info{info_clone_alloc, infos[overlapping_range->start]},
-                    overlapping_range->start != start_addr,
-                    overlapping_range->end != end_addr};
             }
         }
+        return nullptr;
+    }
 
-        return {nullptr, false};
+    checker_page *get_or_create_page(rawptr base) {
+        if (usize value = this->pages->get(base)) {
+            return (checker_page *)value;
+        }
+        auto *page = (checker_page *)this->alloc->alloc(layout::of<checker_page>());
+        util::fill((u8)0, (u8 *)page, sizeof(checker_page));
+        this->pages->set(base, (usize)page);
+        return page;
     }
 
-    option<usize> get_bucket_index(rawptr addr) const {
-        return binary_search(buckets.begin(), buckets.end(), get_bucket_id(addr), bucket_start)
-            .to_ok();
+    // Pages the range covers completely are tagged with its start, and the pages at either end
+    // that it only partly covers get a reference, plus a start bit on the first one.
+    void mark(rawptr start, rawptr end) {
+        rawptr full_begin = util::align_pointer_up(start, CHECKER_PAGE_SIZE);
+        rawptr full_end = page_base(end);
+        if (full_begin < full_end) {
+            usize len = (usize)full_end - (usize)full_begin;
+            this->pages->set_range(full_begin, len, FULL_PAGE_TAG | (usize)start);
+        }
+
+        if (start < full_begin || full_begin >= full_end) {
+            checker_page *page = get_or_create_page(page_base(start));
+            page->starts[page_offset(start) / 64] |= (u64)1 << (page_offset(start) % 64);
+            page->live += 1;
+        }
+        rawptr last_base = page_base(util::offset_rawptr(end, -1));
+        if (end > full_end && last_base != page_base(start)) {
+            get_or_create_page(last_base)->live += 1;
+        }
     }
 
-    option<usize> get_range_index(usize bucket_idx, rawptr addr) const {
-        return binary_search(buckets[bucket_idx].allocations.begin(),
-            buckets[bucket_idx].allocations.end(),
-            addr,
-            range_start)
-            .to_ok();
+    void release_page_ref(rawptr base) {
+        auto *page = (checker_page *)this->pages->get(base);
+        page->live -= 1;
+        if (page->live == 0) {
+            this->pages->set(base, 0);
+            this->alloc->dealloc(layout::of<checker_page>(), (void *)page);
+        }
     }
 
-    bool remove_range(allocation_range range) {
-        auto start_bucket_index = binary_search(buckets.begin(),
-            buckets.end(),
-            get_bucket_id(range.start),
-            bucket_start);
+    void unmark(rawptr start, rawptr end) {
+        rawptr full_begin = util::align_pointer_up(start, CHECKER_PAGE_SIZE);
+        rawptr full_end = page_base(end);
+        if (full_begin < full_end) {
+            this->pages->set_range(full_begin, (usize)full_end - (usize)full_begin, 0);
+        }
+
+        if (start < full_begin || full_begin >= full_end) {
+            auto *page = (checker_page *)this->pages->get(page_base(start));
+            page->starts[page_offset(start) / 64] &= ~((u64)1 << (page_offset(start) % 64));
+            release_page_ref(page_base(start));
+        }
+        rawptr last_base = page_base(util::offset_rawptr(end, -1));
+        if (end > full_end && last_base != page_base(start)) {
+            release_page_ref(last_base);
+        }
+    }
 
-        if (start_bucket_index.is_ok()) {
-            auto &start_bucket = buckets[start_bucket_index.unwrap_ok()];
-            auto start_range_index = binary_search(start_bucket.allocations.begin(),
-                start_bucket.allocations.end(),
-                range.start,
-                range_start);
+    option<const allocation_info &> add(rawptr ptr, allocation_info &&info) {
+        rawptr end = block_end(ptr, info);
+        if (!this->pages) {
+            this->pages = new (this->alloc->alloc(layout::of<page_map>())) page_map(this->alloc);
+        }
 
-            if (start_range_index.is_ok()) {
-                auto end_bucket_index = binary_search(buckets.begin(),
-                    buckets.end(),
-                    get_bucket_id(range.end),
-                    bucket_start);
-                auto &end_bucket = buckets[end_bucket_index.unwrap_ok()];
-                auto end_range_index = binary_search(end_bucket.allocations.begin(),
-                    end_bucket.allocations.end(),
-                    range.start,
-                    range_start);
+        if (auto overlapping = find_overlapping(ptr, end)) {
+            return this->infos[*overlapping];
+        }
 
-                if (start_bucket.allocations[start_range_index.unwrap_ok()].end != range.end) {
-                    return false;
-                }
+        mark(ptr, end);
+        this->infos.insert(ptr, mv(info));
+        return nullptr;
+    }
 
-                start_bucket.allocations.shift_remove(start_range_index.unwrap_ok());
-                end_bucket.allocations.shift_remove(end_range_index.unwrap_ok());
+    struct removal_info {
+        option<allocation_info> info;
+        bool is_dealloc_start_misaligned;
+        bool is_dealloc_end_misaligned;
+    };
 
-                return true;
-            }
+    removal_info remove(rawptr addr, layout layout, allocator *info_clone_alloc) {
+        auto owner = find_owner(addr);
+        if (!owner) {
+            return {nullptr, false, false};
         }
 
-        return false;
-    }
+        allocation_info &info = this->infos[*owner];
+        rawptr end_addr = util::offset_rawptr(addr, layout.size);
+        rawptr min_end = util::offset_rawptr(*owner, info.min_size);
+        rawptr max_end = util::offset_rawptr(*owner, info.allocated_with.size);
+        bool is_end_aligned = end_addr >= min_end && end_addr <= max_end;
 
-    option<allocation_range> get_overlapping_range(rawptr addr) const {
-        if (auto alloc_range = get_previous_range(addr)) {
-            if (alloc_range->start <= addr && alloc_range->end > addr) {
-                return alloc_range;
-            }
+        if (*owner == addr && is_end_aligned) {
+            unmark(*owner, block_end(*owner, info));
+            return {this->infos.remove(*owner), false, false};
         }
-        return nullptr;
+        return {allocation_info{info_clone_alloc, info}, *owner != addr, !is_end_aligned};
     }
 
-    option<allocation_range> get_overlapping_range(allocation_range range) const {
-        auto prev_from_end = get_previous_range(range.end);
-        if (prev_from_end.is_none())
-            return nullptr;
+    struct range_removal {
+        usize bytes = 0;
+        usize count = 0;
+    };
 
-        if (range.start < prev_from_end->end && prev_from_end->start < range.end) {
-            return prev_from_end;
-        } else {
-            return nullptr;
+    // Removes every allocation that starts in [begin, end), for blocks that were all freed at once
+    // by a reset or a restore. Ranges with more pages than there are allocations are cheaper to
+    // find by looking at every allocation instead.
+    range_removal remove_range(rawptr begin, rawptr end) {
+        if (!this->pages || begin >= end) {
+            return {};
         }
-    }
 
-    option<allocation_range> get_previous_range(rawptr addr) const {
-        auto bucket_addr = get_bucket_id(addr);
-        if (auto bucket_idx
-            = binary_find_previous_index(buckets.begin(), buckets.end(), bucket_addr, bucket_start))
-        {
-            const auto &bucket = buckets[*bucket_idx];
-            if (auto range_idx = binary_find_previous_index(bucket.allocations.begin(),
-                    bucket.allocations.end(),
-                    addr,
-                    range_start))
-            {
-                return bucket.allocations[*range_idx];
+        vector<rawptr> starts(this->alloc);
+        usize page_count = ((usize)end - (usize)page_base(begin)) / CHECKER_PAGE_SIZE + 1;
+        if (page_count > this->infos.len()) {
+            auto &table = this->infos.table;
+            for (usize slot = 0; slot < table.capacity; ++slot) {
+                if (table.is_occupied(slot)) {
+                    rawptr ptr = table.get(slot).get<0>();
+                    if (ptr >= begin && ptr < end) {
+                        starts.push(ptr);
+                    }
+                }
             }
-        } else if (bucket_addr > 0) {
-            if (auto bucket_idx = binary_find_previous_index(buckets.begin(),
-                    buckets.end(),
-                    bucket_addr - 1,
-                    bucket_start))
+        } else {
+            // Every allocation has its start bit set on a partial page, or else it starts right at
+            // the beginning of a full page.
+            for (rawptr base = page_base(begin); base < end;
+                 base = util::offset_rawptr(base, CHECKER_PAGE_SIZE))
             {
-                const auto &bucket = buckets[*bucket_idx];
-                if (auto range_idx = binary_find_previous_index(bucket.allocations.begin(),
-                        bucket.allocations.end(),
-                        addr,
-                        range_start))
-                {
-                    return bucket.allocations[*range_idx];
+                usize value = this->pages->get(base);
+                if (value & FULL_PAGE_TAG) {
+                    rawptr start = (rawptr)(value & ~FULL_PAGE_TAG);
+                    if (start == base && start >= begin) {
+                        starts.push(start);
+                    }
+                } else if (value != 0) {
+                    usize first = base < begin ? page_offset(begin) : 0;
+                    usize last = std::min((usize)end - (usize)base, CHECKER_PAGE_SIZE);
+                    auto *page = (const checker_page *)value;
+                    while (auto offset = find_first_start(page, first, last)) {
+                        starts.push(util::offset_rawptr(base, *offset));
+                        first = *offset + 1;
+                    }
                 }
             }
         }
-        return nullptr;
+
+        range_removal removed;
+        for (rawptr start : starts) {
+            allocation_info &info = this->infos[start];
+            removed.bytes += info.allocated_with.size;
+            removed.count += 1;
+            unmark(start, block_end(start, info));
+            this->infos.remove(start);
+        }
+        return removed;
     }
 
     allocation_info &get_info(rawptr ptr) {
-        return infos[ptr];
+        return this->infos[ptr];
     }
 
     usize count() const {
-        return infos.len();
+        return this->infos.len();
     }
 };
 
+// Each thread gets its own generator, seeded from the one before it so they don't all pick the same
+// sample points.
+static std::atomic<u64> next_sample_seed{0x9e3779b97f4a7c15ull};
+static thread_local u64 sample_rng_state
+    = next_sample_seed.fetch_add(0x9e3779b97f4a7c15ull, std::memory_order_relaxed);
+
+// xorshift64*, which is plenty random for picking sample points.
+static u64 next_sample_random() {
+    sample_rng_state ^= sample_rng_state >> 12;
+    sample_rng_state ^= sample_rng_state << 25;
+    sample_rng_state ^= sample_rng_state >> 27;
+    return sample_rng_state * 0x2545f4914f6cdd1dull;
+}
+
+// Distances between sample points are exponentially distributed, which makes the sample points a
+// Poisson process over allocated bytes. Every byte is equally likely to be sampled, no matter how
+// the allocations before it were sized.
+static isize next_sample_distance(usize interval) {
+    // Uniform in (0, 1], so the log is always finite.
+    double uniform = (double)((next_sample_random() >> 11) + 1) * 0x1.0p-53;
+    return (isize)(-std::log(uniform) * (double)interval) + 1;
+}
+
+// A live allocation picked by the heap sampler. Allocations are sampled with a probability that
+// depends on their size, so each sample stands in for `1 / probability` allocations like it.
+struct heap_sample {
+    heap_sample(allocator *alloc, usize size, double weight)
+        : size(size), weight(weight), stack_trace(alloc) {}
+
+    usize size;
+    double weight;
+    vector<void *> stack_trace;
+};
+
+struct internal_query_info {
+    allocator_id attached_to;
+    // The allocator's counters as of the last measurement, which the next one is relative to.
+    query_info baseline;
+    // Highest live byte and allocation counts the allocator reached since the last measurement.
+    std::atomic<usize> peak_bytes_in_use{0};
+    std::atomic<usize> peak_active_allocations{0};
+};
+
+// Counters are split into shards that threads pick by index, so that threads recording into the
+// same allocator usually write to different cache lines. Reading a counter sums up every shard.
+constexpr usize PROFILE_SHARD_COUNT = 16;
+// How many performance queries can listen to a single allocator at once.
+constexpr usize MAX_QUERIES_PER_ALLOCATOR = 16;
+
+struct alignas(64) counter_shard {
+    std::atomic<usize> allocation_count{0};
+    std::atomic<usize> deallocation_count{0};
+    std::atomic<usize> reallocation_count{0};
+    std::atomic<usize> cum_allocation_bytes{0};
+    std::atomic<usize> cum_deallocation_bytes{0};
+
+    std::atomic<usize> explicit_huge_page_mappings{0};
+    std::atomic<usize> transparent_huge_page_mappings{0};
+    std::atomic<usize> huge_page_fallbacks{0};
+    std::atomic<usize> reserved_bytes{0};
+
+    // Every shard samples its own share of the allocated bytes, which is still a Poisson process
+    // with the same rate per byte.
+    std::atomic<isize> bytes_until_sample{0};
+};
+
+static std::atomic<usize> next_shard_index{0};
+static thread_local usize shard_index
+    = next_shard_index.fetch_add(1, std::memory_order_relaxed) % PROFILE_SHARD_COUNT;
+
+// Counters can be updated from any thread without locking. The heap samples and the checker each
+// have a lock of their own, which is only taken by requests that actually need them.
 struct allocator_info {
-    allocator_info(allocator *alloc) : listening_queries(alloc), checker(alloc) {}
+    allocator_info(allocator *alloc) : heap_samples(alloc), checker(alloc) {}
 
     option<string> name;
 
-    usize num_bytes_in_use = 0;
-    usize maximum_bytes_in_use = 0;
-    usize num_active_allocations = 0;
-    usize maximum_active_allocations = 0;
+    // Live counts are kept in one place rather than sharded, since their high-water marks need a
+    // single current value to compare against.
+    std::atomic<usize> num_bytes_in_use{0};
+    std::atomic<usize> maximum_bytes_in_use{0};
+    std::atomic<usize> num_active_allocations{0};
+    std::atomic<usize> maximum_active_allocations{0};
+
+    counter_shard shards[PROFILE_SHARD_COUNT];
+
+    std::atomic<profiling_tier> tier{MAX_PROFILING_TIER};
+    // Captures a stack trace for every allocation the checker tracks, on top of the sampled ones.
+    // This makes allocating many times slower, so it's only worth it when chasing down a bug.
+    bool should_capture_stack_traces = false;
 
-    usize current_transaction_depth = 0;
-    bool should_capture_stack_traces = true;
+    std::atomic<usize> heap_sample_interval{DEFAULT_HEAP_SAMPLE_INTERVAL};
+    std::mutex sample_lock;
+    // Mirrors `heap_samples.len()`, so that deallocations can skip the lock when nothing was
+    // sampled.
+    std::atomic<usize> heap_sample_count{0};
+    hash_map<rawptr, heap_sample> heap_samples;
 
-    vector<query_id> listening_queries;
+    std::atomic<internal_query_info *> listening_queries[MAX_QUERIES_PER_ALLOCATOR] = {};
+
+    std::mutex checker_lock;
     allocation_checker checker;
+
+    counter_shard &current_shard() {
+        return this->shards[shard_index];
+    }
 };
 
-struct internal_query_info {
-    query_info query;
-    allocator_id attached_to;
+// Allocator and query IDs index into chunked tables whose entries never move, so that requests can
+// look up their allocator without locking. Chunks are only added while holding `registry_lock`.
+constexpr usize REGISTRY_CHUNK_SIZE = 64;
+constexpr usize REGISTRY_CHUNK_COUNT = 1024;
+
+template <typename T>
+struct registry_table {
+    struct chunk {
+        T *entries[REGISTRY_CHUNK_SIZE];
+    };
+
+    std::atomic<chunk *> chunks[REGISTRY_CHUNK_COUNT] = {};
+
+    T &operator[](isize id) const {
+        chunk *chunk = this->chunks[id / REGISTRY_CHUNK_SIZE].load(std::memory_order_acquire);
+        return *chunk->entries[id % REGISTRY_CHUNK_SIZE];
+    }
+
+    // Must be called while holding `registry_lock`.
+    T *&entry(isize id) {
+        if ((usize)id >= REGISTRY_CHUNK_SIZE * REGISTRY_CHUNK_COUNT) {
+            VIXEN_PANIC("Tried to register more than {} profiled objects at once.",
+                REGISTRY_CHUNK_SIZE * REGISTRY_CHUNK_COUNT);
+        }
+
+        std::atomic<chunk *> &slot = this->chunks[id / REGISTRY_CHUNK_SIZE];
+        chunk *existing = slot.load(std::memory_order_relaxed);
+        if (!existing) {
+            existing = (chunk *)debug_allocator()->alloc(layout::of<chunk>());
+            util::fill((u8)0, (u8 *)existing, sizeof(chunk));
+            slot.store(existing, std::memory_order_release);
+        }
+        return existing->entries[id % REGISTRY_CHUNK_SIZE];
+    }
 };
 
+// Guards handing out and taking back IDs, and attaching queries to allocators.
+static std::mutex registry_lock;
 static usize max_allocator_id = 0;
 static usize max_query_id = 0;
 static vector<allocator_id> freed_allocator_names(debug_allocator());
 static vector<query_id> freed_query_names(debug_allocator());
 
-static vector<allocator_info> allocator_infos(debug_allocator());
-static vector<internal_query_info> queries(debug_allocator());
+static registry_table<allocator_info> allocator_infos;
+static registry_table<internal_query_info> queries;
+
+static void raise_to(std::atomic<usize> &maximum, usize value) {
+    usize current = maximum.load(std::memory_order_relaxed);
+    while (value > current
+           && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {}
+}
+
+// Sums up every shard of an allocator's counters.
+static query_info merge_counters(const allocator_info &info) {
+    query_info merged;
+    merged.bytes_in_use = info.num_bytes_in_use.load(std::memory_order_relaxed);
+    merged.active_allocations = info.num_active_allocations.load(std::memory_order_relaxed);
+    merged.maximum_bytes_in_use = info.maximum_bytes_in_use.load(std::memory_order_relaxed);
+    merged.maximum_active_allocations
+        = info.maximum_active_allocations.load(std::memory_order_relaxed);
+
+    for (const counter_shard &shard : info.shards) {
+        merged.allocation_count += shard.allocation_count.load(std::memory_order_relaxed);
+        merged.deallocation_count += shard.deallocation_count.load(std::memory_order_relaxed);
+        merged.reallocation_count += shard.reallocation_count.load(std::memory_order_relaxed);
+        merged.cum_allocation_bytes += shard.cum_allocation_bytes.load(std::memory_order_relaxed);
+        merged.cum_deallocation_bytes
+            += shard.cum_deallocation_bytes.load(std::memory_order_relaxed);
+
+        merged.explicit_huge_page_mappings
+            += shard.explicit_huge_page_mappings.load(std::memory_order_relaxed);
+        merged.transparent_huge_page_mappings
+            += shard.transparent_huge_page_mappings.load(std::memory_order_relaxed);
+        merged.huge_page_fallbacks += shard.huge_page_fallbacks.load(std::memory_order_relaxed);
+        merged.reserved_bytes += shard.reserved_bytes.load(std::memory_order_relaxed);
+    }
+    return merged;
+}
+
+static void reset_query(const allocator_info &info, internal_query_info &query) {
+    query.baseline = merge_counters(info);
+    query.peak_bytes_in_use.store(query.baseline.bytes_in_use, std::memory_order_relaxed);
+    query.peak_active_allocations.store(query.baseline.active_allocations,
+        std::memory_order_relaxed);
+}
 
 query_id create_memory_performace_query(allocator_id alloc_id) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    allocator_info &alloc_info = allocator_infos[alloc_id.id];
+
     query_id id;
-    internal_query_info query_info;
-    query_info.query = {};
-    query_info.attached_to = alloc_id;
+    internal_query_info *query;
     if (freed_query_names.len() > 0) {
         id = *freed_query_names.pop();
-        queries[id.id] = query_info;
+        query = &queries[id.id];
     } else {
         id = {static_cast<isize>(max_query_id++)};
-        queries.push(query_info);
+        query = new (debug_allocator()->alloc(layout::of<internal_query_info>()))
+            internal_query_info();
+        queries.entry(id.id) = query;
+    }
+    query->attached_to = alloc_id;
+    reset_query(alloc_info, *query);
+
+    for (auto &slot : alloc_info.listening_queries) {
+        if (slot.load(std::memory_order_relaxed) == nullptr) {
+            slot.store(query, std::memory_order_release);
+            return id;
+        }
     }
-    allocator_infos[alloc_id.id].listening_queries.push(id);
-    return id;
+    VIXEN_PANIC("Tried to attach more than {} performance queries to one allocator.",
+        MAX_QUERIES_PER_ALLOCATOR);
 }
 
 void delete_memory_performace_query(query_id id) {
+    std::lock_guard<std::mutex> guard(registry_lock);
     internal_query_info *query_info = &queries[id.id];
     allocator_info *affected_alloc_info = &allocator_infos[query_info->attached_to.id];
 
-    if (auto idx = affected_alloc_info->listening_queries.index_of(id)) {
-        affected_alloc_info->listening_queries.remove(*idx);
+    for (auto &slot : affected_alloc_info->listening_queries) {
+        if (slot.load(std::memory_order_relaxed) == query_info) {
+            slot.store(nullptr, std::memory_order_release);
+        }
     }
 
     freed_query_names.push(id);
 }
 
 query_info measure_memory_performace_query(query_id id) {
-    query_info info = queries[id.id].query;
-    queries[id.id].query = {};
+    std::lock_guard<std::mutex> guard(registry_lock);
+    internal_query_info &query = queries[id.id];
+    allocator_info &alloc_info = allocator_infos[query.attached_to.id];
+
+    query_info now = merge_counters(alloc_info);
+    const query_info &then = query.baseline;
+
+    query_info info;
+    info.bytes_in_use = now.bytes_in_use - then.bytes_in_use;
+    info.active_allocations = now.active_allocations - then.active_allocations;
+    info.maximum_bytes_in_use
+        = query.peak_bytes_in_use.load(std::memory_order_relaxed) - then.bytes_in_use;
+    info.maximum_active_allocations
+        = query.peak_active_allocations.load(std::memory_order_relaxed) - then.active_allocations;
+
+    info.allocation_count = now.allocation_count - then.allocation_count;
+    info.deallocation_count = now.deallocation_count - then.deallocation_count;
+    info.reallocation_count = now.reallocation_count - then.reallocation_count;
+    info.cum_allocation_bytes = now.cum_allocation_bytes - then.cum_allocation_bytes;
+    info.cum_deallocation_bytes = now.cum_deallocation_bytes - then.cum_deallocation_bytes;
+
+    info.explicit_huge_page_mappings
+        = now.explicit_huge_page_mappings - then.explicit_huge_page_mappings;
+    info.transparent_huge_page_mappings
+        = now.transparent_huge_page_mappings - then.transparent_huge_page_mappings;
+    info.huge_page_fallbacks = now.huge_page_fallbacks - then.huge_page_fallbacks;
+    info.reserved_bytes = now.reserved_bytes - then.reserved_bytes;
+
+    reset_query(alloc_info, query);
     return info;
 }
 
 void register_allocator(allocator *alloc) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    allocator_info *info;
     if (freed_allocator_names.len() > 0) {
         alloc->id = *freed_allocator_names.pop();
-        allocator_infos[alloc->id.id] = allocator_info(debug_allocator());
+        info = &allocator_infos[alloc->id.id];
+        info->~allocator_info();
+        new (info) allocator_info(debug_allocator());
     } else {
         alloc->id = {static_cast<isize>(max_allocator_id++)};
-        allocator_infos.push(allocator_info(debug_allocator()));
+        info = new (debug_allocator()->alloc(layout::of<allocator_info>()))
+            allocator_info(debug_allocator());
+        allocator_infos.entry(alloc->id.id) = info;
+    }
+    for (counter_shard &shard : info->shards) {
+        shard.bytes_until_sample.store(next_sample_distance(DEFAULT_HEAP_SAMPLE_INTERVAL),
+            std::memory_order_relaxed);
+    }
+    alloc->profiling = MAX_PROFILING_TIER;
+}
+
+void set_profiling_tier(allocator *alloc, profiling_tier tier) {
+    VIXEN_ASSERT(alloc->id != NOT_TRACKED_ID,
+        "Tried to set the profiling tier of an allocator that was never registered.");
+
+    tier = std::min(tier, MAX_PROFILING_TIER);
+    allocator_info &info = allocator_infos[alloc->id.id];
+    std::lock_guard<std::mutex> guard(info.checker_lock);
+
+    // The checker only knows about allocations made while it was running, so it would reject
+    // freeing anything from before.
+    VIXEN_ASSERT(tier != profiling_tier::full || info.tier == profiling_tier::full
+            || info.num_active_allocations == 0,
+        "Tried to start checking an allocator that already has {} active allocations.",
+        info.num_active_allocations.load());
+
+    // Switching away from full checking forgets the live allocations, so switching back later
+    // starts from a clean slate.
+    if (tier != profiling_tier::full) {
+        info.checker = allocation_checker(debug_allocator());
     }
+
+    info.tier = tier;
+    alloc->profiling = tier;
 }
 
 constexpr usize ONE_KB = 1024;
@@ -357,21 +725,32 @@ static usize bytes_units(usize bytes) {
 
 void unregister_allocator(allocator *alloc) {
     allocator_info &info = allocator_infos[alloc->id.id];
+    query_info counters = merge_counters(info);
 
     VIXEN_INFO("allocator stats for `{}`:", info.name ? *info.name : "<unknown>"_s);
 
     VIXEN_INFO("\tMaximum tracked bytes used: {} {} ({} bytes)",
-        bytes_units(info.maximum_bytes_in_use),
-        bytes_scale(info.maximum_bytes_in_use),
-        info.maximum_bytes_in_use);
+        bytes_units(counters.maximum_bytes_in_use),
+        bytes_scale(counters.maximum_bytes_in_use),
+        counters.maximum_bytes_in_use);
 
     VIXEN_INFO("\tCurrent tracked bytes used: {} {} ({} bytes)",
-        bytes_units(info.num_bytes_in_use),
-        bytes_scale(info.num_bytes_in_use),
-        info.num_bytes_in_use);
-
-    VIXEN_INFO("\tMaximum tracked active allocations: {}", info.maximum_active_allocations);
-    VIXEN_INFO("\tCurrent tracked active allocations: {}", info.num_active_allocations);
+        bytes_units(counters.bytes_in_use),
+        bytes_scale(counters.bytes_in_use),
+        counters.bytes_in_use);
+
+    VIXEN_INFO("\tMaximum tracked active allocations: {}", counters.maximum_active_allocations);
+    VIXEN_INFO("\tCurrent tracked active allocations: {}", counters.active_allocations);
+
+    if (counters.explicit_huge_page_mappings + counters.transparent_huge_page_mappings
+            + counters.huge_page_fallbacks
+        > 0)
+    {
+        VIXEN_INFO("\tHuge page mappings: {} explicit, {} transparent, {} fell back",
+            counters.explicit_huge_page_mappings,
+            counters.transparent_huge_page_mappings,
+            counters.huge_page_fallbacks);
+    }
 
     translation_cache cache(debug_allocator());
 
@@ -389,26 +768,124 @@ void unregister_allocator(allocator *alloc) {
     //     }
     // });
 
+    std::lock_guard<std::mutex> guard(registry_lock);
     freed_allocator_names.push(alloc->id);
+    alloc->profiling = profiling_tier::off;
 }
 
 usize get_active_allocation_count(allocator_id id) {
-    return allocator_infos[id.id].num_active_allocations;
+    return allocator_infos[id.id].num_active_allocations.load(std::memory_order_relaxed);
 }
 
 usize get_active_allocation_max_count(allocator_id id) {
-    return allocator_infos[id.id].maximum_active_allocations;
+    return allocator_infos[id.id].maximum_active_allocations.load(std::memory_order_relaxed);
 }
 
 usize get_active_byte_count(allocator_id id) {
-    return allocator_infos[id.id].num_bytes_in_use;
+    return allocator_infos[id.id].num_bytes_in_use.load(std::memory_order_relaxed);
 }
 
 usize get_active_byte_max_count(allocator_id id) {
-    return allocator_infos[id.id].maximum_bytes_in_use;
+    return allocator_infos[id.id].maximum_bytes_in_use.load(std::memory_order_relaxed);
+}
+
+void set_heap_sample_interval(allocator_id id, usize interval) {
+    allocator_info &info = allocator_infos[id.id];
+    std::lock_guard<std::mutex> guard(info.sample_lock);
+    info.heap_sample_interval.store(interval, std::memory_order_relaxed);
+    for (counter_shard &shard : info.shards) {
+        shard.bytes_until_sample.store(interval == 0 ? 0 : next_sample_distance(interval),
+            std::memory_order_relaxed);
+    }
+    info.heap_samples.clear();
+    info.heap_sample_count.store(0, std::memory_order_relaxed);
+}
+
+usize estimate_live_heap_bytes(allocator_id id) {
+    allocator_info &info = allocator_infos[id.id];
+    std::lock_guard<std::mutex> guard(info.sample_lock);
+    auto &table = info.heap_samples.table;
+    double bytes = 0.0;
+    for (usize slot = 0; slot < table.capacity; ++slot) {
+        if (table.is_occupied(slot)) {
+            const heap_sample &sample = table.get(slot).get<1>();
+            bytes += sample.weight * (double)sample.size;
+        }
+    }
+    return (usize)bytes;
+}
+
+struct heap_profile_site {
+    heap_sample *first;
+    usize sample_count;
+    double bytes;
+    double allocations;
+};
+
+static bool is_stack_less(const heap_sample *lhs, const heap_sample *rhs) {
+    return std::lexicographical_compare(lhs->stack_trace.begin(),
+        lhs->stack_trace.end(),
+        rhs->stack_trace.begin(),
+        rhs->stack_trace.end());
+}
+
+static bool is_stack_equal(const heap_sample *lhs, const heap_sample *rhs) {
+    return lhs->stack_trace.len() == rhs->stack_trace.len()
+        && std::equal(lhs->stack_trace.begin(), lhs->stack_trace.end(), rhs->stack_trace.begin());
+}
+
+void print_heap_profile(allocator_id id, usize max_sites) {
+    allocator_info &info = allocator_infos[id.id];
+    std::lock_guard<std::mutex> guard(info.sample_lock);
+    auto &table = info.heap_samples.table;
+
+    vector<heap_sample *> samples(debug_allocator());
+    for (usize slot = 0; slot < table.capacity; ++slot) {
+        if (table.is_occupied(slot)) {
+            samples.push(&table.get(slot).get<1>());
+        }
+    }
+
+    // Group samples with identical stacks into call sites, then list the biggest sites first.
+    std::sort(samples.begin(), samples.end(), is_stack_less);
+    vector<heap_profile_site> sites(debug_allocator());
+    double total_bytes = 0.0;
+    for (heap_sample *sample : samples) {
+        if (sites.len() == 0 || !is_stack_equal(sites[sites.len() - 1].first, sample)) {
+            sites.push(heap_profile_site{sample, 0, 0.0, 0.0});
+        }
+        heap_profile_site &site = sites[sites.len() - 1];
+        site.sample_count += 1;
+        site.bytes += sample->weight * (double)sample->size;
+        site.allocations += sample->weight;
+        total_bytes += sample->weight * (double)sample->size;
+    }
+    std::sort(sites.begin(), sites.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.bytes > rhs.bytes;
+    });
+
+    VIXEN_INFO("heap profile for `{}`: ~{} {} live from {} call sites, estimated from {} samples",
+        info.name ? *info.name : "<unknown>"_s,
+        bytes_units((usize)total_bytes),
+        bytes_scale((usize)total_bytes),
+        sites.len(),
+        samples.len());
+
+    translation_cache cache(debug_allocator());
+    for (usize i = 0; i < std::min(sites.len(), max_sites); ++i) {
+        const heap_profile_site &site = sites[i];
+        VIXEN_INFO("#{}: ~{} {} in ~{} allocations ({} samples)",
+            i + 1,
+            bytes_units((usize)site.bytes),
+            bytes_scale((usize)site.bytes),
+            (usize)site.allocations,
+            site.sample_count);
+        print_stack_trace_capture(translate_stack_trace(&cache, site.first->stack_trace));
+    }
 }
 
 void set_allocator_name(allocator_id id, string_slice name) {
+    std::lock_guard<std::mutex> guard(registry_lock);
     allocator_info &info = allocator_infos[id.id];
     if (info.name.is_none()) {
         info.name = string(debug_allocator(), name);
@@ -427,15 +904,64 @@ option<string_slice> get_allocator_name(allocator_id id) {
 
 // allocator_id get_allocator_parent(allocator_id child) {}
 
+// Allocators that this thread is in the middle of a request to, innermost last. An allocator that
+// calls into itself while serving a request is still serving the outer one, so requests are only
+// recorded while their allocator is on the stack once.
+constexpr usize MAX_TRANSACTION_DEPTH = 64;
+
+// A reallocation that `record_realloc_start` saw begin, kept until it can be traced.
+struct pending_realloc {
+    layout old_layout;
+    layout new_layout;
+    void *old_ptr;
+    // Set once `record_realloc_move` traced it, so `record_realloc` doesn't trace it again.
+    bool traced;
+};
+
+struct transaction_stack {
+    allocator_id ids[MAX_TRANSACTION_DEPTH];
+    // Blocks that `record_realloc_start` took out of the checker, by the transaction moving them.
+    allocation_info *moving[MAX_TRANSACTION_DEPTH];
+    pending_realloc reallocs[MAX_TRANSACTION_DEPTH];
+    usize len = 0;
+};
+
+static thread_local transaction_stack transactions;
+
+static bool is_outermost_transaction(allocator_id id) {
+    usize depth = 0;
+    for (usize i = 0; i < transactions.len; ++i) {
+        depth += transactions.ids[i] == id;
+    }
+    return depth == 1;
+}
+
+// Only meant for the outermost transaction of `id`, which is the only one it has.
+static usize transaction_index(allocator_id id) {
+    usize i = transactions.len;
+    while (transactions.ids[i - 1] != id) {
+        --i;
+    }
+    return i - 1;
+}
+
 void begin_transaction(allocator_id id) {
     if (debug_allocator()->id != id) {
-        allocator_infos[id.id].current_transaction_depth += 1;
+        if (transactions.len == MAX_TRANSACTION_DEPTH) {
+            VIXEN_PANIC("Allocator requests were nested more than {} deep.", MAX_TRANSACTION_DEPTH);
+        }
+        transactions.moving[transactions.len] = nullptr;
+        transactions.reallocs[transactions.len] = {};
+        transactions.ids[transactions.len++] = id;
     }
 }
 
 void end_transaction(allocator_id id) {
     if (debug_allocator()->id != id) {
-        allocator_infos[id.id].current_transaction_depth -= 1;
+        VIXEN_DEBUG_ASSERT(transactions.len > 0 && transactions.ids[transactions.len - 1] == id,
+            "Tried to end a transaction of allocator {}, which isn't the innermost one.",
+            id.id);
+        --transactions.len;
     }
 }
 
@@ -448,34 +974,86 @@ void format_stack_trace(
     }
 }
 
-static void commit_alloc(allocator_info *alloc_info, layout layout, void *ptr) {
-    alloc_info->num_bytes_in_use += layout.size;
-    alloc_info->num_active_allocations += 1;
+static void sample_alloc(allocator_info *alloc_info, usize size, void *ptr) {
+    usize interval = alloc_info->heap_sample_interval.load(std::memory_order_relaxed);
+    if (interval == 0) {
+        return;
+    }
+
+    // Only the request that takes the countdown past zero is sampled, and it starts the next one.
+    // The next countdown starts over at the end of this allocation, rather than carrying over the
+    // overshoot: any further sample points inside it are already covered by its weight, and a big
+    // allocation could otherwise leave the countdown below zero for good.
+    std::atomic<isize> &bytes_until_sample = alloc_info->current_shard().bytes_until_sample;
+    isize before = bytes_until_sample.fetch_sub((isize)size, std::memory_order_relaxed);
+    if (before <= 0 || before - (isize)size > 0) {
+        return;
+    }
+    bytes_until_sample.store(next_sample_distance(interval), std::memory_order_relaxed);
+
+    // An allocation gets sampled when a sample point lands in any of its bytes, which happens with
+    // probability `1 - e^(-size/interval)`. Weighting by the inverse makes the estimate unbiased.
+    double weight = 1.0 / -std::expm1(-(double)size / (double)interval);
+    heap_sample sample(debug_allocator(), size, weight);
+    sample.stack_trace = capture_stack_trace(debug_allocator());
+
+    std::lock_guard<std::mutex> guard(alloc_info->sample_lock);
+    alloc_info->heap_samples.insert((rawptr)ptr, mv(sample));
+    alloc_info->heap_sample_count.store(alloc_info->heap_samples.len(), std::memory_order_relaxed);
+}
+
+static void sample_dealloc(allocator_info *alloc_info, void *ptr) {
+    if (alloc_info->heap_sample_count.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> guard(alloc_info->sample_lock);
+        alloc_info->heap_samples.remove((rawptr)ptr);
+        alloc_info->heap_sample_count.store(alloc_info->heap_samples.len(),
+            std::memory_order_relaxed);
+    }
+}
+
+// Adds to the live counts, and raises the high-water marks of the allocator and of every query
+// listening to it.
+static void add_live(allocator_info *alloc_info, isize bytes, isize allocations) {
+    usize bytes_in_use
+        = alloc_info->num_bytes_in_use.fetch_add((usize)bytes, std::memory_order_relaxed)
+        + (usize)bytes;
+    usize active_allocations = alloc_info->num_active_allocations.fetch_add((usize)allocations,
+                                   std::memory_order_relaxed)
+        + (usize)allocations;
+    if (bytes <= 0 && allocations <= 0) {
+        return;
+    }
+
+    raise_to(alloc_info->maximum_bytes_in_use, bytes_in_use);
+    raise_to(alloc_info->maximum_active_allocations, active_allocations);
+    for (auto &slot : alloc_info->listening_queries) {
+        if (internal_query_info *query = slot.load(std::memory_order_acquire)) {
+            raise_to(query->peak_bytes_in_use, bytes_in_use);
+            raise_to(query->peak_active_allocations, active_allocations);
+        }
+    }
+}
 
-    alloc_info->maximum_active_allocations
-        = std::max(alloc_info->maximum_active_allocations, alloc_info->num_active_allocations);
-    alloc_info->maximum_bytes_in_use
-        = std::max(alloc_info->maximum_bytes_in_use, alloc_info->num_bytes_in_use);
+static void commit_alloc(allocator_info *alloc_info, layout layout, void *ptr, usize min_size) {
+    add_live(alloc_info, (isize)layout.size, 1);
 
-    for (usize i = 0; i < alloc_info->listening_queries.len(); ++i) {
-        internal_query_info *query = &queries[alloc_info->listening_queries[i].id];
+    counter_shard &shard = alloc_info->current_shard();
+    shard.allocation_count.fetch_add(1, std::memory_order_relaxed);
+    shard.cum_allocation_bytes.fetch_add(layout.size, std::memory_order_relaxed);
 
-        query->query.bytes_in_use += layout.size;
-        query->query.cum_allocation_bytes += layout.size;
-        query->query.active_allocations += 1;
-        query->query.allocation_count += 1;
+    sample_alloc(alloc_info, layout.size, ptr);
 
-        query->query.maximum_active_allocations
-            = std::max(query->query.maximum_active_allocations, query->query.active_allocations);
-        query->query.maximum_bytes_in_use
-            = std::max(query->query.maximum_bytes_in_use, query->query.bytes_in_use);
+    if (alloc_info->tier.load(std::memory_order_relaxed) != profiling_tier::full) {
+        return;
     }
 
     allocation_info info(ptr, layout);
+    info.min_size = min_size;
     if (alloc_info->should_capture_stack_traces) {
         info.stack_trace = capture_stack_trace(debug_allocator());
     }
 
+    std::lock_guard<std::mutex> guard(alloc_info->checker_lock);
     if (auto overlapping = alloc_info->checker.add(ptr, mv(info))) {
         if (alloc_info->name) {
             VIXEN_PANIC(
@@ -502,19 +1080,9 @@ static bool is_even(char ch) {
     return ch % 2 == 0;
 }
 
-static void commit_dealloc(allocator_info *alloc_info, layout layout, void *ptr) {
-    alloc_info->num_bytes_in_use -= layout.size;
-    alloc_info->num_active_allocations -= 1;
-
-    for (usize i = 0; i < alloc_info->listening_queries.len(); ++i) {
-        internal_query_info *query = &queries[alloc_info->listening_queries[i].id];
-
-        query->query.bytes_in_use -= layout.size;
-        query->query.cum_deallocation_bytes += layout.size;
-        query->query.active_allocations -= 1;
-        query->query.deallocation_count += 1;
-    }
-
+// Checks a deallocation against the live allocations, and returns the size that the block was
+// actually tracked with.
+static usize check_dealloc(allocator_info *alloc_info, layout layout, void *ptr) {
     // option<allocation_info> prev = alloc_info->checker.infos.remove(ptr);
 
     // VIXEN_ASSERT(
@@ -524,6 +1092,7 @@ static void commit_dealloc(allocator_info *alloc_info, layout layout, void *ptr)
     //     layout,
     //     prev->allocated_with);
 
+    std::lock_guard<std::mutex> guard(alloc_info->checker_lock);
     auto removal_info = alloc_info->checker.remove(ptr, layout, debug_allocator());
     if (auto &info = removal_info.info) {
         if (removal_info.is_dealloc_start_misaligned || removal_info.is_dealloc_end_misaligned) {
@@ -558,6 +1127,7 @@ static void commit_dealloc(allocator_info *alloc_info, layout layout, void *ptr)
             string diagnostic_str(mv(diagnostic));
             VIXEN_PANIC("{}", diagnostic_str);
         }
+        return info->allocated_with.size;
     } else {
         VIXEN_PANIC(
             "tried to deallocate pointer at {} using layout {}, but the pointer was not in any active allocation.",
@@ -566,7 +1136,132 @@ static void commit_dealloc(allocator_info *alloc_info, layout layout, void *ptr)
     }
 }
 
-void record_reset(allocator_id id) {}
+static void count_dealloc(allocator_info *alloc_info, usize size) {
+    add_live(alloc_info, -(isize)size, -1);
+
+    counter_shard &shard = alloc_info->current_shard();
+    shard.deallocation_count.fetch_add(1, std::memory_order_relaxed);
+    shard.cum_deallocation_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+static void commit_dealloc(allocator_info *alloc_info, layout layout, void *ptr) {
+    // Counters have to trust the size they're given, unless the checker knows better.
+    usize size = layout.size;
+    if (alloc_info->tier.load(std::memory_order_relaxed) == profiling_tier::full) {
+        size = check_dealloc(alloc_info, layout, ptr);
+    }
+
+    count_dealloc(alloc_info, size);
+    sample_dealloc(alloc_info, ptr);
+}
+
+static void trace_request(trace_event_kind kind,
+    allocator_id id,
+    layout old_layout,
+    void *old_ptr,
+    layout new_layout,
+    void *new_ptr) {
+    if (!is_event_tracing()) {
+        return;
+    }
+
+    trace_event event = {};
+    event.kind = kind;
+    event.allocator = (i32)id.id;
+    event.ptr = (u64)new_ptr;
+    event.size = new_layout.size;
+    event.align = new_layout.align;
+    event.old_ptr = (u64)old_ptr;
+    event.old_size = old_layout.size;
+    record_trace_event(event);
+}
+
+static void trace_alloc(allocator_id id, layout layout, void *ptr) {
+    trace_request(trace_event_kind::alloc, id, {0, 0}, nullptr, layout, ptr);
+}
+
+static void trace_dealloc(allocator_id id, layout layout, void *ptr) {
+    trace_request(trace_event_kind::dealloc, id, {0, 0}, nullptr, layout, ptr);
+}
+
+// Drops the checker's allocations that start in [begin, end), and takes them out of the live counts.
+static void remove_live_range(allocator_info *alloc_info, rawptr begin, rawptr end) {
+    allocation_checker::range_removal removed;
+    {
+        std::lock_guard<std::mutex> guard(alloc_info->checker_lock);
+        removed = alloc_info->checker.remove_range(begin, end);
+    }
+    add_live(alloc_info, -(isize)removed.bytes, -(isize)removed.count);
+}
+
+void record_reset(allocator_id id) {
+    if (debug_allocator()->id == id) {
+        return;
+    }
+
+    // Everything the allocator handed out is gone, so none of the samples are live any more.
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    if (alloc_info->heap_sample_count.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> guard(alloc_info->sample_lock);
+        alloc_info->heap_samples.clear();
+        alloc_info->heap_sample_count.store(0, std::memory_order_relaxed);
+    }
+
+    // Nothing is live after a reset, so the counters can follow it even without the checker.
+    if (alloc_info->tier.load(std::memory_order_relaxed) == profiling_tier::full) {
+        remove_live_range(alloc_info, nullptr, (rawptr)~(usize)0);
+    } else {
+        add_live(alloc_info,
+            -(isize)alloc_info->num_bytes_in_use.load(std::memory_order_relaxed),
+            -(isize)alloc_info->num_active_allocations.load(std::memory_order_relaxed));
+    }
+
+    if (is_outermost_transaction(id)) {
+        trace_request(trace_event_kind::reset, id, {0, 0}, nullptr, {0, 0}, nullptr);
+    }
+}
+
+void record_restore(allocator_id id, void *begin, void *end) {
+    if (debug_allocator()->id == id) {
+        return;
+    }
+
+    // Only the blocks past the savepoint were freed, and samples of older blocks are still live.
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    if (alloc_info->heap_sample_count.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> guard(alloc_info->sample_lock);
+        vector<rawptr> freed(debug_allocator());
+        auto &table = alloc_info->heap_samples.table;
+        for (usize slot = 0; slot < table.capacity; ++slot) {
+            if (table.is_occupied(slot)) {
+                rawptr ptr = table.get(slot).get<0>();
+                if (ptr >= begin && ptr < end) {
+                    freed.push(ptr);
+                }
+            }
+        }
+        for (rawptr ptr : freed) {
+            alloc_info->heap_samples.remove(ptr);
+        }
+        alloc_info->heap_sample_count.store(alloc_info->heap_samples.len(),
+            std::memory_order_relaxed);
+    }
+
+    // Only the checker knows the sizes of the freed blocks, so the counters can't follow a restore
+    // at lower tiers.
+    if (alloc_info->tier.load(std::memory_order_relaxed) == profiling_tier::full) {
+        remove_live_range(alloc_info, (rawptr)begin, (rawptr)end);
+    }
+
+    if (is_outermost_transaction(id)) {
+        trace_request(trace_event_kind::restore,
+            id,
+            {0, 0},
+            nullptr,
+            {(usize)end - (usize)begin, 0},
+            begin);
+    }
+}
 
 void record_alloc(allocator_id id, layout layout, void *ptr) {
     if (debug_allocator()->id == id) {
@@ -574,7 +1269,7 @@ void record_alloc(allocator_id id, layout layout, void *ptr) {
     }
 
     allocator_info *alloc_info = &allocator_infos[id.id];
-    if (ptr == nullptr || alloc_info->current_transaction_depth != 1) {
+    if (ptr == nullptr || !is_outermost_transaction(id)) {
         return;
     }
 
@@ -583,7 +1278,8 @@ void record_alloc(allocator_id id, layout layout, void *ptr) {
     } else {
         VIXEN_TRACE("[A] {} ({})", layout, ptr);
     }
-    commit_alloc(alloc_info, layout, ptr);
+    trace_alloc(id, layout, ptr);
+    commit_alloc(alloc_info, layout, ptr, layout.size);
 }
 
 void record_dealloc(allocator_id id, layout layout, void *ptr) {
@@ -592,7 +1288,7 @@ void record_dealloc(allocator_id id, layout layout, void *ptr) {
     }
 
     allocator_info *alloc_info = &allocator_infos[id.id];
-    if (ptr == nullptr || alloc_info->current_transaction_depth != 1) {
+    if (ptr == nullptr || !is_outermost_transaction(id)) {
         return;
     }
 
@@ -601,9 +1297,210 @@ void record_dealloc(allocator_id id, layout layout, void *ptr) {
     } else {
         VIXEN_TRACE("[D] {} ({})", layout, ptr);
     }
+    trace_dealloc(id, layout, ptr);
     commit_dealloc(alloc_info, layout, ptr);
 }
 
+void record_alloc_batch(allocator_id id, layout layout, usize count, void *const *ptrs) {
+    if (debug_allocator()->id == id) {
+        return;
+    }
+
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    if (!is_outermost_transaction(id)) {
+        return;
+    }
+
+    if (alloc_info->name) {
+        VIXEN_TRACE("[A] '{}' {} x {}", *alloc_info->name, layout, count);
+    } else {
+        VIXEN_TRACE("[A] {} x {}", layout, count);
+    }
+    for (usize i = 0; i < count; ++i) {
+        trace_alloc(id, layout, ptrs[i]);
+        commit_alloc(alloc_info, layout, ptrs[i], layout.size);
+    }
+}
+
+void record_dealloc_batch(allocator_id id, layout layout, usize count, void *const *ptrs) {
+    if (debug_allocator()->id == id) {
+        return;
+    }
+
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    if (!is_outermost_transaction(id)) {
+        return;
+    }
+
+    if (alloc_info->name) {
+        VIXEN_TRACE("[D] '{}' {} x {}", *alloc_info->name, layout, count);
+    } else {
+        VIXEN_TRACE("[D] {} x {}", layout, count);
+    }
+    for (usize i = 0; i < count; ++i) {
+        trace_dealloc(id, layout, ptrs[i]);
+        commit_dealloc(alloc_info, layout, ptrs[i]);
+    }
+}
+
+// Takes a block that's being reallocated out of the checker, and returns how it was tracked.
+static allocation_info take_realloc_block(
+    allocator_info *alloc_info, layout old_layout, void *old_ptr) {
+    std::lock_guard<std::mutex> guard(alloc_info->checker_lock);
+    auto removal_info = alloc_info->checker.remove(old_ptr, old_layout, debug_allocator());
+    auto &info = removal_info.info;
+    if (!info) {
+        VIXEN_PANIC(
+            "tried to reallocate, but the old pointer was not in any active allocation:\n"
+            "reallocation request:\n"
+            "old pointer = {}\n"
+            "old layout = {}\n",
+            old_ptr,
+            old_layout);
+    }
+
+    if (removal_info.is_dealloc_start_misaligned || removal_info.is_dealloc_end_misaligned) {
+        vector<char> diagnostic(debug_allocator());
+        auto bi = stream::back_inserter(diagnostic);
+        auto oi = stream::make_stream_output_iterator(bi);
+
+        fmt::format_to(oi,
+            "tried to reallocate, but the allocated pointer was in the middle of a block:\n");
+
+        fmt::format_to(oi, "request:\n");
+        if (alloc_info->name) {
+            fmt::format_to(oi, "- allocator name = '{}'\n", *alloc_info->name);
+        }
+        fmt::format_to(oi, "- old pointer = {}\n", old_ptr);
+        fmt::format_to(oi, "- old layout = {}\n", old_layout);
+        fmt::format_to(oi, "- start misaligned = {}\n", removal_info.is_dealloc_start_misaligned);
+        fmt::format_to(oi, "- end misaligned = {}\n", removal_info.is_dealloc_end_misaligned);
+        fmt::format_to(oi, "\n");
+        fmt::format_to(oi, "block in:\n");
+        fmt::format_to(oi, "- pointer = {}\n", info->base);
+        fmt::format_to(oi, "- layout = {}\n", info->allocated_with);
+        fmt::format_to(oi, "- reallocation count = {}\n", info->realloc_count);
+
+        if (info->stack_trace) {
+            fmt::format_to(oi, "- stack trace:\n");
+            translation_cache cache(heap::debug_allocator());
+            format_stack_trace(bi, cache, *info->stack_trace);
+        }
+
+        string diagnostic_str(mv(diagnostic));
+        VIXEN_PANIC("{}", diagnostic_str);
+    }
+    return mv(*info);
+}
+
+// Puts a block taken by `take_realloc_block` back into the checker at wherever it ended up.
+static void put_realloc_block(allocator_info *alloc_info,
+    allocation_info &&info,
+    layout new_layout,
+    void *new_ptr,
+    usize new_min_size) {
+    // TODO: maybe record stack traces for reallocations too instead of only keeping track of the
+    // initial alloc.
+    info.allocated_with = new_layout;
+    info.min_size = new_min_size;
+    info.base = new_ptr;
+
+    std::lock_guard<std::mutex> guard(alloc_info->checker_lock);
+    if (auto overlapping = alloc_info->checker.add(new_ptr, mv(info))) {
+        VIXEN_PANIC("allocation collision: tried to allocate over a previous allocation at {}.\n",
+            overlapping->base);
+    }
+}
+
+static void count_realloc(
+    allocator_info *alloc_info, usize old_size, layout new_layout, void *new_ptr) {
+    add_live(alloc_info, (isize)new_layout.size - (isize)old_size, 0);
+
+    counter_shard &shard = alloc_info->current_shard();
+    shard.reallocation_count.fetch_add(1, std::memory_order_relaxed);
+    shard.cum_allocation_bytes.fetch_add(new_layout.size, std::memory_order_relaxed);
+    shard.cum_deallocation_bytes.fetch_add(old_size, std::memory_order_relaxed);
+
+    sample_alloc(alloc_info, new_layout.size, new_ptr);
+}
+
+// Moves the block that `record_realloc_start` took for the outermost transaction of `id` out of the
+// transaction, if it took one.
+static option<allocation_info> take_moving_block(allocator_id id) {
+    allocation_info *&slot = transactions.moving[transaction_index(id)];
+    if (!slot) {
+        return nullptr;
+    }
+
+    option<allocation_info> info = mv(*slot);
+    slot->~allocation_info();
+    debug_allocator()->dealloc(layout::of<allocation_info>(), slot);
+    slot = nullptr;
+    return info;
+}
+
+void record_realloc_start(allocator_id id, layout old_layout, void *old_ptr, layout new_layout) {
+    if (debug_allocator()->id == id) {
+        return;
+    }
+
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    if (old_ptr == nullptr || !is_outermost_transaction(id)) {
+        return;
+    }
+
+    transactions.reallocs[transaction_index(id)] = {old_layout, new_layout, old_ptr, false};
+
+    // The sampler sees a reallocation as freeing the old block and allocating a new one.
+    sample_dealloc(alloc_info, old_ptr);
+
+    if (alloc_info->tier.load(std::memory_order_relaxed) == profiling_tier::full) {
+        allocation_info info = take_realloc_block(alloc_info, old_layout, old_ptr);
+        transactions.moving[transaction_index(id)]
+            = new (debug_allocator()->alloc(layout::of<allocation_info>()))
+                allocation_info(mv(info));
+    }
+}
+
+void record_realloc_failed(allocator_id id, void *old_ptr) {
+    if (debug_allocator()->id == id) {
+        return;
+    }
+
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    if (old_ptr == nullptr || !is_outermost_transaction(id)) {
+        return;
+    }
+
+    // The old block is still live, though it lost its heap sample, if it had one.
+    if (option<allocation_info> info = take_moving_block(id)) {
+        layout tracked_layout = info->allocated_with;
+        usize min_size = info->min_size;
+        put_realloc_block(alloc_info, mv(*info), tracked_layout, old_ptr, min_size);
+    }
+}
+
+void record_realloc_move(void *old_ptr, void *new_ptr) {
+    if (transactions.len == 0 || !is_event_tracing()) {
+        return;
+    }
+
+    // Allocators that hand reallocations on to their parent are still in the middle of theirs, and
+    // the old block is about to be freed for them too.
+    for (usize i = 0; i < transactions.len; ++i) {
+        pending_realloc &pending = transactions.reallocs[i];
+        if (pending.old_ptr == old_ptr && !pending.traced) {
+            trace_request(trace_event_kind::realloc,
+                transactions.ids[i],
+                pending.old_layout,
+                old_ptr,
+                pending.new_layout,
+                new_ptr);
+            pending.traced = true;
+        }
+    }
+}
+
 void record_realloc(
     allocator_id id, layout old_layout, void *old_ptr, layout new_layout, void *new_ptr) {
     if (debug_allocator()->id == id) {
@@ -611,10 +1508,14 @@ void record_realloc(
     }
 
     allocator_info *alloc_info = &allocator_infos[id.id];
-    if (alloc_info->current_transaction_depth != 1) {
+    if (!is_outermost_transaction(id)) {
         return;
     }
 
+    // Counters have to trust the size they're given, unless the checker knows better.
+    option<allocation_info> moved = take_moving_block(id);
+    usize old_size = moved ? moved->allocated_with.size : old_layout.size;
+
     if (old_ptr == nullptr && new_ptr != nullptr) {
         // Realloc zero -> something, which is an allocation.
         if (alloc_info->name) {
@@ -622,7 +1523,8 @@ void record_realloc(
         } else {
             VIXEN_TRACE("[R:A] {} ({})", new_layout, new_ptr);
         }
-        commit_alloc(alloc_info, new_layout, new_ptr);
+        trace_alloc(id, new_layout, new_ptr);
+        commit_alloc(alloc_info, new_layout, new_ptr, new_layout.size);
     } else if (old_ptr != nullptr && new_ptr == nullptr) {
         // Realloc something -> zero, which is a deallocation.
         if (alloc_info->name) {
@@ -630,7 +1532,8 @@ void record_realloc(
         } else {
             VIXEN_TRACE("[R:D] {} ({})", old_layout, old_ptr);
         }
-        commit_dealloc(alloc_info, old_layout, old_ptr);
+        trace_dealloc(id, old_layout, old_ptr);
+        count_dealloc(alloc_info, old_size);
     } else if (old_ptr != nullptr, new_ptr != nullptr) {
         // Bona fide reallocation!
         if (alloc_info->name) {
@@ -643,104 +1546,103 @@ void record_realloc(
         } else {
             VIXEN_TRACE("[R] {} ({}) -> {} ({})", old_layout, old_ptr, new_layout, old_layout);
         }
-        alloc_info->num_bytes_in_use -= old_layout.size;
-        alloc_info->num_bytes_in_use += new_layout.size;
-        alloc_info->maximum_bytes_in_use
-            = std::max(alloc_info->maximum_bytes_in_use, alloc_info->num_bytes_in_use);
+        // Blocks that moved were traced before the old one was freed.
+        if (!transactions.reallocs[transaction_index(id)].traced) {
+            trace_request(trace_event_kind::realloc, id, old_layout, old_ptr, new_layout, new_ptr);
+        }
+        if (moved) {
+            put_realloc_block(alloc_info, mv(*moved), new_layout, new_ptr, new_layout.size);
+        }
+        count_realloc(alloc_info, old_size, new_layout, new_ptr);
+    }
+}
 
-        for (usize i = 0; i < alloc_info->listening_queries.len(); ++i) {
-            internal_query_info *query = &queries[alloc_info->listening_queries[i].id];
+void record_alloc_at_least(allocator_id id, layout requested, usize usable, void *ptr) {
+    if (debug_allocator()->id == id) {
+        return;
+    }
 
-            query->query.bytes_in_use -= old_layout.size;
-            query->query.bytes_in_use += new_layout.size;
-            query->query.cum_allocation_bytes += new_layout.size;
-            query->query.cum_deallocation_bytes += old_layout.size;
-            query->query.reallocation_count += 1;
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    if (ptr == nullptr || !is_outermost_transaction(id)) {
+        return;
+    }
 
-            query->query.maximum_bytes_in_use
-                = std::max(query->query.maximum_bytes_in_use, query->query.bytes_in_use);
-        }
+    layout actual = requested.with_size(usable);
+    if (alloc_info->name) {
+        VIXEN_TRACE("[A] '{}' {} ({})", *alloc_info->name, actual, ptr);
+    } else {
+        VIXEN_TRACE("[A] {} ({})", actual, ptr);
+    }
+    trace_alloc(id, actual, ptr);
+    commit_alloc(alloc_info, actual, ptr, requested.size);
+}
 
-        auto removal_info = alloc_info->checker.remove(old_ptr, old_layout, debug_allocator());
-        if (auto &info = removal_info.info) {
-            if (removal_info.is_dealloc_start_misaligned || removal_info.is_dealloc_end_misaligned)
-            {
-                vector<char> diagnostic(debug_allocator());
-                auto bi = stream::back_inserter(diagnostic);
-                auto oi = stream::make_stream_output_iterator(bi);
+void record_resize_in_place(
+    allocator_id id, layout old_layout, usize new_size, usize usable, void *ptr) {
+    if (debug_allocator()->id == id) {
+        return;
+    }
 
-                fmt::format_to(oi,
-                    "tried to reallocate, but the allocated pointer was in the middle of a block:\n");
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    if (ptr == nullptr || !is_outermost_transaction(id)) {
+        return;
+    }
 
-                fmt::format_to(oi, "request:\n");
-                if (alloc_info->name) {
-                    fmt::format_to(oi, "- allocator name = '{}'\n", *alloc_info->name);
-                }
-                fmt::format_to(oi, "- old pointer = {}\n", old_ptr);
-                fmt::format_to(oi, "- old layout = {}\n", old_layout);
-                fmt::format_to(oi, "- new pointer = {}\n", new_ptr);
-                fmt::format_to(oi, "- new layout = {}\n", new_layout);
-                fmt::format_to(oi,
-                    "- start misaligned = {}\n",
-                    removal_info.is_dealloc_start_misaligned);
-                fmt::format_to(oi,
-                    "- end misaligned = {}\n",
-                    removal_info.is_dealloc_end_misaligned);
-                fmt::format_to(oi, "\n");
-                fmt::format_to(oi, "block in:\n");
-                fmt::format_to(oi, "- pointer = {}\n", info->base);
-                fmt::format_to(oi, "- layout = {}\n", info->allocated_with);
-                fmt::format_to(oi, "- reallocation count = {}\n", info->realloc_count);
-
-                if (info->stack_trace) {
-                    fmt::format_to(oi, "- stack trace:\n");
-                    translation_cache cache(heap::debug_allocator());
-                    format_stack_trace(bi, cache, *info->stack_trace);
-                }
+    layout new_layout = old_layout.with_size(usable);
+    if (alloc_info->name) {
+        VIXEN_TRACE("[R] '{}' {} -> {} in place ({})",
+            *alloc_info->name,
+            old_layout,
+            new_layout,
+            ptr);
+    } else {
+        VIXEN_TRACE("[R] {} -> {} in place ({})", old_layout, new_layout, ptr);
+    }
+    trace_request(trace_event_kind::realloc, id, old_layout, ptr, new_layout, ptr);
+
+    // The block never leaves the caller's hands, so it can go straight back into the checker.
+    usize old_size = old_layout.size;
+    sample_dealloc(alloc_info, ptr);
+    if (alloc_info->tier.load(std::memory_order_relaxed) == profiling_tier::full) {
+        allocation_info info = take_realloc_block(alloc_info, old_layout, ptr);
+        old_size = info.allocated_with.size;
+        put_realloc_block(alloc_info, mv(info), new_layout, ptr, new_size);
+    }
+    count_realloc(alloc_info, old_size, new_layout, ptr);
+}
 
-                string diagnostic_str(mv(diagnostic));
-                VIXEN_PANIC("{}", diagnostic_str);
-            } else {
-                // TODO: maybe record stack traces for reallocations too instead of only keeping
-                // track of the initial alloc.
-                info->allocated_with = new_layout;
-                info->base = new_ptr;
-                if (auto overlapping = alloc_info->checker.add(new_ptr, mv(*info))) {
-                    VIXEN_PANIC(
-                        "allocation collision: tried to allocate over a previous allocation at {}.\n",
-                        overlapping->base);
-                }
-            }
-        } else {
-            VIXEN_PANIC(
-                "tried to reallocate, but the old pointer was not in any active allocation:\n"
-                "reallocation request:\n",
-                "old pointer = {}\n"
-                "old layout = {}\n"
-                "new pointer = {}\n"
-                "new layout = {}\n",
-                old_ptr,
-                old_layout,
-                new_ptr,
-                new_layout);
-        }
+void record_page_mapping(allocator_id id, page_mapping_kind requested, page_mapping_kind actual) {
+    if (debug_allocator()->id == id || requested == page_mapping_kind::regular) {
+        return;
+    }
 
-        // option<allocation_info> prev = alloc_info->checker.infos.remove(old_ptr);
-        // VIXEN_ASSERT(prev.is_some(),
-        //     "Tried to reallocate pointer {}, but it was not an active allocation.",
-        //     old_ptr);
+    allocator_info *alloc_info = &allocator_infos[id.id];
+    bool is_explicit = actual == page_mapping_kind::explicit_huge;
+    bool is_transparent = actual == page_mapping_kind::transparent_huge;
+    bool is_fallback = actual != requested;
 
-        // allocation_info info{new_layout, prev->realloc_count + 1};
-        // if (alloc_info->should_capture_stack_traces) {
-        //     info.stack_trace = capture_stack_trace(debug_allocator());
-        // }
+    if (alloc_info->name) {
+        VIXEN_TRACE("[M] '{}' wanted {} pages, got {} pages",
+            *alloc_info->name,
+            (int)requested,
+            (int)actual);
+    } else {
+        VIXEN_TRACE("[M] wanted {} pages, got {} pages", (int)requested, (int)actual);
+    }
 
-        // option<allocation_info> overlapping = alloc_info->checker.infos.insert(new_ptr,
-        // mv(info)); VIXEN_ASSERT(overlapping.is_none(),
-        //     "Tried to reallocate pointer {} ({}) to {} ({}), but it overlaps with an active
-        //     allocation with layout ({}).", old_ptr, old_layout, new_ptr, new_layout,
-        //     overlapping->allocated_with);
+    counter_shard &shard = alloc_info->current_shard();
+    shard.explicit_huge_page_mappings.fetch_add(is_explicit, std::memory_order_relaxed);
+    shard.transparent_huge_page_mappings.fetch_add(is_transparent, std::memory_order_relaxed);
+    shard.huge_page_fallbacks.fetch_add(is_fallback, std::memory_order_relaxed);
+}
+
+void record_reserve(allocator_id id, usize size) {
+    if (debug_allocator()->id == id) {
+        return;
     }
+
+    allocator_infos[id.id].current_shard().reserved_bytes.fetch_add(size,
+        std::memory_order_relaxed);
 }
 
 void record_legacy_alloc(allocator_id id, usize size, void *ptr) {}
@@ -0,0 +1,357 @@
+#include "vixen/allocator/allocators.hpp"
+
+namespace vixen::heap {
+
+// Number of 16-byte-spaced classes at the bottom of the size class table, which covers sizes up to
+// 128 bytes. Everything above that gets four classes per power of two.
+constexpr usize LINEAR_CLASS_COUNT = 8;
+constexpr usize LINEAR_CLASS_MAX = LINEAR_CLASS_COUNT * SLAB_MIN_ALIGNMENT;
+constexpr usize CLASSES_PER_DOUBLING = 4;
+
+static usize log2_floor(usize n) {
+    return (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(n);
+}
+
+bool slab_allocator::is_small(const layout &layout) {
+    return layout.size <= SLAB_MAX_SIZE && layout.align <= SLAB_MIN_ALIGNMENT;
+}
+
+usize slab_allocator::size_class_of(usize size) {
+    if (size <= LINEAR_CLASS_MAX) {
+        return size == 0 ? 0 : (size - 1) / SLAB_MIN_ALIGNMENT;
+    }
+
+    // `size` is in the range (2^k, 2^(k+1)], which is split into four classes of 2^(k-2) bytes.
+    usize k = log2_floor(size - 1);
+    usize base = (usize)1 << k;
+    usize sub_class = (size - 1 - base) >> (k - 2);
+    usize doublings = k - log2_floor(LINEAR_CLASS_MAX);
+    return LINEAR_CLASS_COUNT + doublings * CLASSES_PER_DOUBLING + sub_class;
+}
+
+usize slab_allocator::size_class_size(usize size_class) {
+    if (size_class < LINEAR_CLASS_COUNT) {
+        return (size_class + 1) * SLAB_MIN_ALIGNMENT;
+    }
+
+    usize idx = size_class - LINEAR_CLASS_COUNT;
+    usize k = log2_floor(LINEAR_CLASS_MAX) + idx / CLASSES_PER_DOUBLING;
+    return ((usize)1 << k) + (idx % CLASSES_PER_DOUBLING + 1) * ((usize)1 << (k - 2));
+}
+
+usize slab_allocator::resized_slot_size(const layout &old_layout, usize new_size) {
+    layout new_layout = old_layout.with_size(new_size);
+    if (!is_small(old_layout) || !is_small(new_layout)) {
+        return 0;
+    }
+
+    usize size_class = size_class_of(old_layout.size);
+    return size_class == size_class_of(new_size) ? size_class_size(size_class) : 0;
+}
+
+static_assert(SLAB_MAX_SIZE == 16 * 1024 && SLAB_SIZE_CLASS_COUNT == 36,
+    "SLAB_SIZE_CLASS_COUNT must be kept in sync with SLAB_MAX_SIZE.");
+
+static slab_allocator::span_descriptor *span_of(void *ptr) {
+    return (slab_allocator::span_descriptor *)((usize)ptr & ~(SLAB_SPAN_SIZE - 1));
+}
+
+usize slab_allocator::slot_size_of(const void *ptr) {
+    return size_class_size(span_of((void *)ptr)->size_class);
+}
+
+static layout span_layout() {
+    return {SLAB_SPAN_SIZE, SLAB_SPAN_SIZE};
+}
+
+slab_allocator::slab_allocator(allocator *parent) : parent(parent) {}
+
+slab_allocator::~slab_allocator() {
+    span_descriptor *current = this->spans;
+    while (current) {
+        span_descriptor *next = current->all_next;
+        this->parent->dealloc(span_layout(), (void *)current);
+        current = next;
+    }
+}
+
+static void link_partial(slab_allocator::span_descriptor *&head,
+    slab_allocator::span_descriptor *span) {
+    span->prev = nullptr;
+    span->next = head;
+    if (head) {
+        head->prev = span;
+    }
+    head = span;
+}
+
+static void unlink_partial(slab_allocator::span_descriptor *&head,
+    slab_allocator::span_descriptor *span) {
+    if (span->prev) {
+        span->prev->next = span->next;
+    } else {
+        head = span->next;
+    }
+    if (span->next) {
+        span->next->prev = span->prev;
+    }
+    span->prev = nullptr;
+    span->next = nullptr;
+}
+
+slab_allocator::span_descriptor *slab_allocator::allocate_span(usize size_class) {
+    auto *span = (span_descriptor *)this->parent->alloc(span_layout());
+    usize object_size = size_class_size(size_class);
+
+    void *first = util::align_pointer_up(
+        util::offset_rawptr(span, sizeof(span_descriptor)),
+        SLAB_MIN_ALIGNMENT);
+    usize capacity = ((usize)span + SLAB_SPAN_SIZE - (usize)first) / object_size;
+
+    span->owner = this;
+    span->prev = nullptr;
+    span->next = nullptr;
+    span->free_list = nullptr;
+    span->bump = first;
+    span->end = util::offset_rawptr(first, capacity * object_size);
+    span->size_class = size_class;
+    span->used = 0;
+    span->capacity = capacity;
+    new (&span->remote_frees) remote_free_list();
+    span->next_pending = nullptr;
+
+    span->all_prev = nullptr;
+    span->all_next = this->spans;
+    if (this->spans) {
+        this->spans->all_prev = span;
+    }
+    this->spans = span;
+
+    return span;
+}
+
+void slab_allocator::release_span(span_descriptor *span) {
+    if (span->all_prev) {
+        span->all_prev->all_next = span->all_next;
+    } else {
+        this->spans = span->all_next;
+    }
+    if (span->all_next) {
+        span->all_next->all_prev = span->all_prev;
+    }
+
+    this->parent->dealloc(span_layout(), (void *)span);
+}
+
+void *slab_allocator::allocate_from_class(usize size_class) {
+    span_descriptor *span = this->partial[size_class];
+    if (!span) {
+        span = allocate_span(size_class);
+        link_partial(this->partial[size_class], span);
+    }
+
+    void *ptr;
+    if (span->free_list) {
+        ptr = span->free_list;
+        span->free_list = *(void **)ptr;
+    } else {
+        ptr = span->bump;
+        span->bump = util::offset_rawptr(span->bump, size_class_size(size_class));
+    }
+
+    span->used += 1;
+    if (span->used == span->capacity) {
+        unlink_partial(this->partial[size_class], span);
+    }
+    return ptr;
+}
+
+void slab_allocator::deallocate_to_span(span_descriptor *span, void *ptr) {
+    VIXEN_DEBUG_ASSERT(span->owner == this,
+        "Tried to deallocate {} from a slab that does not own it.",
+        ptr);
+
+    *(void **)ptr = span->free_list;
+    span->free_list = ptr;
+
+    span_descriptor *&head = this->partial[span->size_class];
+    if (span->used == span->capacity) {
+        link_partial(head, span);
+    }
+    span->used -= 1;
+
+    // Hang on to the last span of a class even if it's empty, so that a single allocation bouncing
+    // between alloc and dealloc doesn't request and release a span every time.
+    if (span->used == 0 && (head != span || span->next != nullptr)) {
+        unlink_partial(head, span);
+        release_span(span);
+    }
+}
+
+// Pushes a slot onto its span's remote list without taking the lock. The first slot to land in an
+// empty list also queues its span for collection. Nobody else can queue the span until it has been
+// collected, and it can't be collected before it's queued, so the span can't be released while
+// this is still touching it.
+void slab_allocator::deallocate_remote(span_descriptor *span, void *ptr) {
+    VIXEN_DEBUG_ASSERT(span->owner == this,
+        "Tried to deallocate {} from a slab that does not own it.",
+        ptr);
+
+    if (!span->remote_frees.push(ptr, ptr)) {
+        return;
+    }
+
+    span_descriptor *head = this->pending_spans.load(std::memory_order_relaxed);
+    do {
+        span->next_pending = head;
+    } while (!this->pending_spans.compare_exchange_weak(head,
+        span,
+        std::memory_order_release,
+        std::memory_order_relaxed));
+}
+
+// NOTE: the lock must be held.
+void slab_allocator::collect_remote_frees() {
+    if (this->pending_spans.load(std::memory_order_relaxed) == nullptr) {
+        return;
+    }
+
+    span_descriptor *span = this->pending_spans.exchange(nullptr, std::memory_order_acquire);
+    while (span) {
+        // Both links live inside the span, which may be released along with its last slot.
+        span_descriptor *next_span = span->next_pending;
+        void *slot = span->remote_frees.take_all();
+        while (slot) {
+            void *next_slot = *(void **)slot;
+            deallocate_to_span(span, slot);
+            slot = next_slot;
+        }
+        span = next_span;
+    }
+}
+
+void slab_allocator::alloc_slots(usize size_class, usize count, void **out) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    collect_remote_frees();
+    usize allocated = 0;
+    try {
+        for (; allocated < count; ++allocated) {
+            out[allocated] = allocate_from_class(size_class);
+        }
+    } catch (allocation_exception &ex) {
+        for (usize i = 0; i < allocated; ++i) {
+            deallocate_to_span(span_of(out[i]), out[i]);
+        }
+        throw;
+    }
+}
+
+void slab_allocator::dealloc_slots(usize count, void *const *ptrs) {
+    std::unique_lock<std::mutex> guard(this->lock, std::try_to_lock);
+    for (usize i = 0; i < count; ++i) {
+        if (guard.owns_lock()) {
+            deallocate_to_span(span_of(ptrs[i]), ptrs[i]);
+        } else {
+            deallocate_remote(span_of(ptrs[i]), ptrs[i]);
+        }
+    }
+}
+
+void *slab_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    if (!is_small(layout)) {
+        return this->parent->alloc(layout);
+    }
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    collect_remote_frees();
+    return allocate_from_class(size_class_of(layout.size));
+}
+
+void slab_allocator::internal_dealloc(const layout &layout, void *ptr) {
+    _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
+
+    if (!is_small(layout)) {
+        this->parent->dealloc(layout, ptr);
+        return;
+    }
+
+    std::unique_lock<std::mutex> guard(this->lock, std::try_to_lock);
+    if (guard.owns_lock()) {
+        deallocate_to_span(span_of(ptr), ptr);
+    } else {
+        deallocate_remote(span_of(ptr), ptr);
+    }
+}
+
+void slab_allocator::internal_alloc_batch(const layout &layout, usize count, void **out_ptrs) {
+    if (!is_small(layout)) {
+        allocator::internal_alloc_batch(layout, count, out_ptrs);
+        return;
+    }
+    alloc_slots(size_class_of(layout.size), count, out_ptrs);
+}
+
+void slab_allocator::internal_dealloc_batch(const layout &layout, usize count, void *const *ptrs) {
+    if (!is_small(layout)) {
+        allocator::internal_dealloc_batch(layout, count, ptrs);
+        return;
+    }
+    dealloc_slots(count, ptrs);
+}
+
+allocation slab_allocator::internal_alloc_at_least(const layout &layout) {
+    if (!is_small(layout)) {
+        return this->parent->alloc_at_least(layout);
+    }
+
+    usize size_class = size_class_of(layout.size);
+    std::lock_guard<std::mutex> guard(this->lock);
+    collect_remote_frees();
+    return {allocate_from_class(size_class), size_class_size(size_class)};
+}
+
+usize slab_allocator::internal_try_grow_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    if (!is_small(old_layout)) {
+        return this->parent->try_grow_in_place(old_layout, new_size, ptr);
+    }
+    return resized_slot_size(old_layout, new_size);
+}
+
+usize slab_allocator::internal_try_shrink_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    if (!is_small(old_layout)) {
+        // Moving into a size class means moving into a slot.
+        if (is_small(old_layout.with_size(new_size))) {
+            return 0;
+        }
+        return this->parent->try_shrink_in_place(old_layout, new_size, ptr);
+    }
+    return resized_slot_size(old_layout, new_size);
+}
+
+void *slab_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    bool old_small = is_small(old_layout);
+    bool new_small = is_small(new_layout);
+
+    // Slots are always the full size of their class, so resizing within a class is free.
+    if (old_small && new_small
+        && size_class_of(old_layout.size) == size_class_of(new_layout.size))
+    {
+        return old_ptr;
+    }
+
+    // Let the parent resize large blocks however it sees fit.
+    if (!old_small && !new_small) {
+        return this->parent->realloc(old_layout, new_layout, old_ptr);
+    }
+
+    return general_realloc(this, old_layout, new_layout, old_ptr);
+}
+
+} // namespace vixen::heap
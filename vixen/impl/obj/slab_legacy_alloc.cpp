@@ -0,0 +1,102 @@
+#include "vixen/allocator/allocators.hpp"
+#include "vixen/util.hpp"
+
+namespace vixen::heap {
+
+static layout legacy_layout(usize size) {
+    return {size, MAX_LEGACY_ALIGNMENT};
+}
+
+static_assert(SLAB_MIN_ALIGNMENT >= MAX_LEGACY_ALIGNMENT,
+    "Slab slots must be aligned well enough for legacy allocations.");
+
+slab_legacy_allocator::slab_legacy_allocator(allocator *small, allocator *large)
+    : small(small), large(large), large_sizes(large) {}
+
+usize slab_legacy_allocator::usable_size(const void *ptr) const {
+    if (ptr == nullptr) {
+        return 0;
+    }
+    if (usize size = this->large_sizes.get(ptr)) {
+        return size;
+    }
+    return slab_allocator::slot_size_of(ptr);
+}
+
+usize slab_legacy_allocator::internal_legacy_size(const void *ptr) const {
+    return usable_size(ptr);
+}
+
+void *slab_legacy_allocator::internal_legacy_alloc(usize size) {
+    // `malloc(0)` has to return something that can be freed, and a null pointer would look like
+    // running out of memory to most callers.
+    layout layout = legacy_layout(std::max(size, (usize)1));
+    if (slab_allocator::is_small(layout)) {
+        // Small blocks are freed with the size of their whole slot, since that's all that can be
+        // found out from the pointer, so they're allocated as the whole slot too.
+        return this->small->alloc_at_least(layout).ptr;
+    }
+
+    void *ptr = this->large->alloc(layout);
+    VIXEN_DEBUG_ASSERT((usize)ptr % page_size() == 0,
+        "Large legacy block {} does not start on a page of its own.",
+        ptr);
+    this->large_sizes.set(ptr, layout.size);
+    return ptr;
+}
+
+void slab_legacy_allocator::internal_legacy_dealloc(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    if (usize size = this->large_sizes.get(ptr)) {
+        this->large_sizes.set(ptr, 0);
+        this->large->dealloc(legacy_layout(size), ptr);
+    } else {
+        this->small->dealloc(legacy_layout(slab_allocator::slot_size_of(ptr)), ptr);
+    }
+}
+
+void *slab_legacy_allocator::internal_legacy_realloc(usize new_size, void *old_ptr) {
+    if (old_ptr == nullptr) {
+        return internal_legacy_alloc(new_size);
+    } else if (new_size == 0) {
+        internal_legacy_dealloc(old_ptr);
+        return nullptr;
+    }
+
+    layout new_layout = legacy_layout(new_size);
+    usize old_size = this->large_sizes.get(old_ptr);
+
+    // Large blocks stay with `large`, which can usually resize them without copying.
+    if (old_size != 0 && !slab_allocator::is_small(new_layout)) {
+        this->large_sizes.set(old_ptr, 0);
+        void *new_ptr;
+        try {
+            new_ptr = this->large->realloc(legacy_layout(old_size), new_layout, old_ptr);
+        } catch (allocation_exception &ex) {
+            this->large_sizes.set(old_ptr, old_size);
+            throw;
+        }
+        this->large_sizes.set(new_ptr, new_size);
+        return new_ptr;
+    }
+
+    // Slots are the full size of their class, so anything that stays in the class stays put.
+    if (old_size == 0) {
+        old_size = slab_allocator::slot_size_of(old_ptr);
+        if (slab_allocator::is_small(new_layout)
+            && slab_allocator::size_class_of(new_size) == slab_allocator::size_class_of(old_size))
+        {
+            return old_ptr;
+        }
+    }
+
+    void *new_ptr = internal_legacy_alloc(new_size);
+    util::copy_nonoverlapping((u8 *)old_ptr, (u8 *)new_ptr, std::min(old_size, new_size));
+    internal_legacy_dealloc(old_ptr);
+    return new_ptr;
+}
+
+} // namespace vixen::heap
@@ -4,8 +4,17 @@
 #include "vixen/defer.hpp"
 #include "vixen/util.hpp"
 
-#include <dlfcn.h>
+#include "vixen/io/file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cxxabi.h>
+#include <elf.h>
 #include <execinfo.h>
+#include <link.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace vixen {
 
@@ -13,23 +22,6 @@ namespace vixen {
 // + ----- Internal ------------------------------------------------------------- +
 
 namespace detail {
-string get_command_output(allocator *alloc, string cmd) {
-    vector<char> cmdbuf = mv(cmd.data);
-    null_terminate(&cmdbuf);
-
-    FILE *pipe = popen(cmdbuf.begin(), "r");
-    if (pipe == nullptr) {
-        VIXEN_ASSERT(false, "`popen({})` failed.", cmd);
-    }
-    defer(pclose(pipe));
-
-    string result(alloc);
-    char buffer[128];
-    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-        result.push(buffer);
-    }
-    return result;
-}
 
 template <typename T>
 string format_string(allocator *alloc, const T &value) {
@@ -40,40 +32,815 @@ string format_string(allocator *alloc, const T &value) {
     return string(mv(diagnostic));
 }
 
-address_info translate_symbol(allocator *alloc, string_slice sym, void *reladdr) {
-    auto open_paren = sym.index_of('(');
+// Reads the primitive encodings that DWARF is built out of. Running off the end of the data marks
+// the reader as failed and returns zeroes from then on, so callers only have to check at the end.
+struct dwarf_reader {
+    const u8 *pos;
+    const u8 *end;
+    bool is_failed = false;
+
+    dwarf_reader(const u8 *start, usize len) : pos(start), end(start + len) {}
+
+    usize remaining() const {
+        return (usize)(this->end - this->pos);
+    }
+
+    bool take(usize len, const u8 **out) {
+        if (this->is_failed || len > remaining()) {
+            this->is_failed = true;
+            this->pos = this->end;
+            return false;
+        }
+        *out = this->pos;
+        this->pos += len;
+        return true;
+    }
+
+    u64 fixed(usize len) {
+        const u8 *bytes;
+        if (!take(len, &bytes)) {
+            return 0;
+        }
+        u64 value = 0;
+        for (usize i = 0; i < len; ++i) {
+            value |= (u64)bytes[i] << (i * 8);
+        }
+        return value;
+    }
+
+    u64 uleb() {
+        u64 value = 0;
+        for (usize shift = 0;; shift += 7) {
+            u8 byte = (u8)fixed(1);
+            if (shift < 64) {
+                value |= (u64)(byte & 0x7f) << shift;
+            }
+            if (!(byte & 0x80) || this->is_failed) {
+                return value;
+            }
+        }
+    }
+
+    i64 sleb() {
+        i64 value = 0;
+        usize shift = 0;
+        u8 byte;
+        do {
+            byte = (u8)fixed(1);
+            if (shift < 64) {
+                value |= (i64)(byte & 0x7f) << shift;
+            }
+            shift += 7;
+        } while ((byte & 0x80) && !this->is_failed);
+        if (shift < 64 && (byte & 0x40)) {
+            value |= -((i64)1 << shift);
+        }
+        return value;
+    }
+
+    const char *cstr() {
+        const u8 *start = this->pos;
+        while (this->pos < this->end && *this->pos != 0) {
+            ++this->pos;
+        }
+        if (this->pos == this->end) {
+            this->is_failed = true;
+            return "";
+        }
+        ++this->pos;
+        return (const char *)start;
+    }
+};
+
+struct image_segment {
+    usize start, end;
+};
+
+// The directory that the paths in the line table at `line_offset` are relative to.
+struct compilation_dir {
+    u64 line_offset;
+    const char *path;
+};
+
+struct elf_symbol {
+    usize address;
+    usize size;
+    const char *name;
+};
+
+// A loaded ELF object, along with the parts of its file that symbolizing needs. The file is mapped
+// rather than read, so only the pages of the tables that are actually looked at get loaded.
+struct loaded_image {
+    explicit loaded_image(allocator *alloc)
+        : path(alloc), segments(alloc), symbols(alloc), compilation_dirs(alloc) {}
+
+    string path;
+    // Added to the addresses in the file to get where they ended up in memory.
+    usize bias = 0;
+    vector<image_segment> segments;
+
+    const u8 *data = nullptr;
+    usize size = 0;
+    vector<elf_symbol> symbols;
+    slice<const u8> debug_line = {nullptr, 0};
+    slice<const u8> debug_line_str = {nullptr, 0};
+    slice<const u8> debug_str = {nullptr, 0};
+    slice<const u8> debug_info = {nullptr, 0};
+    slice<const u8> debug_abbrev = {nullptr, 0};
+    vector<compilation_dir> compilation_dirs;
+
+    bool contains(usize addr) const {
+        for (const image_segment &segment : this->segments) {
+            if (addr >= segment.start && addr < segment.end) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Images stay loaded for as long as the process runs, so each one is only parsed once no matter
+// how many traces get symbolized.
+static std::mutex image_lock;
+static vector<loaded_image *> *loaded_images = nullptr;
+
+static slice<const u8> section_data(const loaded_image &image, const Elf64_Shdr &section) {
+    if (section.sh_type == SHT_NOBITS || section.sh_offset > image.size
+        || section.sh_size > image.size - section.sh_offset)
+    {
+        return {nullptr, 0};
+    }
+    return {image.data + section.sh_offset, section.sh_size};
+}
+
+static void load_symbols(loaded_image *image, const Elf64_Shdr *sections, usize count) {
+    for (usize i = 0; i < count; ++i) {
+        const Elf64_Shdr &section = sections[i];
+        if ((section.sh_type != SHT_SYMTAB && section.sh_type != SHT_DYNSYM)
+            || section.sh_entsize != sizeof(Elf64_Sym) || section.sh_link >= count)
+        {
+            continue;
+        }
+
+        slice<const u8> table = section_data(*image, section);
+        slice<const u8> strings = section_data(*image, sections[section.sh_link]);
+        const Elf64_Sym *syms = (const Elf64_Sym *)table.ptr;
+        for (usize j = 0; j < table.len / sizeof(Elf64_Sym); ++j) {
+            const Elf64_Sym &sym = syms[j];
+            u8 type = ELF64_ST_TYPE(sym.st_info);
+            if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym.st_shndx == SHN_UNDEF
+                || sym.st_value == 0 || sym.st_name >= strings.len)
+            {
+                continue;
+            }
+            // Names are only used if the string table ends in a terminator, which keeps every
+            // name in bounds.
+            if (strings.ptr[strings.len - 1] != 0) {
+                break;
+            }
+            image->symbols.push(elf_symbol{sym.st_value,
+                sym.st_size,
+                (const char *)strings.ptr + sym.st_name});
+        }
+    }
+
+    std::sort(image->symbols.begin(), image->symbols.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.address < rhs.address;
+    });
+}
+
+static void load_compilation_dirs(loaded_image *image);
+
+// Maps the image's file and finds its symbol tables and line tables. Images whose file can't be
+// read, like the vDSO, keep no tables and symbolize to nothing.
+static void load_image_file(loaded_image *image) {
+    string_slice path = image->path.len() > 0 ? string_slice(image->path) : "/proc/self/exe"_s;
+    vector<char> terminated = to_null_terminated(heap::debug_allocator(), path);
+
+    file backing(terminated.begin(), mode::read);
+    struct stat info;
+    if (backing.fd < 0 || fstat(backing.fd, &info) != 0
+        || (usize)info.st_size < sizeof(Elf64_Ehdr))
+    {
+        return;
+    }
+    void *base = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, backing.fd, 0);
+    if (base == MAP_FAILED) {
+        return;
+    }
+    image->data = (const u8 *)base;
+    image->size = info.st_size;
+
+    const Elf64_Ehdr *header = (const Elf64_Ehdr *)base;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64
+        || header->e_ident[EI_DATA] != ELFDATA2LSB || header->e_shentsize != sizeof(Elf64_Shdr)
+        || header->e_shoff > image->size
+        || (usize)header->e_shnum * sizeof(Elf64_Shdr) > image->size - header->e_shoff
+        || header->e_shstrndx >= header->e_shnum)
+    {
+        return;
+    }
+
+    const Elf64_Shdr *sections = (const Elf64_Shdr *)(image->data + header->e_shoff);
+    load_symbols(image, sections, header->e_shnum);
+
+    slice<const u8> names = section_data(*image, sections[header->e_shstrndx]);
+    for (usize i = 0; i < header->e_shnum; ++i) {
+        const Elf64_Shdr &section = sections[i];
+        // Compressed debug info would need zlib, so those images just go without line numbers.
+        if (section.sh_name >= names.len || (section.sh_flags & SHF_COMPRESSED)) {
+            continue;
+        }
+        const char *name = (const char *)names.ptr + section.sh_name;
+        usize max_len = names.len - section.sh_name;
+        if (strncmp(name, ".debug_line", max_len) == 0) {
+            image->debug_line = section_data(*image, section);
+        } else if (strncmp(name, ".debug_line_str", max_len) == 0) {
+            image->debug_line_str = section_data(*image, section);
+        } else if (strncmp(name, ".debug_str", max_len) == 0) {
+            image->debug_str = section_data(*image, section);
+        } else if (strncmp(name, ".debug_info", max_len) == 0) {
+            image->debug_info = section_data(*image, section);
+        } else if (strncmp(name, ".debug_abbrev", max_len) == 0) {
+            image->debug_abbrev = section_data(*image, section);
+        }
+    }
+
+    if (image->debug_line.len > 0) {
+        load_compilation_dirs(image);
+    }
+}
+
+static int collect_image(dl_phdr_info *info, usize, void *) {
+    for (loaded_image *image : *loaded_images) {
+        if (image->bias == info->dlpi_addr && image->path == string_slice(info->dlpi_name)) {
+            return 0;
+        }
+    }
+
+    auto *image = new (heap::debug_allocator()->alloc(heap::layout::of<loaded_image>()))
+        loaded_image(heap::debug_allocator());
+    image->path.push(string_slice(info->dlpi_name));
+    image->bias = info->dlpi_addr;
+    for (usize i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) &segment = info->dlpi_phdr[i];
+        if (segment.p_type == PT_LOAD) {
+            usize start = info->dlpi_addr + segment.p_vaddr;
+            image->segments.push(image_segment{start, start + segment.p_memsz});
+        }
+    }
+    load_image_file(image);
+    loaded_images->push(image);
+    return 0;
+}
+
+static loaded_image *find_image(usize addr) {
+    for (loaded_image *image : *loaded_images) {
+        if (image->contains(addr)) {
+            return image;
+        }
+    }
+    return nullptr;
+}
+
+static const elf_symbol *find_symbol(const loaded_image &image, usize addr) {
+    const elf_symbol *after = std::upper_bound(image.symbols.begin(),
+        image.symbols.end(),
+        addr,
+        [](usize addr, const elf_symbol &symbol) { return addr < symbol.address; });
+    if (after == image.symbols.begin()) {
+        return nullptr;
+    }
+    const elf_symbol *symbol = after - 1;
+    if (symbol->size != 0 && addr >= symbol->address + symbol->size) {
+        return nullptr;
+    }
+    return symbol;
+}
+
+static void set_symbol_name(allocator *alloc, address_info &info, const char *name) {
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    info.name = string(alloc, status == 0 && demangled ? demangled : name);
+    free(demangled);
+}
+
+// An address that a line table row has to be found for.
+struct line_query {
+    usize address;
+    address_info *info;
+};
+
+struct line_file {
+    const char *name;
+    usize directory;
+};
+
+// Entry formats of DWARF 5 line table headers, as pairs of content type and form.
+struct entry_format {
+    u64 content_type;
+    u64 form;
+};
+
+constexpr u64 DW_LNCT_PATH = 0x1;
+constexpr u64 DW_LNCT_DIRECTORY_INDEX = 0x2;
+
+constexpr u64 DW_AT_STMT_LIST = 0x10;
+constexpr u64 DW_AT_COMP_DIR = 0x1b;
+
+constexpr u64 DW_FORM_ADDR = 0x01;
+constexpr u64 DW_FORM_BLOCK2 = 0x03;
+constexpr u64 DW_FORM_BLOCK4 = 0x04;
+constexpr u64 DW_FORM_DATA2 = 0x05;
+constexpr u64 DW_FORM_DATA4 = 0x06;
+constexpr u64 DW_FORM_DATA8 = 0x07;
+constexpr u64 DW_FORM_STRING = 0x08;
+constexpr u64 DW_FORM_BLOCK = 0x09;
+constexpr u64 DW_FORM_BLOCK1 = 0x0a;
+constexpr u64 DW_FORM_DATA1 = 0x0b;
+constexpr u64 DW_FORM_FLAG = 0x0c;
+constexpr u64 DW_FORM_SDATA = 0x0d;
+constexpr u64 DW_FORM_STRP = 0x0e;
+constexpr u64 DW_FORM_UDATA = 0x0f;
+constexpr u64 DW_FORM_REF_ADDR = 0x10;
+constexpr u64 DW_FORM_REF1 = 0x11;
+constexpr u64 DW_FORM_REF2 = 0x12;
+constexpr u64 DW_FORM_REF4 = 0x13;
+constexpr u64 DW_FORM_REF8 = 0x14;
+constexpr u64 DW_FORM_REF_UDATA = 0x15;
+constexpr u64 DW_FORM_SEC_OFFSET = 0x17;
+constexpr u64 DW_FORM_EXPRLOC = 0x18;
+constexpr u64 DW_FORM_FLAG_PRESENT = 0x19;
+constexpr u64 DW_FORM_STRX = 0x1a;
+constexpr u64 DW_FORM_ADDRX = 0x1b;
+constexpr u64 DW_FORM_REF_SUP4 = 0x1c;
+constexpr u64 DW_FORM_STRP_SUP = 0x1d;
+constexpr u64 DW_FORM_DATA16 = 0x1e;
+constexpr u64 DW_FORM_LINE_STRP = 0x1f;
+constexpr u64 DW_FORM_REF_SIG8 = 0x20;
+constexpr u64 DW_FORM_IMPLICIT_CONST = 0x21;
+constexpr u64 DW_FORM_LOCLISTX = 0x22;
+constexpr u64 DW_FORM_RNGLISTX = 0x23;
+constexpr u64 DW_FORM_REF_SUP8 = 0x24;
+constexpr u64 DW_FORM_STRX1 = 0x25;
+constexpr u64 DW_FORM_STRX2 = 0x26;
+constexpr u64 DW_FORM_STRX3 = 0x27;
+constexpr u64 DW_FORM_STRX4 = 0x28;
+constexpr u64 DW_FORM_ADDRX1 = 0x29;
+constexpr u64 DW_FORM_ADDRX2 = 0x2a;
+constexpr u64 DW_FORM_ADDRX3 = 0x2b;
+constexpr u64 DW_FORM_ADDRX4 = 0x2c;
+
+constexpr u8 DW_LNS_COPY = 1;
+constexpr u8 DW_LNS_ADVANCE_PC = 2;
+constexpr u8 DW_LNS_ADVANCE_LINE = 3;
+constexpr u8 DW_LNS_SET_FILE = 4;
+constexpr u8 DW_LNS_CONST_ADD_PC = 8;
+constexpr u8 DW_LNS_FIXED_ADVANCE_PC = 9;
+
+constexpr u8 DW_LNE_END_SEQUENCE = 1;
+constexpr u8 DW_LNE_SET_ADDRESS = 2;
+
+// Reads one attribute value. Strings come back through `string_out` and numbers through
+// `number_out`, and everything else is skipped over. Strings that live in tables this doesn't load,
+// like `.debug_str_offsets`, are skipped too. Returns false for forms that can't be skipped.
+static bool read_form(const loaded_image &image,
+    dwarf_reader &reader,
+    u64 form,
+    bool is_dwarf64,
+    usize address_size,
+    const char **string_out,
+    u64 *number_out) {
+    usize offset_size = is_dwarf64 ? 8 : 4;
+    const u8 *skipped;
+    switch (form) {
+    case DW_FORM_STRING: *string_out = reader.cstr(); return true;
+    case DW_FORM_LINE_STRP:
+    case DW_FORM_STRP: {
+        slice<const u8> strings = form == DW_FORM_STRP ? image.debug_str : image.debug_line_str;
+        u64 offset = reader.fixed(offset_size);
+        if (offset >= strings.len) {
+            return false;
+        }
+        *string_out = (const char *)strings.ptr + offset;
+        return true;
+    }
+    case DW_FORM_UDATA: *number_out = reader.uleb(); return true;
+    case DW_FORM_DATA1: *number_out = reader.fixed(1); return true;
+    case DW_FORM_DATA2: *number_out = reader.fixed(2); return true;
+    case DW_FORM_DATA4: *number_out = reader.fixed(4); return true;
+    case DW_FORM_DATA8: *number_out = reader.fixed(8); return true;
+    case DW_FORM_SEC_OFFSET: *number_out = reader.fixed(offset_size); return true;
+
+    case DW_FORM_FLAG_PRESENT:
+    case DW_FORM_IMPLICIT_CONST: return true;
+    case DW_FORM_FLAG:
+    case DW_FORM_REF1:
+    case DW_FORM_STRX1:
+    case DW_FORM_ADDRX1: return reader.take(1, &skipped);
+    case DW_FORM_REF2:
+    case DW_FORM_STRX2:
+    case DW_FORM_ADDRX2: return reader.take(2, &skipped);
+    case DW_FORM_STRX3:
+    case DW_FORM_ADDRX3: return reader.take(3, &skipped);
+    case DW_FORM_REF4:
+    case DW_FORM_REF_SUP4:
+    case DW_FORM_STRX4:
+    case DW_FORM_ADDRX4: return reader.take(4, &skipped);
+    case DW_FORM_REF8:
+    case DW_FORM_REF_SIG8:
+    case DW_FORM_REF_SUP8: return reader.take(8, &skipped);
+    case DW_FORM_DATA16: return reader.take(16, &skipped);
+    case DW_FORM_ADDR: return reader.take(address_size, &skipped);
+    case DW_FORM_REF_ADDR:
+    case DW_FORM_STRP_SUP: return reader.take(offset_size, &skipped);
+    case DW_FORM_SDATA: reader.sleb(); return !reader.is_failed;
+    case DW_FORM_REF_UDATA:
+    case DW_FORM_STRX:
+    case DW_FORM_ADDRX:
+    case DW_FORM_LOCLISTX:
+    case DW_FORM_RNGLISTX: reader.uleb(); return !reader.is_failed;
+    case DW_FORM_BLOCK1: return reader.take(reader.fixed(1), &skipped);
+    case DW_FORM_BLOCK2: return reader.take(reader.fixed(2), &skipped);
+    case DW_FORM_BLOCK4: return reader.take(reader.fixed(4), &skipped);
+    case DW_FORM_BLOCK:
+    case DW_FORM_EXPRLOC: return reader.take(reader.uleb(), &skipped);
+    default: return false;
+    }
+}
+
+// Finds the abbreviation with `code` in the table that `reader` is on, and leaves `reader` on its
+// attribute specifications.
+static bool find_abbreviation(dwarf_reader &reader, u64 code) {
+    while (reader.remaining() > 0 && !reader.is_failed) {
+        u64 current = reader.uleb();
+        if (current == 0) {
+            return false;
+        }
+        reader.uleb();
+        reader.fixed(1);
+        if (current == code) {
+            return !reader.is_failed;
+        }
+        for (u64 attribute = reader.uleb(), form = reader.uleb(); attribute != 0 || form != 0;
+             attribute = reader.uleb(), form = reader.uleb())
+        {
+            if (form == DW_FORM_IMPLICIT_CONST) {
+                reader.sleb();
+            }
+            if (reader.is_failed) {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+// Reads the first entry of every compilation unit, to find the directory each line table's paths
+// are relative to. Line tables before DWARF 5 don't record it themselves.
+static void load_compilation_dirs(loaded_image *image) {
+    slice<const u8> debug_info = image->debug_info;
+    slice<const u8> debug_abbrev = image->debug_abbrev;
+    dwarf_reader units(debug_info.ptr, debug_info.len);
+    while (units.remaining() > 0 && !units.is_failed) {
+        u64 unit_length = units.fixed(4);
+        bool is_dwarf64 = unit_length == 0xffffffff;
+        if (is_dwarf64) {
+            unit_length = units.fixed(8);
+        }
+        const u8 *unit_start;
+        if (!units.take(unit_length, &unit_start)) {
+            break;
+        }
+        dwarf_reader reader(unit_start, unit_length);
+
+        u16 version = (u16)reader.fixed(2);
+        if (version < 2 || version > 5) {
+            continue;
+        }
+        usize address_size;
+        u64 abbrev_offset;
+        if (version >= 5) {
+            reader.fixed(1);
+            address_size = reader.fixed(1);
+            abbrev_offset = reader.fixed(is_dwarf64 ? 8 : 4);
+        } else {
+            abbrev_offset = reader.fixed(is_dwarf64 ? 8 : 4);
+            address_size = reader.fixed(1);
+        }
+        if (abbrev_offset >= debug_abbrev.len) {
+            continue;
+        }
 
-    address_info info;
-    info.raw_symbol = string(alloc, sym);
-    if (open_paren.is_none()) {
-        info.name = string(alloc, "??"_s);
-        info.location = string(alloc, "??"_s);
-        return info;
+        dwarf_reader abbrevs(debug_abbrev.ptr + abbrev_offset, debug_abbrev.len - abbrev_offset);
+        if (!find_abbreviation(abbrevs, reader.uleb())) {
+            continue;
+        }
+
+        compilation_dir unit = {~(u64)0, nullptr};
+        for (u64 attribute = abbrevs.uleb(), form = abbrevs.uleb(); attribute != 0 || form != 0;
+             attribute = abbrevs.uleb(), form = abbrevs.uleb())
+        {
+            if (form == DW_FORM_IMPLICIT_CONST) {
+                abbrevs.sleb();
+            }
+            const char *string_value = nullptr;
+            u64 number_value = ~(u64)0;
+            if (abbrevs.is_failed
+                || !read_form(*image,
+                    reader,
+                    form,
+                    is_dwarf64,
+                    address_size,
+                    &string_value,
+                    &number_value))
+            {
+                break;
+            }
+            if (attribute == DW_AT_STMT_LIST) {
+                unit.line_offset = number_value;
+            } else if (attribute == DW_AT_COMP_DIR) {
+                unit.path = string_value;
+            }
+        }
+        if (unit.line_offset != ~(u64)0 && unit.path) {
+            image->compilation_dirs.push(unit);
+        }
     }
 
-    string_slice exepath = sym[range_to(*open_paren)];
+    std::sort(image->compilation_dirs.begin(),
+        image->compilation_dirs.end(),
+        [](const auto &lhs, const auto &rhs) { return lhs.line_offset < rhs.line_offset; });
+}
 
-    string cmd(alloc);
-    cmd.push("addr2line -ifCe "_s);
-    cmd.push(exepath);
-    cmd.push(" "_s);
-    cmd.push(format_string(alloc, reladdr));
+static const char *find_compilation_dir(const loaded_image &image, u64 line_offset) {
+    const compilation_dir *found = std::lower_bound(image.compilation_dirs.begin(),
+        image.compilation_dirs.end(),
+        line_offset,
+        [](const compilation_dir &unit, u64 offset) { return unit.line_offset < offset; });
+    if (found == image.compilation_dirs.end() || found->line_offset != line_offset) {
+        return "";
+    }
+    return found->path;
+}
 
-    string output = get_command_output(alloc, mv(cmd));
-    vector<string> lines = output.as_slice().split(alloc, "\n"_s);
-    if (lines.len() < 2) {
-        VIXEN_ASSERT(false, "addr2line failed with output: `{}`", output);
+// Reads a DWARF 5 list of directory or file entries, keeping their path and directory index.
+static bool read_v5_entries(const loaded_image &image,
+    dwarf_reader &reader,
+    bool is_dwarf64,
+    vector<line_file> &out) {
+    vector<entry_format> formats(heap::debug_allocator());
+    usize format_count = reader.fixed(1);
+    for (usize i = 0; i < format_count; ++i) {
+        u64 content_type = reader.uleb();
+        formats.push(entry_format{content_type, reader.uleb()});
     }
 
-    info.name = mv(lines[0]);
-    info.location = mv(lines[1]);
-    return info;
+    usize count = reader.uleb();
+    for (usize i = 0; i < count && !reader.is_failed; ++i) {
+        line_file entry = {"", 0};
+        for (const entry_format &format : formats) {
+            const char *string_value = "";
+            u64 number_value = 0;
+            if (!read_form(image,
+                    reader,
+                    format.form,
+                    is_dwarf64,
+                    8,
+                    &string_value,
+                    &number_value))
+            {
+                return false;
+            }
+            if (format.content_type == DW_LNCT_PATH) {
+                entry.name = string_value;
+            } else if (format.content_type == DW_LNCT_DIRECTORY_INDEX) {
+                entry.directory = number_value;
+            }
+        }
+        out.push(entry);
+    }
+    return !reader.is_failed;
 }
 
-void *get_reladdr(void *absolute) {
-    Dl_info info;
-    dladdr(absolute, &info);
-    return (void *)((usize)absolute - (usize)info.dli_fbase);
+static void set_location(allocator *alloc,
+    address_info &info,
+    const vector<line_file> &directories,
+    const vector<line_file> &files,
+    u64 file,
+    u64 line) {
+    if (file >= files.len()) {
+        return;
+    }
+    const line_file &entry = files[file];
+
+    // Relative paths are relative to their directory, and relative directories are relative to
+    // the compilation directory, which is always directory 0.
+    string path(alloc);
+    if (entry.name[0] != '/' && entry.directory < directories.len()) {
+        const char *directory = directories[entry.directory].name;
+        if (directory[0] != '/' && entry.directory != 0 && directories[0].name[0] != 0) {
+            path.push(string_slice(directories[0].name));
+            path.push("/"_s);
+        }
+        if (directory[0] != 0) {
+            path.push(string_slice(directory));
+            path.push("/"_s);
+        }
+    }
+    path.push(string_slice(entry.name));
+    path.push(":"_s);
+    path.push(format_string(alloc, line).as_slice());
+    info.location = mv(path);
+}
+
+// Runs every line program in the image once, and gives each query the row whose address range
+// contains it. `queries` has to be sorted by address.
+static void find_lines(allocator *alloc, loaded_image &image, slice<line_query> queries) {
+    dwarf_reader units(image.debug_line.ptr, image.debug_line.len);
+    while (units.remaining() > 0 && !units.is_failed) {
+        u64 unit_offset = (u64)(units.pos - image.debug_line.ptr);
+        u64 unit_length = units.fixed(4);
+        bool is_dwarf64 = unit_length == 0xffffffff;
+        if (is_dwarf64) {
+            unit_length = units.fixed(8);
+        }
+        const u8 *unit_start;
+        if (!units.take(unit_length, &unit_start)) {
+            return;
+        }
+        dwarf_reader reader(unit_start, unit_length);
+
+        u16 version = (u16)reader.fixed(2);
+        if (version < 2 || version > 5) {
+            continue;
+        }
+        usize address_size = 8;
+        if (version >= 5) {
+            address_size = reader.fixed(1);
+            reader.fixed(1);
+        }
+        u64 header_length = reader.fixed(is_dwarf64 ? 8 : 4);
+        const u8 *program_start = reader.pos + header_length;
+        if (header_length > reader.remaining()) {
+            continue;
+        }
+
+        u8 min_instruction_length = (u8)reader.fixed(1);
+        // Skips the maximum operations per instruction, which only matters for VLIW targets, and
+        // `default_is_stmt`, since every row is as good as any other for finding a line.
+        if (version >= 4) {
+            reader.fixed(1);
+        }
+        reader.fixed(1);
+        i8 line_base = (i8)reader.fixed(1);
+        u8 line_range = (u8)reader.fixed(1);
+        u8 opcode_base = (u8)reader.fixed(1);
+        const u8 *opcode_lengths;
+        if (line_range == 0 || opcode_base == 0 || !reader.take(opcode_base - 1, &opcode_lengths)) {
+            continue;
+        }
+
+        // Before DWARF 5, index 0 is the compilation directory, which only the compilation unit
+        // records, and files count from 1.
+        vector<line_file> directories(alloc);
+        vector<line_file> files(alloc);
+        if (version >= 5) {
+            if (!read_v5_entries(image, reader, is_dwarf64, directories)
+                || !read_v5_entries(image, reader, is_dwarf64, files))
+            {
+                continue;
+            }
+        } else {
+            directories.push(line_file{find_compilation_dir(image, unit_offset), 0});
+            for (const char *name = reader.cstr(); *name != 0; name = reader.cstr()) {
+                directories.push(line_file{name, 0});
+            }
+            files.push(line_file{"", 0});
+            for (const char *name = reader.cstr(); *name != 0; name = reader.cstr()) {
+                usize directory = reader.uleb();
+                reader.uleb();
+                reader.uleb();
+                files.push(line_file{name, directory});
+            }
+        }
+
+        reader = dwarf_reader(program_start, (usize)(unit_start + unit_length - program_start));
+        usize address = 0, file = 1, line = 1;
+        usize sequence_start = 0;
+        bool has_row = false;
+        usize row_address = 0, row_file = 0, row_line = 0;
+
+        // Every row covers the addresses up to the next row, so queries are answered one row late.
+        auto emit_row = [&](bool is_end) {
+            // Sequences at address 0 are functions that the linker threw away.
+            if (has_row && sequence_start != 0 && address > row_address) {
+                line_query *first = std::lower_bound(queries.begin(),
+                    queries.end(),
+                    row_address,
+                    [](const line_query &query, usize addr) { return query.address < addr; });
+                for (line_query *query = first; query != queries.end() && query->address < address;
+                     ++query)
+                {
+                    set_location(alloc, *query->info, directories, files, row_file, row_line);
+                }
+            }
+            if (is_end) {
+                has_row = false;
+                address = 0, file = 1, line = 1;
+            } else {
+                if (!has_row) {
+                    sequence_start = address;
+                }
+                has_row = true;
+                row_address = address, row_file = file, row_line = line;
+            }
+        };
+
+        while (reader.remaining() > 0 && !reader.is_failed) {
+            u8 opcode = (u8)reader.fixed(1);
+            if (opcode >= opcode_base) {
+                u8 adjusted = opcode - opcode_base;
+                address += (adjusted / line_range) * min_instruction_length;
+                line += line_base + (adjusted % line_range);
+                emit_row(false);
+            } else if (opcode == 0) {
+                u64 len = reader.uleb();
+                const u8 *extended;
+                if (len == 0 || !reader.take(len, &extended)) {
+                    break;
+                }
+                if (extended[0] == DW_LNE_END_SEQUENCE) {
+                    emit_row(true);
+                } else if (extended[0] == DW_LNE_SET_ADDRESS && len - 1 == address_size) {
+                    address = dwarf_reader(extended + 1, address_size).fixed(address_size);
+                }
+            } else if (opcode == DW_LNS_COPY) {
+                emit_row(false);
+            } else if (opcode == DW_LNS_ADVANCE_PC) {
+                address += reader.uleb() * min_instruction_length;
+            } else if (opcode == DW_LNS_ADVANCE_LINE) {
+                line += reader.sleb();
+            } else if (opcode == DW_LNS_SET_FILE) {
+                file = reader.uleb();
+            } else if (opcode == DW_LNS_CONST_ADD_PC) {
+                address += ((255 - opcode_base) / line_range) * min_instruction_length;
+            } else if (opcode == DW_LNS_FIXED_ADVANCE_PC) {
+                address += reader.fixed(2);
+            } else {
+                for (u8 i = 0; i < opcode_lengths[opcode - 1]; ++i) {
+                    reader.uleb();
+                }
+            }
+        }
+    }
+}
+
+// Fills in the name and location of each address from the symbol tables and line tables of the
+// image it's in, without leaving the process.
+void symbolize(allocator *alloc, slice<void *> addrs, slice<address_info> infos) {
+    std::lock_guard<std::mutex> guard(image_lock);
+    if (!loaded_images) {
+        void *storage = heap::debug_allocator()->alloc(heap::layout::of<vector<loaded_image *>>());
+        loaded_images = new (storage) vector<loaded_image *>(heap::debug_allocator());
+    }
+    // Picks up anything that was loaded since the last time.
+    dl_iterate_phdr(collect_image, nullptr);
+
+    vector<loaded_image *> images(alloc);
+    vector<vector<line_query>> queries(alloc);
+    for (usize i = 0; i < addrs.len; ++i) {
+        infos[i].name = string(alloc, "??"_s);
+        infos[i].location = string(alloc, "??:?"_s);
+
+        loaded_image *image = find_image((usize)addrs[i]);
+        if (!image) {
+            continue;
+        }
+        // Return addresses point just past their call, which can be on the next line, or even in
+        // the next function when the call never returns.
+        usize addr = (usize)addrs[i] - image->bias - 1;
+        if (const elf_symbol *symbol = find_symbol(*image, addr)) {
+            set_symbol_name(alloc, infos[i], symbol->name);
+        }
+
+        if (image->debug_line.len > 0) {
+            auto index = images.index_of(image);
+            if (!index) {
+                images.push(image);
+                queries.push(vector<line_query>(alloc));
+                index = images.len() - 1;
+            }
+            queries[*index].push(line_query{addr, &infos[i]});
+        }
+    }
+
+    for (usize i = 0; i < images.len(); ++i) {
+        std::sort(queries[i].begin(), queries[i].end(), [](const auto &lhs, const auto &rhs) {
+            return lhs.address < rhs.address;
+        });
+        find_lines(alloc, *images[i], queries[i]);
+    }
 }
 
 vector<string> translate_addrs(allocator *alloc, slice<void *> addrs) {
@@ -124,16 +891,28 @@ void translation_cache::add_symbol(void *symbol) {
 
 void translation_cache::translate() {
     translation_queue.dedup_unstable();
-    vector<string> symbols = detail::translate_addrs(alloc, translation_queue);
+    vector<void *> pending(alloc);
+    for (void *addr : translation_queue) {
+        if (!translated.key_exists(addr)) {
+            pending.push(addr);
+        }
+    }
+    translation_queue.clear();
+    if (pending.len() == 0) {
+        return;
+    }
 
-    for (usize i = 0; i < translation_queue.len(); ++i) {
-        address_info info = detail::translate_symbol(alloc,
-            symbols[i],
-            detail::get_reladdr(translation_queue[i]));
-        translated.insert(translation_queue[i], mv(info));
+    vector<string> symbols = detail::translate_addrs(alloc, pending);
+    vector<address_info> infos(alloc);
+    for (usize i = 0; i < pending.len(); ++i) {
+        infos.push(address_info(alloc));
     }
+    detail::symbolize(alloc, pending, infos);
 
-    translation_queue.clear();
+    for (usize i = 0; i < pending.len(); ++i) {
+        infos[i].raw_symbol = mv(symbols[i]);
+        translated.insert(pending[i], mv(infos[i]));
+    }
 }
 
 address_info const &translation_cache::get_info(void *addr) const {
@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <cstdlib>
+#include <malloc.h>
 
 namespace vixen::heap {
 void *system_allocator::internal_alloc(const layout &layout) {
@@ -32,4 +33,8 @@ void *system_allocator::internal_legacy_realloc(usize new_size, void *old_ptr) {
     return std::realloc(old_ptr, new_size);
 }
 
+usize system_allocator::internal_legacy_size(const void *ptr) const {
+    return malloc_usable_size((void *)ptr);
+}
+
 } // namespace vixen::heap
\ No newline at end of file
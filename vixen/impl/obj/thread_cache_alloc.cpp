@@ -0,0 +1,228 @@
+#include "vixen/allocator/allocators.hpp"
+
+namespace vixen::heap {
+
+// Every live `thread_cache_allocator` owns one slot in the registry. Threads find their cache for
+// an allocator by indexing their own table with that slot, and the generation tells them whether
+// the cache in that entry still belongs to the allocator that currently owns the slot.
+//
+// The registry lock is only taken when a thread creates a cache, when a thread exits, and when an
+// allocator is created or destroyed.
+static std::mutex registry_lock;
+static bool slot_in_use[MAX_THREAD_CACHE_ALLOCATORS];
+static u64 slot_generations[MAX_THREAD_CACHE_ALLOCATORS];
+
+struct thread_cache_entry {
+    thread_cache_allocator::thread_cache *cache;
+    u64 generation;
+};
+
+struct thread_cache_table {
+    thread_cache_entry entries[MAX_THREAD_CACHE_ALLOCATORS];
+    // Set once the table has been destroyed. Static destructors can still free through a thread
+    // cache allocator after the main thread's thread locals are gone, and those have to go
+    // straight to the backend. Like `entries`, this relies on thread locals being zeroed.
+    bool torn_down;
+
+    // Give every cached slot back when the thread exits, but only for caches whose allocator is
+    // still alive. Caches of destroyed allocators were already released by their allocator.
+    ~thread_cache_table() {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        for (usize i = 0; i < MAX_THREAD_CACHE_ALLOCATORS; ++i) {
+            thread_cache_entry &entry = entries[i];
+            if (entry.cache && slot_in_use[i] && slot_generations[i] == entry.generation) {
+                thread_cache_allocator *owner = entry.cache->owner;
+                owner->flush(entry.cache);
+                owner->release(entry.cache);
+            }
+            entry = {nullptr, 0};
+        }
+        torn_down = true;
+    }
+};
+
+static thread_local thread_cache_table thread_caches;
+
+// Large classes get smaller magazines so that idle threads don't sit on too much memory.
+static usize magazine_limit(usize size_class) {
+    usize limit = (64 * 1024) / slab_allocator::size_class_size(size_class);
+    return std::clamp(limit, (usize)4, THREAD_CACHE_MAGAZINE_SIZE);
+}
+
+thread_cache_allocator::thread_cache_allocator(slab_allocator *backend) : backend(backend) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    this->slot = -1;
+    this->generation = 0;
+    for (usize i = 0; i < MAX_THREAD_CACHE_ALLOCATORS; ++i) {
+        if (!slot_in_use[i]) {
+            slot_in_use[i] = true;
+            this->slot = i;
+            this->generation = ++slot_generations[i];
+            break;
+        }
+    }
+}
+
+thread_cache_allocator::~thread_cache_allocator() {
+    std::lock_guard<std::mutex> guard(registry_lock);
+    while (this->caches) {
+        thread_cache *cache = this->caches;
+        flush(cache);
+        release(cache);
+    }
+    if (this->slot >= 0) {
+        slot_in_use[this->slot] = false;
+    }
+}
+
+void thread_cache_allocator::flush(thread_cache *cache) {
+    for (usize i = 0; i < SLAB_SIZE_CLASS_COUNT; ++i) {
+        magazine &mag = cache->magazines[i];
+        backend->dealloc_slots(mag.count, mag.slots);
+        mag.count = 0;
+    }
+}
+
+// NOTE: the registry lock must be held.
+void thread_cache_allocator::release(thread_cache *cache) {
+    if (cache->prev) {
+        cache->prev->next = cache->next;
+    } else {
+        this->caches = cache->next;
+    }
+    if (cache->next) {
+        cache->next->prev = cache->prev;
+    }
+    backend->dealloc(layout::of<thread_cache>(), (void *)cache);
+}
+
+void thread_cache_allocator::flush_thread_cache() {
+    if (this->slot < 0 || thread_caches.torn_down) {
+        return;
+    }
+    thread_cache_entry &entry = thread_caches.entries[this->slot];
+    if (entry.cache && entry.generation == this->generation) {
+        flush(entry.cache);
+    }
+}
+
+thread_cache_allocator::thread_cache *thread_cache_allocator::create_thread_cache() {
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    auto *cache = (thread_cache *)backend->alloc(layout::of<thread_cache>());
+    cache->owner = this;
+    cache->prev = nullptr;
+    cache->next = this->caches;
+    if (this->caches) {
+        this->caches->prev = cache;
+    }
+    this->caches = cache;
+    for (usize i = 0; i < SLAB_SIZE_CLASS_COUNT; ++i) {
+        cache->magazines[i].count = 0;
+    }
+
+    thread_caches.entries[this->slot] = {cache, this->generation};
+    return cache;
+}
+
+thread_cache_allocator::thread_cache *thread_cache_allocator::get_thread_cache() {
+    if (this->slot < 0 || unlikely(thread_caches.torn_down)) {
+        return nullptr;
+    }
+    thread_cache_entry &entry = thread_caches.entries[this->slot];
+    if (likely(entry.cache && entry.generation == this->generation)) {
+        return entry.cache;
+    }
+    return create_thread_cache();
+}
+
+void *thread_cache_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    thread_cache *cache;
+    if (!slab_allocator::is_small(layout) || !(cache = get_thread_cache())) {
+        return backend->alloc(layout);
+    }
+
+    usize size_class = slab_allocator::size_class_of(layout.size);
+    magazine &mag = cache->magazines[size_class];
+    if (mag.count == 0) {
+        usize refill = magazine_limit(size_class) / 2;
+        backend->alloc_slots(size_class, refill, mag.slots);
+        mag.count = refill;
+    }
+
+    return mag.slots[--mag.count];
+}
+
+void thread_cache_allocator::internal_dealloc(const layout &layout, void *ptr) {
+    _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
+
+    thread_cache *cache;
+    if (!slab_allocator::is_small(layout) || !(cache = get_thread_cache())) {
+        backend->dealloc(layout, ptr);
+        return;
+    }
+
+    usize size_class = slab_allocator::size_class_of(layout.size);
+    magazine &mag = cache->magazines[size_class];
+    usize limit = magazine_limit(size_class);
+    if (mag.count == limit) {
+        // Drain the oldest half of the magazine, keeping the most recently freed (and probably
+        // still hot) slots around.
+        usize drain = limit / 2;
+        backend->dealloc_slots(drain, mag.slots);
+        util::copy(mag.slots + drain, mag.slots, mag.count - drain);
+        mag.count -= drain;
+    }
+
+    mag.slots[mag.count++] = ptr;
+}
+
+allocation thread_cache_allocator::internal_alloc_at_least(const layout &layout) {
+    if (!slab_allocator::is_small(layout)) {
+        return backend->alloc_at_least(layout);
+    }
+
+    usize size_class = slab_allocator::size_class_of(layout.size);
+    return {internal_alloc(layout), slab_allocator::size_class_size(size_class)};
+}
+
+usize thread_cache_allocator::internal_try_grow_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    if (!slab_allocator::is_small(old_layout)) {
+        return backend->try_grow_in_place(old_layout, new_size, ptr);
+    }
+    return slab_allocator::resized_slot_size(old_layout, new_size);
+}
+
+usize thread_cache_allocator::internal_try_shrink_in_place(
+    const layout &old_layout, usize new_size, void *ptr) {
+    if (!slab_allocator::is_small(old_layout)) {
+        return backend->try_shrink_in_place(old_layout, new_size, ptr);
+    }
+    return slab_allocator::resized_slot_size(old_layout, new_size);
+}
+
+void *thread_cache_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    bool old_small = slab_allocator::is_small(old_layout);
+    bool new_small = slab_allocator::is_small(new_layout);
+
+    if (old_small && new_small
+        && slab_allocator::size_class_of(old_layout.size)
+               == slab_allocator::size_class_of(new_layout.size))
+    {
+        return old_ptr;
+    }
+
+    if (!old_small && !new_small) {
+        return backend->realloc(old_layout, new_layout, old_ptr);
+    }
+
+    return general_realloc(this, old_layout, new_layout, old_ptr);
+}
+
+} // namespace vixen::heap
@@ -0,0 +1,402 @@
+#include "vixen/allocator/allocators.hpp"
+
+#include <cstddef>
+
+namespace vixen::heap {
+
+// This follows the design in "TLSF: a New Dynamic Memory Allocator for Real-Time Systems" (Masmano
+// et al.). Unlike most implementations of it, a block's `prev_phys` field doesn't overlap the end
+// of the previous block's payload: a used block pays for two words instead of one, but that keeps
+// the headers the same size as the alignment, so every payload is 16-byte aligned like `malloc`'s.
+
+using block_header = tlsf_allocator::block_header;
+
+constexpr usize ALIGN_SIZE = (usize)1 << TLSF_ALIGN_LOG2;
+constexpr usize SMALL_BLOCK_SIZE = (usize)1 << TLSF_FL_INDEX_SHIFT;
+
+constexpr usize BLOCK_FREE_BIT = 1 << 0;
+constexpr usize BLOCK_PREV_FREE_BIT = 1 << 1;
+constexpr usize BLOCK_FLAG_MASK = BLOCK_FREE_BIT | BLOCK_PREV_FREE_BIT;
+
+// The part of a header that a used block needs to keep around.
+constexpr usize BLOCK_OVERHEAD = offsetof(block_header, next_free);
+constexpr usize BLOCK_PAYLOAD_OFFSET = BLOCK_OVERHEAD;
+// A free block has to be able to hold its free list links.
+constexpr usize BLOCK_SIZE_MIN = sizeof(block_header) - BLOCK_OVERHEAD;
+constexpr usize BLOCK_SIZE_MAX = (usize)1 << TLSF_FL_INDEX_MAX;
+
+static_assert(ALIGN_SIZE == SMALL_BLOCK_SIZE / TLSF_SL_INDEX_COUNT,
+    "TLSF small blocks must be split into size classes of exactly the block alignment.");
+static_assert(BLOCK_OVERHEAD % ALIGN_SIZE == 0 && BLOCK_SIZE_MIN % ALIGN_SIZE == 0,
+    "TLSF block headers must keep payloads aligned.");
+static_assert(TLSF_FL_INDEX_COUNT <= 64, "The first level bitmap must fit in a u64.");
+
+static usize log2_floor(usize n) {
+    return (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(n);
+}
+
+static usize block_size(const block_header *block) {
+    return block->size & ~BLOCK_FLAG_MASK;
+}
+
+static void block_set_size(block_header *block, usize size) {
+    block->size = size | (block->size & BLOCK_FLAG_MASK);
+}
+
+[[maybe_unused]] static bool block_is_last(const block_header *block) {
+    return block_size(block) == 0;
+}
+
+static bool block_is_free(const block_header *block) {
+    return block->size & BLOCK_FREE_BIT;
+}
+
+static void block_set_free(block_header *block, bool free) {
+    block->size = free ? block->size | BLOCK_FREE_BIT : block->size & ~BLOCK_FREE_BIT;
+}
+
+static bool block_is_prev_free(const block_header *block) {
+    return block->size & BLOCK_PREV_FREE_BIT;
+}
+
+static void block_set_prev_free(block_header *block, bool free) {
+    block->size = free ? block->size | BLOCK_PREV_FREE_BIT : block->size & ~BLOCK_PREV_FREE_BIT;
+}
+
+static block_header *block_from_ptr(void *ptr) {
+    return (block_header *)util::offset_rawptr(ptr, -(isize)BLOCK_PAYLOAD_OFFSET);
+}
+
+static void *block_to_ptr(block_header *block) {
+    return util::offset_rawptr(block, BLOCK_PAYLOAD_OFFSET);
+}
+
+static block_header *block_next(block_header *block) {
+    VIXEN_DEBUG_ASSERT(!block_is_last(block), "Tried to get the block after the sentinel block.");
+    return (block_header *)util::offset_rawptr(block_to_ptr(block), block_size(block));
+}
+
+// Points the next block's `prev_phys` back at `block`, and returns the next block.
+static block_header *block_link_next(block_header *block) {
+    block_header *next = block_next(block);
+    next->prev_phys = block;
+    return next;
+}
+
+static void block_mark_as_free(block_header *block) {
+    block_header *next = block_link_next(block);
+    block_set_prev_free(next, true);
+    block_set_free(block, true);
+}
+
+static void block_mark_as_used(block_header *block) {
+    block_header *next = block_next(block);
+    block_set_prev_free(next, false);
+    block_set_free(block, false);
+}
+
+static bool block_can_split(const block_header *block, usize size) {
+    return block_size(block) >= sizeof(block_header) + size;
+}
+
+// Splits the tail off of `block` so that `block` is left with `size` bytes, and returns the tail.
+static block_header *block_split(block_header *block, usize size) {
+    auto *remaining = (block_header *)util::offset_rawptr(block_to_ptr(block), size);
+    usize remaining_size = block_size(block) - (size + BLOCK_OVERHEAD);
+    VIXEN_DEBUG_ASSERT(remaining_size >= BLOCK_SIZE_MIN, "Split a TLSF block too small.");
+
+    block_set_size(remaining, remaining_size);
+    block_set_size(block, size);
+    block_mark_as_free(remaining);
+    return remaining;
+}
+
+// Merges `block` into the block physically before it, `prev`.
+static block_header *block_absorb(block_header *prev, block_header *block) {
+    VIXEN_DEBUG_ASSERT(!block_is_last(prev), "Tried to merge into the sentinel block.");
+    prev->size += block_size(block) + BLOCK_OVERHEAD;
+    block_link_next(prev);
+    return prev;
+}
+
+// Rounds up a request to something that an entire block can be carved out for. Returns 0 for
+// requests that are too big for any block.
+static usize adjust_request_size(usize size, usize align) {
+    usize aligned = util::align_pointer_up(size, align);
+    if (aligned >= BLOCK_SIZE_MAX) {
+        return 0;
+    }
+    return std::max(aligned, BLOCK_SIZE_MIN);
+}
+
+static void mapping_insert(usize size, usize &fl, usize &sl) {
+    if (size < SMALL_BLOCK_SIZE) {
+        fl = 0;
+        sl = size / (SMALL_BLOCK_SIZE / TLSF_SL_INDEX_COUNT);
+    } else {
+        usize log2 = log2_floor(size);
+        sl = (size >> (log2 - TLSF_SL_INDEX_COUNT_LOG2)) ^ TLSF_SL_INDEX_COUNT;
+        fl = log2 - (TLSF_FL_INDEX_SHIFT - 1);
+    }
+}
+
+// Like `mapping_insert`, but rounds up to the next list, so that every block in the list that is
+// found is big enough. This is what makes the allocator a good fit instead of an exact fit.
+static void mapping_search(usize size, usize &fl, usize &sl) {
+    if (size >= SMALL_BLOCK_SIZE) {
+        size += ((usize)1 << (log2_floor(size) - TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+tlsf_allocator::tlsf_allocator(void *block, usize len) {
+    void *start = util::align_pointer_up(block, ALIGN_SIZE);
+    usize padding = (usize)start - (usize)block;
+    VIXEN_ASSERT(len > padding && len - padding >= 2 * BLOCK_OVERHEAD + BLOCK_SIZE_MIN,
+        "Block of {} bytes is too small for a TLSF allocator.",
+        len);
+    usize usable = len - padding;
+
+    // The region ends with a zero-sized sentinel block that is always in use, which stops merges
+    // from running off the end.
+    usize size = std::min((usable - 2 * BLOCK_OVERHEAD) & ~(ALIGN_SIZE - 1),
+        BLOCK_SIZE_MAX - ALIGN_SIZE);
+    auto *first = (block_header *)start;
+    first->size = size;
+    block_set_free(first, true);
+    block_set_prev_free(first, false);
+    insert_free_block(first);
+
+    block_header *sentinel = block_link_next(first);
+    sentinel->size = 0;
+    block_set_free(sentinel, false);
+    block_set_prev_free(sentinel, true);
+}
+
+void tlsf_allocator::insert_free_block(block_header *block) {
+    usize fl, sl;
+    mapping_insert(block_size(block), fl, sl);
+
+    block_header *head = this->free_blocks[fl][sl];
+    block->next_free = head;
+    block->prev_free = nullptr;
+    if (head) {
+        head->prev_free = block;
+    }
+    this->free_blocks[fl][sl] = block;
+
+    this->fl_bitmap |= (u64)1 << fl;
+    this->sl_bitmap[fl] |= (u32)1 << sl;
+}
+
+void tlsf_allocator::remove_free_block(block_header *block) {
+    usize fl, sl;
+    mapping_insert(block_size(block), fl, sl);
+
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        this->free_blocks[fl][sl] = block->next_free;
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+
+    if (!this->free_blocks[fl][sl]) {
+        this->sl_bitmap[fl] &= ~((u32)1 << sl);
+        if (!this->sl_bitmap[fl]) {
+            this->fl_bitmap &= ~((u64)1 << fl);
+        }
+    }
+}
+
+tlsf_allocator::block_header *tlsf_allocator::locate_free(usize size) {
+    usize fl, sl;
+    mapping_search(size, fl, sl);
+    if (fl >= TLSF_FL_INDEX_COUNT) {
+        return nullptr;
+    }
+
+    // Look for a non-empty list in this first-level range, and then in any larger range.
+    u32 sl_map = this->sl_bitmap[fl] & (~(u32)0 << sl);
+    if (!sl_map) {
+        u64 fl_map = fl + 1 < 64 ? this->fl_bitmap & (~(u64)0 << (fl + 1)) : 0;
+        if (!fl_map) {
+            return nullptr;
+        }
+        fl = __builtin_ctzll(fl_map);
+        sl_map = this->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+
+    block_header *block = this->free_blocks[fl][sl];
+    remove_free_block(block);
+    return block;
+}
+
+tlsf_allocator::block_header *tlsf_allocator::merge_prev(block_header *block) {
+    if (block_is_prev_free(block)) {
+        block_header *prev = block->prev_phys;
+        remove_free_block(prev);
+        block = block_absorb(prev, block);
+    }
+    return block;
+}
+
+tlsf_allocator::block_header *tlsf_allocator::merge_next(block_header *block) {
+    block_header *next = block_next(block);
+    if (block_is_free(next)) {
+        remove_free_block(next);
+        block = block_absorb(block, next);
+    }
+    return block;
+}
+
+// Gives the tail of a free block that's bigger than needed back to the free lists.
+void tlsf_allocator::trim_free(block_header *block, usize size) {
+    if (block_can_split(block, size)) {
+        block_header *remaining = block_split(block, size);
+        block_link_next(block);
+        block_set_prev_free(remaining, true);
+        insert_free_block(remaining);
+    }
+}
+
+// Gives the tail of a used block that's bigger than needed back to the free lists.
+void tlsf_allocator::trim_used(block_header *block, usize size) {
+    if (block_can_split(block, size)) {
+        block_header *remaining = block_split(block, size);
+        block_set_prev_free(remaining, false);
+        remaining = merge_next(remaining);
+        insert_free_block(remaining);
+    }
+}
+
+// Gives the first `size` bytes of a free block back to the free lists, and returns the rest.
+tlsf_allocator::block_header *tlsf_allocator::trim_free_leading(block_header *block, usize size) {
+    block_header *remaining = block;
+    if (block_can_split(block, size)) {
+        remaining = block_split(block, size - BLOCK_OVERHEAD);
+        block_set_prev_free(remaining, true);
+        block_link_next(block);
+        insert_free_block(block);
+    }
+    return remaining;
+}
+
+void *tlsf_allocator::prepare_used(block_header *block, usize size) {
+    trim_free(block, size);
+    block_mark_as_used(block);
+    return block_to_ptr(block);
+}
+
+void *tlsf_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    usize size = adjust_request_size(layout.size, ALIGN_SIZE);
+    if (size == 0) {
+        throw allocation_exception{};
+    }
+
+    if (layout.align <= ALIGN_SIZE) {
+        block_header *block = locate_free(size);
+        if (!block) {
+            throw allocation_exception{};
+        }
+        return prepare_used(block, size);
+    }
+
+    // Over-aligned requests ask for enough extra space that the payload can be moved up to the
+    // right alignment, with the gap in front of it split off into its own free block. That gap
+    // has to be big enough to hold a block, so we might need to skip ahead another alignment.
+    usize gap_minimum = sizeof(block_header);
+    usize padded_size = adjust_request_size(size + layout.align + gap_minimum, layout.align);
+    if (padded_size == 0) {
+        throw allocation_exception{};
+    }
+    block_header *block = locate_free(padded_size);
+    if (!block) {
+        throw allocation_exception{};
+    }
+
+    void *ptr = block_to_ptr(block);
+    void *aligned = util::align_pointer_up(ptr, layout.align);
+    usize gap = (usize)aligned - (usize)ptr;
+    if (gap != 0 && gap < gap_minimum) {
+        usize offset = std::max(gap_minimum - gap, layout.align);
+        aligned = util::align_pointer_up(util::offset_rawptr(aligned, offset), layout.align);
+        gap = (usize)aligned - (usize)ptr;
+    }
+    if (gap != 0) {
+        block = trim_free_leading(block, gap);
+    }
+
+    return prepare_used(block, size);
+}
+
+void tlsf_allocator::internal_dealloc(const layout &layout, void *ptr) {
+    _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
+
+    block_header *block = block_from_ptr(ptr);
+    VIXEN_DEBUG_ASSERT(!block_is_free(block), "Tried to deallocate {} twice.", ptr);
+
+    block_mark_as_free(block);
+    block = merge_prev(block);
+    block = merge_next(block);
+    insert_free_block(block);
+}
+
+// Resizes the used block at `ptr`, returning its new payload size, or 0 if it would have to move.
+usize tlsf_allocator::resize_in_place(void *ptr, usize new_size) {
+    usize size = adjust_request_size(new_size, ALIGN_SIZE);
+    if (size == 0) {
+        return 0;
+    }
+
+    block_header *block = block_from_ptr(ptr);
+    block_header *next = block_next(block);
+    usize current_size = block_size(block);
+    usize combined_size = current_size + block_size(next) + BLOCK_OVERHEAD;
+
+    // Grow into the next block if it's free and there's enough room, otherwise we have no choice
+    // but to move.
+    if (size > current_size && (!block_is_free(next) || size > combined_size)) {
+        return 0;
+    }
+
+    if (size > current_size) {
+        merge_next(block);
+        block_mark_as_used(block);
+    }
+
+    // Shrinking, or growing into a bigger free block than needed, gives the tail back.
+    trim_used(block, size);
+    return block_size(block);
+}
+
+void *tlsf_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    bool is_aligned = ((usize)old_ptr & (new_layout.align - 1)) == 0;
+    if (!is_aligned || resize_in_place(old_ptr, new_layout.size) == 0) {
+        return general_realloc(this, old_layout, new_layout, old_ptr);
+    }
+    return old_ptr;
+}
+
+// Blocks are often a little bigger than requested, when the leftover was too small to split off.
+allocation tlsf_allocator::internal_alloc_at_least(const layout &layout) {
+    void *ptr = internal_alloc(layout);
+    return {ptr, block_size(block_from_ptr(ptr))};
+}
+
+usize tlsf_allocator::internal_try_grow_in_place(const layout &, usize new_size, void *ptr) {
+    return resize_in_place(ptr, new_size);
+}
+
+usize tlsf_allocator::internal_try_shrink_in_place(const layout &, usize new_size, void *ptr) {
+    return resize_in_place(ptr, new_size);
+}
+
+} // namespace vixen::heap
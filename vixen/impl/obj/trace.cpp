@@ -0,0 +1,316 @@
+#include "vixen/allocator/trace.hpp"
+
+#include "vixen/allocator/allocator.hpp"
+#include "vixen/io/file.hpp"
+
+#include <atomic>
+#include <execinfo.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <thread>
+#include <time.h>
+
+namespace vixen::heap {
+
+// Each thread buffers this many events, and writes them out once its ring is half full.
+constexpr usize TRACE_RING_SIZE = 4096;
+// Each thread remembers this many of the stacks it already wrote out.
+constexpr usize TRACE_STACK_CACHE_SIZE = 1024;
+constexpr usize TRACE_MAX_STACK_DEPTH = 32;
+// Frames for the tracer itself, which would otherwise start every stack.
+constexpr usize TRACE_SKIPPED_FRAMES = 2;
+
+// Only the owning thread pushes events, and only one thread at a time drains them, which is
+// usually the owner too. Rings are never freed: a ring whose thread exited is handed to the next
+// thread that starts recording.
+struct trace_ring {
+    trace_event events[TRACE_RING_SIZE];
+    std::atomic<usize> head{0};
+    std::atomic<usize> tail{0};
+    std::atomic<bool> is_draining{false};
+    std::atomic<bool> is_retired{false};
+
+    u32 thread = 0;
+    u32 seen_stacks[TRACE_STACK_CACHE_SIZE] = {};
+    trace_ring *next = nullptr;
+};
+
+// Guards the ring list, and starting and stopping traces.
+static std::mutex trace_lock;
+static trace_ring *trace_rings = nullptr;
+static std::atomic<u32> next_trace_thread{0};
+
+// Threads only touch the file between raising `active_writers` and lowering it again, and only
+// after seeing `is_tracing` set. Stopping clears `is_tracing` and then waits for the writers to
+// leave, so the file is never unmapped from under one.
+static std::atomic<bool> is_tracing{false};
+static std::atomic<usize> active_writers{0};
+
+static file *trace_file = nullptr;
+static trace_file_header *trace_header = nullptr;
+static trace_event *trace_events = nullptr;
+static usize trace_capacity = 0;
+static bool trace_captures_stacks = false;
+static std::atomic<usize> trace_cursor{0};
+static std::atomic<usize> trace_dropped{0};
+
+struct thread_trace_state {
+    trace_ring *ring = nullptr;
+    bool is_recording = false;
+    bool has_exited = false;
+
+    ~thread_trace_state();
+};
+
+static thread_local thread_trace_state thread_trace;
+
+static usize trace_file_size(usize max_events) {
+    return sizeof(trace_file_header) + max_events * sizeof(trace_event);
+}
+
+static u64 trace_timestamp() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000 + (u64)now.tv_nsec;
+}
+
+// Copies everything buffered in `ring` into the file. Does nothing if someone else is already
+// draining it, since they'll pick up what's there.
+static void drain_ring(trace_ring *ring) {
+    if (ring->is_draining.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+
+    usize tail = ring->tail.load(std::memory_order_relaxed);
+    usize head = ring->head.load(std::memory_order_acquire);
+    usize count = head - tail;
+    if (count > 0) {
+        usize first = trace_cursor.fetch_add(count, std::memory_order_relaxed);
+        usize fits = first >= trace_capacity ? 0 : std::min(count, trace_capacity - first);
+        for (usize i = 0; i < fits; ++i) {
+            trace_events[first + i] = ring->events[(tail + i) % TRACE_RING_SIZE];
+        }
+        if (fits < count) {
+            trace_dropped.fetch_add(count - fits, std::memory_order_relaxed);
+        }
+        ring->tail.store(head, std::memory_order_release);
+    }
+
+    ring->is_draining.store(false, std::memory_order_release);
+}
+
+// Drains `ring` from a thread that isn't the one stopping the trace.
+static void drain_ring_while_tracing(trace_ring *ring) {
+    active_writers.fetch_add(1, std::memory_order_seq_cst);
+    if (is_tracing.load(std::memory_order_seq_cst)) {
+        drain_ring(ring);
+    }
+    active_writers.fetch_sub(1, std::memory_order_release);
+}
+
+thread_trace_state::~thread_trace_state() {
+    if (this->ring) {
+        drain_ring_while_tracing(this->ring);
+        this->ring->is_retired.store(true, std::memory_order_release);
+        this->ring = nullptr;
+    }
+    this->has_exited = true;
+}
+
+static trace_ring *acquire_ring() {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    trace_ring *ring = trace_rings;
+    while (ring && !ring->is_retired.load(std::memory_order_acquire)) {
+        ring = ring->next;
+    }
+
+    if (ring) {
+        // Whatever the last thread left behind was written out when it exited, or when the trace
+        // was stopped.
+        ring->is_retired.store(false, std::memory_order_relaxed);
+        ring->tail.store(ring->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        util::fill((u32)0, ring->seen_stacks, TRACE_STACK_CACHE_SIZE);
+    } else {
+        ring = new (debug_allocator()->alloc(layout::of<trace_ring>())) trace_ring();
+        ring->next = trace_rings;
+        trace_rings = ring;
+    }
+    ring->thread = next_trace_thread.fetch_add(1, std::memory_order_relaxed);
+    return ring;
+}
+
+static void push_event(trace_ring *ring, const trace_event &event) {
+    usize head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == TRACE_RING_SIZE) {
+        drain_ring_while_tracing(ring);
+        if (head - ring->tail.load(std::memory_order_acquire) == TRACE_RING_SIZE) {
+            trace_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    ring->events[head % TRACE_RING_SIZE] = event;
+    ring->head.store(head + 1, std::memory_order_release);
+
+    if (head + 1 - ring->tail.load(std::memory_order_relaxed) >= TRACE_RING_SIZE / 2) {
+        drain_ring_while_tracing(ring);
+    }
+}
+
+// FNV-1a over the return addresses. 0 means "no stack", so it's never used as an ID.
+static u32 hash_stack(void *const *frames, usize count) {
+    u32 hash = 0x811c9dc5;
+    for (usize i = 0; i < count; ++i) {
+        usize addr = (usize)frames[i];
+        for (usize byte = 0; byte < sizeof(addr); ++byte) {
+            hash = (hash ^ (u8)(addr >> (byte * 8))) * 0x01000193;
+        }
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+// Writes the stack out the first time this thread sees it, and returns its ID.
+static u32 record_stack(trace_ring *ring, u64 timestamp) {
+    void *frames[TRACE_MAX_STACK_DEPTH + TRACE_SKIPPED_FRAMES];
+    usize depth = (usize)backtrace(frames, TRACE_MAX_STACK_DEPTH + TRACE_SKIPPED_FRAMES);
+    if (depth <= TRACE_SKIPPED_FRAMES) {
+        return 0;
+    }
+    void *const *stack = frames + TRACE_SKIPPED_FRAMES;
+    depth -= TRACE_SKIPPED_FRAMES;
+
+    u32 id = hash_stack(stack, depth);
+    u32 &seen = ring->seen_stacks[id % TRACE_STACK_CACHE_SIZE];
+    if (seen == id) {
+        return id;
+    }
+    seen = id;
+
+    for (usize i = 0; i < depth; ++i) {
+        trace_event frame = {};
+        frame.timestamp = timestamp;
+        frame.ptr = (u64)stack[i];
+        frame.size = i;
+        frame.thread = ring->thread;
+        frame.stack_id = id;
+        frame.kind = trace_event_kind::stack_frame;
+        push_event(ring, frame);
+    }
+    return id;
+}
+
+void record_trace_event(trace_event event) {
+    // Walking the stack can allocate the first time, which would land right back here.
+    thread_trace_state &state = thread_trace;
+    if (!is_tracing.load(std::memory_order_relaxed) || state.is_recording || state.has_exited) {
+        return;
+    }
+    state.is_recording = true;
+
+    if (!state.ring) {
+        state.ring = acquire_ring();
+    }
+    event.timestamp = trace_timestamp();
+    event.thread = state.ring->thread;
+    if (trace_captures_stacks) {
+        event.stack_id = record_stack(state.ring, event.timestamp);
+    }
+    push_event(state.ring, event);
+
+    state.is_recording = false;
+}
+
+bool is_event_tracing() {
+    return is_tracing.load(std::memory_order_relaxed);
+}
+
+void start_event_trace(const char *path, trace_options options) {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    VIXEN_ASSERT(!is_tracing.load(), "Tried to start an event trace while one was running.");
+
+    usize size = util::align_pointer_up(trace_file_size(options.max_events), page_size());
+    file *backing = new (debug_allocator()->alloc(layout::of<file>()))
+        file(path, open_mode{true, true, true, false, true, 0644});
+    if (backing->fd < 0 || ftruncate(backing->fd, size) != 0) {
+        backing->~file();
+        debug_allocator()->dealloc(layout::of<file>(), backing);
+        VIXEN_PANIC("Could not create the event trace file '{}'.", path);
+    }
+
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, backing->fd, 0);
+    if (base == MAP_FAILED) {
+        backing->~file();
+        debug_allocator()->dealloc(layout::of<file>(), backing);
+        VIXEN_PANIC("Could not map the event trace file '{}'.", path);
+    }
+
+    trace_file = backing;
+    trace_header = (trace_file_header *)base;
+    trace_header->magic = TRACE_MAGIC;
+    trace_header->version = TRACE_VERSION;
+    trace_header->event_size = sizeof(trace_event);
+    trace_events = (trace_event *)util::offset_rawptr(base, sizeof(trace_file_header));
+    trace_capacity = options.max_events;
+    trace_captures_stacks = options.capture_stacks;
+    trace_cursor.store(0, std::memory_order_relaxed);
+    trace_dropped.store(0, std::memory_order_relaxed);
+
+    // Anything still buffered belongs to a trace that already stopped.
+    for (trace_ring *ring = trace_rings; ring; ring = ring->next) {
+        ring->tail.store(ring->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        util::fill((u32)0, ring->seen_stacks, TRACE_STACK_CACHE_SIZE);
+    }
+
+    is_tracing.store(true, std::memory_order_seq_cst);
+}
+
+// Threads that are still copying their events in may leave holes behind the count, which read as
+// events with a timestamp of 0.
+static void write_trace_header() {
+    trace_header->event_count = std::min(trace_cursor.load(), trace_capacity);
+    trace_header->dropped_count = trace_dropped.load();
+}
+
+void flush_event_trace() {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    if (!is_tracing.load()) {
+        return;
+    }
+
+    for (trace_ring *ring = trace_rings; ring; ring = ring->next) {
+        drain_ring_while_tracing(ring);
+    }
+    write_trace_header();
+}
+
+void stop_event_trace() {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    if (!is_tracing.load()) {
+        return;
+    }
+
+    is_tracing.store(false, std::memory_order_seq_cst);
+    while (active_writers.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+
+    for (trace_ring *ring = trace_rings; ring; ring = ring->next) {
+        drain_ring(ring);
+    }
+    write_trace_header();
+
+    usize size = trace_file_size(trace_header->event_count);
+    munmap(trace_header, util::align_pointer_up(trace_file_size(trace_capacity), page_size()));
+    // Nothing past the last event is worth keeping on disk.
+    if (ftruncate(trace_file->fd, size) != 0) {
+        VIXEN_WARN("Could not trim the event trace file to {} bytes.", size);
+    }
+    trace_file->~file();
+    debug_allocator()->dealloc(layout::of<file>(), trace_file);
+
+    trace_file = nullptr;
+    trace_header = nullptr;
+    trace_events = nullptr;
+}
+
+} // namespace vixen::heap
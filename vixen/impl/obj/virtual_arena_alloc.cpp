@@ -0,0 +1,130 @@
+#include "vixen/allocator/allocators.hpp"
+
+#include <sys/mman.h>
+
+namespace vixen::heap {
+
+// Pages are committed in chunks of this many bytes, so that bumping through a bunch of small
+// allocations doesn't turn into one `mprotect` per page.
+constexpr usize COMMIT_GRANULE = 64 * 1024;
+
+virtual_arena_allocator::virtual_arena_allocator(usize reserve_size, usize retain_size) {
+    usize size = util::align_pointer_up(reserve_size, COMMIT_GRANULE);
+    void *base = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        throw allocation_exception{};
+    }
+
+    this->start = base;
+    this->end = util::offset_rawptr(base, size);
+    this->cursor = base;
+    this->prev_cursor = base;
+    this->committed = base;
+    this->retain_size = util::align_pointer_up(std::min(retain_size, size), COMMIT_GRANULE);
+}
+
+virtual_arena_allocator::~virtual_arena_allocator() {
+    munmap(this->start, (usize)this->end - (usize)this->start);
+}
+
+usize virtual_arena_allocator::committed_bytes() const {
+    return (usize)this->committed - (usize)this->start;
+}
+
+void virtual_arena_allocator::commit_to(void *new_cursor) {
+    if (new_cursor <= this->committed) {
+        return;
+    }
+    if (new_cursor > this->end) {
+        throw allocation_exception{};
+    }
+
+    void *new_committed = util::align_pointer_up(new_cursor, COMMIT_GRANULE);
+    new_committed = std::min(new_committed, this->end);
+    usize len = (usize)new_committed - (usize)this->committed;
+    if (mprotect(this->committed, len, PROT_READ | PROT_WRITE) != 0) {
+        throw allocation_exception{};
+    }
+    this->committed = new_committed;
+}
+
+void virtual_arena_allocator::internal_reset() {
+    this->cursor = this->start;
+    this->prev_cursor = this->start;
+
+    // Give everything past the retained region back to the OS. `MADV_DONTNEED` drops the pages
+    // right away, and re-protecting them makes stray accesses into the reset region fault.
+    void *retained_end = util::offset_rawptr(this->start, this->retain_size);
+    if (this->committed > retained_end) {
+        usize len = (usize)this->committed - (usize)retained_end;
+        madvise(retained_end, len, MADV_DONTNEED);
+        mprotect(retained_end, len, PROT_NONE);
+        this->committed = retained_end;
+    }
+}
+
+// The most recent allocation can grow until the end of the reservation, since there is nothing
+// after it but reserved address space.
+usize virtual_arena_allocator::internal_try_grow_in_place(
+    const layout &, usize new_size, void *ptr) {
+    void *new_cursor = util::offset_rawptr(ptr, new_size);
+    if (ptr != this->prev_cursor || new_cursor > this->end) {
+        return 0;
+    }
+
+    try {
+        commit_to(new_cursor);
+    } catch (allocation_exception &ex) {
+        return 0;
+    }
+    this->cursor = new_cursor;
+    return new_size;
+}
+
+usize virtual_arena_allocator::internal_try_shrink_in_place(
+    const layout &, usize new_size, void *ptr) {
+    if (ptr == this->prev_cursor) {
+        this->cursor = util::offset_rawptr(ptr, new_size);
+    }
+    return new_size;
+}
+
+void *virtual_arena_allocator::internal_realloc(
+    const layout &old_layout, const layout &new_layout, void *old_ptr) {
+    _VIXEN_REALLOC_PROLOGUE(old_layout, new_layout, old_ptr)
+
+    if (old_layout.align < new_layout.align) {
+        return general_realloc(this, old_layout, new_layout, old_ptr);
+    }
+
+    if (new_layout.size <= old_layout.size) {
+        internal_try_shrink_in_place(old_layout, new_layout.size, old_ptr);
+        return old_ptr;
+    }
+    if (internal_try_grow_in_place(old_layout, new_layout.size, old_ptr) != 0) {
+        return old_ptr;
+    }
+    return general_realloc(this, old_layout, new_layout, old_ptr);
+}
+
+void *virtual_arena_allocator::internal_alloc(const layout &layout) {
+    _VIXEN_ALLOC_PROLOGUE(layout)
+
+    void *base = util::align_pointer_up(this->cursor, layout.align);
+    void *next = util::offset_rawptr(base, layout.size);
+    commit_to(next);
+
+    this->prev_cursor = base;
+    this->cursor = next;
+    return base;
+}
+
+void virtual_arena_allocator::internal_dealloc(const layout &layout, void *ptr) {
+    _VIXEN_DEALLOC_PROLOGUE(layout, ptr)
+
+    if (this->prev_cursor == ptr) {
+        this->cursor = this->prev_cursor;
+    }
+}
+
+} // namespace vixen::heap
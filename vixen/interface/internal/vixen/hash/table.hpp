@@ -23,6 +23,9 @@ struct hash_table_stats {
     usize collisions;
 };
 
+// Number of slots in a table the first time it is grown.
+constexpr usize default_hash_table_capacity = 16;
+
 template <typename T>
 struct default_comparator {
     template <typename U>
@@ -48,6 +51,8 @@ struct hash_table {
 
     ~hash_table();
 
+    /// Makes room for at least one more entry, rehashing into a larger table if needed.
+    void grow_if_needed();
     void insert(usize slot, u64 hash, T &&value);
     constexpr void remove(usize slot);
     constexpr T &get(usize slot);
@@ -69,6 +74,8 @@ struct hash_table {
     constexpr usize len() const { return items; }
     // clang-format on
 
+    void release_storage();
+
     allocator *alloc;
 
     usize capacity = 0;
@@ -55,6 +55,34 @@ struct allocation_exception {};
 
 constexpr u8 ALLOCATION_PATTERN = 0xae;
 constexpr u8 DEALLOCATION_PATTERN = 0xfe;
+
+/// @ingroup vixen_allocator
+/// @brief How much of each allocation gets filled with `ALLOCATION_PATTERN` when it's handed out
+/// and `DEALLOCATION_PATTERN` when it's given back, to make uses of uninitialized or freed memory
+/// easier to spot.
+enum class poison_policy {
+    /// Never touch memory that the caller doesn't touch itself.
+    off,
+    /// Poison entire allocations, but only about one in every `POISON_SAMPLE_RATE`, picked by
+    /// address so that an allocation is poisoned on both ends or neither.
+    sampled,
+    /// Poison only the first `POISON_PREFIX_SIZE` bytes of each allocation, which catches most
+    /// header and small-object bugs without faulting in every page of large allocations.
+    prefix,
+    /// Poison every byte of every allocation.
+    full,
+};
+
+constexpr usize POISON_SAMPLE_RATE = 64;
+constexpr usize POISON_PREFIX_SIZE = 64;
+
+// The policy new allocators start out with, set by the `VIXEN_POISON_POLICY` build option. The
+// build decides this rather than `NDEBUG`, so that vixen and the code using it always agree.
+#if defined(VIXEN_POISON_POLICY)
+constexpr poison_policy DEFAULT_POISON_POLICY = poison_policy::VIXEN_POISON_POLICY;
+#else
+constexpr poison_policy DEFAULT_POISON_POLICY = poison_policy::off;
+#endif
 constexpr usize MAX_LEGACY_ALIGNMENT = alignof(std::max_align_t);
 
 // layout:
@@ -80,6 +108,18 @@ constexpr usize MAX_LEGACY_ALIGNMENT = alignof(std::max_align_t);
 //     - P must have been created with an allocation request to A.
 //     - L must be equal to the layout that P was created with.
 //     - R must not throw.
+//
+// alloc_at_least and in-place resizing:
+//     - A request R that reports a usable size S for P is equivalent to P having been created with
+//       L.with_size(S). Any size in [L.size, S] may be used to describe P afterwards.
+//     - If an in-place resize fails, P is left exactly as it was.
+
+/// @ingroup vixen_allocator
+/// @brief A block returned by `allocator::alloc_at_least`, along with how big it really is.
+struct allocation {
+    void *ptr;
+    usize size;
+};
 
 /// @ingroup vixen_allocator
 /// @brief Base allocator class.
@@ -91,16 +131,60 @@ struct allocator {
     VIXEN_NODISCARD void *realloc(
         const layout &old_layout, const layout &new_layout, void *old_ptr);
 
+    /// @brief Allocates a block of at least `layout.size` bytes, and reports how many bytes of it
+    /// are actually usable, which can be more when the allocator rounds requests up.
+    ///
+    /// The usable size is rounded down to a multiple of `granularity`, so callers that only use
+    /// whole elements of the block describe it with exactly the size that was reported.
+    VIXEN_NODISCARD allocation alloc_at_least(const layout &layout, usize granularity = 1);
+    /// @brief Tries to grow the block at `ptr` to at least `new_size` bytes without moving it.
+    ///
+    /// Returns the new usable size of the block, rounded down to a multiple of `granularity`, or 0
+    /// if it can't grow where it is.
+    usize try_grow_in_place(
+        const layout &old_layout, usize new_size, void *ptr, usize granularity = 1);
+    /// @brief Tries to shrink the block at `ptr` to `new_size` bytes without moving it.
+    ///
+    /// Returns the new usable size of the block, rounded down to a multiple of `granularity`, or 0
+    /// if it can't shrink where it is.
+    usize try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr, usize granularity = 1);
+
+    /// @brief Allocates `count` blocks of `layout` into `out_ptrs` as a single request.
+    ///
+    /// Either every block is allocated, or none are and `allocation_exception` is thrown.
+    void alloc_batch(const layout &layout, usize count, void **out_ptrs);
+    /// @brief Deallocates `count` blocks of `layout` as a single request.
+    void dealloc_batch(const layout &layout, usize count, void *const *ptrs);
+
     /// @brief Unique ID of this allocator, used for allocator tracking.
     /// @see profile.hpp
     allocator_id id = NOT_TRACKED_ID;
 
+    /// @brief How much this allocator is profiled. Only registered allocators are profiled.
+    /// @see set_profiling_tier
+    profiling_tier profiling = profiling_tier::off;
+
+    /// @brief How much of each allocation this allocator fills with debug patterns.
+    poison_policy poison = DEFAULT_POISON_POLICY;
+
 protected:
     VIXEN_NODISCARD virtual void *internal_alloc(const layout &layout) = 0;
     virtual void internal_dealloc(const layout &layout, void *ptr) = 0;
 
     VIXEN_NODISCARD virtual void *internal_realloc(
         const layout &old_layout, const layout &new_layout, void *old_ptr);
+
+    // None of these are ever called with zero sizes. By default, blocks are never bigger than
+    // requested and never resize in place.
+    virtual allocation internal_alloc_at_least(const layout &layout);
+    virtual usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr);
+    virtual usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr);
+
+    // Batches are never empty and never zero-sized, and the default implementations just loop.
+    virtual void internal_alloc_batch(const layout &layout, usize count, void **out_ptrs);
+    virtual void internal_dealloc_batch(const layout &layout, usize count, void *const *ptrs);
 };
 
 /// @ingroup vixen_allocator
@@ -118,6 +202,9 @@ protected:
     VIXEN_NODISCARD virtual void *internal_legacy_alloc(usize size) = 0;
     virtual void internal_legacy_dealloc(void *ptr) = 0;
     VIXEN_NODISCARD virtual void *internal_legacy_realloc(usize new_size, void *old_ptr) = 0;
+    // How many bytes of the block at `ptr` the caller may have written to, which is at least the
+    // size it was requested with. Only asked for when poisoning is on.
+    virtual usize internal_legacy_size(const void *ptr) const = 0;
 };
 
 // TODO: not happy about this inheritance hierarchy... I'd like something more like traits, so I
@@ -191,12 +278,64 @@ inline void alloc_parallel(allocator *alloc, usize len, H **head, Args **...args
 template <typename H, typename... Args>
 inline void realloc_parallel(allocator *alloc, usize len, usize new_len, H **head, Args **...args);
 
+/// @ingroup vixen_allocator
+/// @brief Fills the part of the `size` byte allocation at `ptr` that `policy` calls for with
+/// `pattern`.
+inline void poison_memory(poison_policy policy, u8 pattern, void *ptr, usize size);
+
+/// @ingroup vixen_allocator
+/// @brief Like `poison_memory`, but leaves the first `offset` bytes of the allocation alone. Used
+/// for the tail of a grown allocation, which has to be poisoned as part of the whole allocation.
+inline void poison_memory_from(
+    poison_policy policy, u8 pattern, void *ptr, usize offset, usize size);
+inline bool is_profiled(const allocator *alloc);
+
+/// @ingroup vixen_allocator
+/// @brief Allocates from `alloc` just like `alloc->alloc(layout)`, but calls `A`'s implementation
+/// directly instead of through the vtable when `A` is a concrete (`final`) allocator type, so the
+/// compiler can inline it.
+///
+/// Allocators that are tracked by the profiler always go through the regular path.
+template <typename A>
+VIXEN_NODISCARD inline void *alloc_with(A *alloc, const layout &layout);
+
+/// @ingroup vixen_allocator
+/// @brief Like `alloc_with`, but for `alloc->dealloc(layout, ptr)`.
+template <typename A>
+inline void dealloc_with(A *alloc, const layout &layout, void *ptr);
+
+/// @ingroup vixen_allocator
+/// @brief Like `alloc_with`, but for `alloc->realloc(old_layout, new_layout, old_ptr)`.
+template <typename A>
+VIXEN_NODISCARD inline void *realloc_with(
+    A *alloc, const layout &old_layout, const layout &new_layout, void *old_ptr);
+
+/// @ingroup vixen_allocator
+/// @brief Like `alloc_with`, but for `alloc->alloc_at_least(layout, granularity)`.
+template <typename A>
+VIXEN_NODISCARD inline allocation alloc_at_least_with(
+    A *alloc, const layout &layout, usize granularity = 1);
+
+/// @ingroup vixen_allocator
+/// @brief Like `alloc_with`, but for `alloc->try_grow_in_place(old_layout, new_size, ptr,
+/// granularity)`.
+template <typename A>
+inline usize try_grow_in_place_with(
+    A *alloc, const layout &old_layout, usize new_size, void *ptr, usize granularity = 1);
+
+/// @ingroup vixen_allocator
+/// @brief Like `alloc_with`, but for `alloc->try_shrink_in_place(old_layout, new_size, ptr,
+/// granularity)`.
+template <typename A>
+inline usize try_shrink_in_place_with(
+    A *alloc, const layout &old_layout, usize new_size, void *ptr, usize granularity = 1);
+
 /// @ingroup vixen_allocator
 allocator *global_allocator();
 
 /// @ingroup vixen_allocator
-/// Allocator that can be used like `malloc`/`free` would be, and forwards requests to
-/// `global_allocator()`.
+/// Allocator that can be used like `malloc`/`free` would be. Small requests are served from the
+/// same slab as `global_allocator()`, and nothing is stored in front of any block.
 legacy_allocator *legacy_global_allocator();
 
 /// @ingroup vixen_allocator
@@ -205,6 +344,16 @@ allocator *debug_allocator();
 
 usize page_size();
 
+/// Size of the default huge page, as reported by the kernel, or 2 MiB if it can't be determined.
+usize huge_page_size();
+
+/// Maps `size` bytes of readable and writable pages with the `mmap` flags in `flags`, backed by
+/// `fd` from its start unless it's -1. `address` is only a hint, unless `MAP_FIXED_NOREPLACE` is
+/// in `flags`, in which case the pages are mapped exactly there or not at all.
+///
+/// Returns null if the pages couldn't be mapped.
+void *map_pages(void *address, usize size, int flags, int fd = -1);
+
 } // namespace vixen::heap
 
 /// @ingroup vixen_allocator
@@ -3,29 +3,106 @@
 #pragma once
 
 #include "vixen/allocator/allocator.hpp"
+#include "vixen/allocator/page_map.hpp"
 #include "vixen/traits.hpp"
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 /// @file
 /// @ingroup vixen_allocator
 
 namespace vixen::heap {
+// Size of each span that `slab_allocator` requests from its parent. Spans are aligned to their
+// size, so the span that owns an allocation can be found by masking off the low bits.
+constexpr usize SLAB_SPAN_SIZE = 256 * 1024;
+// Requests larger than this are forwarded to the parent allocator.
+constexpr usize SLAB_MAX_SIZE = 16 * 1024;
+// Every size class is a multiple of this, and every slab allocation is aligned to it.
+constexpr usize SLAB_MIN_ALIGNMENT = 16;
+constexpr usize SLAB_SIZE_CLASS_COUNT = 36;
+
+enum class huge_page_policy {
+    /// Always map regular pages.
+    none,
+    /// Map pages from the `MAP_HUGETLB` pool, falling back to regular pages if it's exhausted.
+    explicit_huge,
+    /// Map regular pages aligned to the huge page size and advise the kernel to back them with
+    /// transparent huge pages.
+    transparent_huge,
+    /// Try `explicit_huge` first, then `transparent_huge`.
+    automatic,
+};
+
 // Requests blocks of memory directly from the OS with `mmap` and releases them with `munmap`.
 // This allocator is a "source" and doesn't have a parent allocator.
+//
+// Allocations of at least `huge_page_threshold` bytes are mapped according to `policy`, and have
+// their size rounded up to a multiple of the huge page size. Which kind of pages were actually
+// used is reported to the profiler with `record_page_mapping`.
+//
+// Reallocations remap the existing pages with `mremap` instead of copying them whenever possible.
 struct page_allocator final : public allocator {
     void *internal_alloc(const layout &layout) override;
     void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    allocation internal_alloc_at_least(const layout &layout) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+
+    page_allocator() = default;
+    explicit page_allocator(huge_page_policy policy);
+    page_allocator(huge_page_policy policy, usize huge_page_threshold);
+
+private:
+    bool wants_huge_pages(const layout &layout) const;
+    usize granularity_of(const layout &layout) const;
+    usize usable_size(const layout &layout) const;
+    usize resize_in_place(const layout &old_layout, usize new_size, void *ptr);
+    void advise_resized(const layout &old_layout, const layout &new_layout, void *ptr);
+
+    // Fixed at construction, since deallocation works out how much to unmap from these.
+    huge_page_policy policy = huge_page_policy::none;
+    usize huge_page_threshold = 0;
 };
 
 struct legacy_adapter_allocator final : public legacy_allocator {
     VIXEN_NODISCARD virtual void *internal_legacy_alloc(usize size) override;
     virtual void internal_legacy_dealloc(void *ptr) override;
     VIXEN_NODISCARD virtual void *internal_legacy_realloc(usize new_size, void *old_ptr) override;
+    virtual usize internal_legacy_size(const void *ptr) const override;
 
     legacy_adapter_allocator(allocator *adapted) : adapted(adapted) {}
 
     allocator *adapted;
 };
 
+// A `legacy_allocator` that doesn't keep a header in front of every block. Small blocks come from
+// `small`, which must hand out slots of a `slab_allocator`, like the slab itself or a
+// `thread_cache_allocator` in front of one, so that their size can be read back from their span.
+// Larger blocks come from `large`, with their size kept in a page map. `large` must give every
+// block pages of its own, like `page_allocator` does.
+struct slab_legacy_allocator final : public legacy_allocator {
+    VIXEN_NODISCARD virtual void *internal_legacy_alloc(usize size) override;
+    virtual void internal_legacy_dealloc(void *ptr) override;
+    VIXEN_NODISCARD virtual void *internal_legacy_realloc(usize new_size, void *old_ptr) override;
+    virtual usize internal_legacy_size(const void *ptr) const override;
+
+    slab_legacy_allocator(allocator *small, allocator *large);
+
+    /// Returns how many bytes of the block at `ptr` can be used, like `malloc_usable_size`.
+    usize usable_size(const void *ptr) const;
+
+private:
+    allocator *small;
+    allocator *large;
+    // Requested size of each large block, stored on its first page. Pages without a large block
+    // starting on them read as 0.
+    page_map large_sizes;
+};
+
 // Forwards alloctions to malloc/free
 struct system_allocator final : public legacy_allocator {
     void *internal_alloc(const layout &layout) override;
@@ -34,21 +111,36 @@ struct system_allocator final : public legacy_allocator {
     VIXEN_NODISCARD virtual void *internal_legacy_alloc(usize size) override;
     virtual void internal_legacy_dealloc(void *ptr) override;
     VIXEN_NODISCARD virtual void *internal_legacy_realloc(usize new_size, void *old_ptr) override;
+    virtual usize internal_legacy_size(const void *ptr) const override;
 };
 
 // Blasts through memory like `arena_allocator` but doesn't page in more memory when
 // its current block runs out.
 // This allocator is a "source" and doesn't have a parent allocator.
 struct linear_allocator final : public resettable_allocator {
-    void *internal_alloc(const layout &layout) override;
+    inline void *internal_alloc(const layout &layout) override;
     void internal_dealloc(const layout &layout, void *ptr) override;
     void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
 
     void internal_reset() override;
 
     linear_allocator(void *block, usize len);
     ~linear_allocator();
 
+    struct savepoint {
+        void *cursor;
+        void *prev_cursor;
+    };
+
+    /// Captures the current position of the allocator, which `restore` can roll back to.
+    savepoint save() const;
+    /// Discards every allocation made since `point` was saved. Savepoints taken after `point` are
+    /// invalidated, while ones taken before it can still be restored.
+    void restore(const savepoint &point);
+
 private:
     void *cursor;
     void *prev_cursor;
@@ -56,14 +148,193 @@ private:
     void *end;
 };
 
+// Every TLSF block is a multiple of this many bytes, and so is aligned to it.
+constexpr usize TLSF_ALIGN_LOG2 = 4;
+// Each first-level (power of two) size range is split into 2^this second-level ranges.
+constexpr usize TLSF_SL_INDEX_COUNT_LOG2 = 5;
+constexpr usize TLSF_SL_INDEX_COUNT = 1 << TLSF_SL_INDEX_COUNT_LOG2;
+// Blocks can be at most 2^this bytes, which also bounds the size of the managed region.
+constexpr usize TLSF_FL_INDEX_MAX = 40;
+constexpr usize TLSF_FL_INDEX_SHIFT = TLSF_SL_INDEX_COUNT_LOG2 + TLSF_ALIGN_LOG2;
+constexpr usize TLSF_FL_INDEX_COUNT = TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1;
+
+// Two-Level Segregated Fit allocator over a fixed block of memory, like `linear_allocator`. Free
+// blocks are kept in lists segregated by size, and a two-level bitmap finds a list with a big
+// enough block in a couple of bit scans, so alloc, dealloc and realloc all run in constant time
+// no matter how fragmented the block gets. Neighboring free blocks are merged eagerly, and realloc
+// grows in place whenever the next block is free and big enough.
+//
+// Throws `allocation_exception` when no free block is big enough, and never asks the OS for more.
+// This allocator is a "source" and doesn't have a parent allocator.
 // NOT THREADSAFE!!!
-struct arena_allocator final : public resettable_allocator {
+struct tlsf_allocator final : public allocator {
+    void *internal_alloc(const layout &layout) override;
+    void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    allocation internal_alloc_at_least(const layout &layout) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+
+    tlsf_allocator(void *block, usize len);
+
+    struct block_header {
+        // Only valid when the previous block is free.
+        block_header *prev_phys;
+        // Size of the payload. The low bits are used for the free and previous-free flags.
+        usize size;
+        // Links in the free list for this block's size, only valid while the block is free.
+        block_header *next_free;
+        block_header *prev_free;
+    };
+
+private:
+    void insert_free_block(block_header *block);
+    void remove_free_block(block_header *block);
+    block_header *locate_free(usize size);
+
+    block_header *merge_prev(block_header *block);
+    block_header *merge_next(block_header *block);
+    void trim_free(block_header *block, usize size);
+    void trim_used(block_header *block, usize size);
+    block_header *trim_free_leading(block_header *block, usize size);
+    void *prepare_used(block_header *block, usize size);
+    usize resize_in_place(void *ptr, usize new_size);
+
+    u64 fl_bitmap = 0;
+    u32 sl_bitmap[TLSF_FL_INDEX_COUNT] = {};
+    block_header *free_blocks[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT] = {};
+};
+
+// Upper bound on the number of block sizes a `buddy_allocator` can have.
+constexpr usize BUDDY_MAX_ORDER_COUNT = 48;
+
+// Binary buddy allocator over a single power-of-two region requested from the parent, meant for
+// mid-sized buffers that churn too much for `arena_allocator` and are too small to be worth a
+// syscall each from `page_allocator`. Every block is a power of two of at least
+// `min_block_size` bytes, aligned to its own size.
+//
+// Freed blocks are merged with their buddy right away whenever the buddy is free too. Reallocs
+// shrink by splitting off the upper halves, and grow in place by absorbing free upper buddies.
+// Requests that are larger than the region, or that can't be satisfied because the region is
+// full, are forwarded to the parent.
+// NOT THREADSAFE!!!
+struct buddy_allocator final : public allocator {
+    void *internal_alloc(const layout &layout) override;
+    void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    allocation internal_alloc_at_least(const layout &layout) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+
+    buddy_allocator(allocator *parent,
+        usize region_size = 64 * 1024 * 1024,
+        usize min_block_size = 4096);
+    ~buddy_allocator();
+
+    /// Returns whether `ptr` was allocated out of this allocator's region, rather than the parent.
+    bool owns(const void *ptr) const;
+
+    struct free_block {
+        free_block *prev, *next;
+    };
+
+private:
+    usize order_of(const layout &layout) const;
+    void push_free(usize order, usize offset);
+    void remove_free(usize order, usize offset);
+    bool resize_in_place(usize offset, usize new_order);
+
+    void *start;
+    usize min_order;
+    usize max_order;
+    // One byte per `min_block_size` bytes of the region, only meaningful at the first index of a
+    // block. Holds the block's order, with the high bit set if the block is free.
+    u8 *block_states;
+    free_block *free_lists[BUDDY_MAX_ORDER_COUNT] = {};
+    allocator *parent;
+};
+
+// Saves the position of an allocator with savepoints, like `arena_allocator` or
+// `linear_allocator`, and rolls back to it when it goes out of scope. Scopes may be nested, as long
+// as inner scopes end before outer ones.
+template <typename A>
+struct scoped_savepoint {
+    explicit scoped_savepoint(A *alloc) : alloc(alloc), point(alloc->save()) {}
+    ~scoped_savepoint() {
+        alloc->restore(point);
+    }
+
+    scoped_savepoint(const scoped_savepoint &) = delete;
+    scoped_savepoint &operator=(const scoped_savepoint &) = delete;
+
+private:
+    A *alloc;
+    typename A::savepoint point;
+};
+
+// Reserves a large range of address space up front and commits pages as the cursor advances, so
+// allocations never move and there's only ever one block to bump through. Like
+// `linear_allocator`, except that it only runs out of memory once the whole reservation is used.
+// Growing the most recent allocation is always done in place.
+//
+// On reset, everything past the first `retain_size` bytes is decommitted and handed back to the
+// OS, while the retained pages stay committed so the next round doesn't fault them in again.
+// This allocator is a "source" and doesn't have a parent allocator.
+struct virtual_arena_allocator final : public resettable_allocator {
     void *internal_alloc(const layout &layout) override;
     void internal_dealloc(const layout &layout, void *ptr) override;
     void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+
     void internal_reset() override;
 
-    explicit arena_allocator(allocator *parent);
+    explicit virtual_arena_allocator(usize reserve_size, usize retain_size = 0);
+    ~virtual_arena_allocator();
+
+    usize committed_bytes() const;
+
+private:
+    void commit_to(void *new_cursor);
+
+    void *cursor;
+    void *prev_cursor;
+    void *start;
+    void *committed;
+    void *end;
+    usize retain_size;
+};
+
+// Blocks allocated by `arena_allocator` stop doubling in size once they reach this many bytes.
+constexpr usize ARENA_DEFAULT_MAX_BLOCK_SIZE = 1024 * 1024;
+// Number of size buckets that empty arena blocks are kept in, one per power of two.
+constexpr usize ARENA_SPARE_BUCKET_COUNT = 64;
+
+// Bump-allocates out of a chain of blocks requested from the parent, where each new block is twice
+// as big as the last, up to `max_block_size`. Blocks emptied by `reset` or `restore` are kept in
+// size buckets, so that a block that fits can be picked without walking anything.
+//
+// On reset, spare blocks that went unused since the previous reset are given back to the parent,
+// and so are blocks past the first `retain_size` bytes, so a long-lived arena only holds on to
+// about as much memory as its last cycle needed. Blocks that `restore` emptied during the cycle
+// count as used, and are kept like any other block the cycle needed.
+// NOT THREADSAFE!!!
+struct arena_allocator final : public resettable_allocator {
+    inline void *internal_alloc(const layout &layout) override;
+    void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    void internal_alloc_batch(const layout &layout, usize count, void **out_ptrs) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+    void internal_reset() override;
+
+    explicit arena_allocator(allocator *parent,
+        usize max_block_size = ARENA_DEFAULT_MAX_BLOCK_SIZE,
+        usize retain_size = SIZE_MAX);
     ~arena_allocator();
 
     struct block_descriptor {
@@ -73,17 +344,361 @@ struct arena_allocator final : public resettable_allocator {
         void *last;
         block_descriptor *next;
         layout block_layout;
+        // Set when the block is started, and cleared on reset, so spares that sat unused for a
+        // whole cycle can be told apart from ones that were only emptied by `restore`.
+        bool used_this_cycle;
     };
 
+    struct savepoint {
+        block_descriptor *block;
+        void *current;
+        void *last;
+    };
+
+    /// Captures the current position of the arena, which `restore` can roll back to.
+    savepoint save() const;
+    /// Discards every allocation made since `point` was saved, keeping any blocks started since
+    /// then around for reuse. Savepoints taken after `point` are invalidated, while ones taken
+    /// before it can still be restored.
+    void restore(const savepoint &point);
+
 private:
-    void *try_allocate_in(const layout &layout, block_descriptor &block);
-    void *try_allocate_in_chain(const layout &layout, block_descriptor &block);
+    inline void *try_allocate_in(const layout &layout, block_descriptor &block);
+    void *alloc_in_new_block(const layout &layout);
     block_descriptor *allocate_block(const layout &required_layout);
+    void free_block(block_descriptor *block);
+    void push_spare(block_descriptor *block);
+    block_descriptor *take_spare(const layout &required_layout);
+    void release_spares();
 
     usize last_size;
+    usize max_block_size;
+    usize retain_size;
+    // Blocks in use since the last reset, in the order they were started. `current_block` is the
+    // last one, and is the only one that's allocated out of.
     block_descriptor *blocks;
     block_descriptor *current_block;
+    // Empty blocks, bucketed by the log2 of their size.
+    u64 spare_bitmap = 0;
+    block_descriptor *spare_blocks[ARENA_SPARE_BUCKET_COUNT] = {};
     allocator *parent;
 };
 
+// Like `arena_allocator`, but any number of threads may allocate from it at once without locking.
+// Threads bump-allocate from the current block with an atomic add, and a thread that finds the
+// current block exhausted installs a new, larger one with a compare-and-swap.
+//
+// The parent allocator must be threadsafe. `reset` must not race with any other use of the arena,
+// and keeps only the newest (and largest) block around for reuse.
+struct concurrent_arena_allocator final : public resettable_allocator {
+    void *internal_alloc(const layout &layout) override;
+    void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    void internal_reset() override;
+
+    explicit concurrent_arena_allocator(allocator *parent);
+    ~concurrent_arena_allocator();
+
+    // Lives at the start of each block, directly followed by the block's data.
+    struct block_descriptor {
+        // Offset of the next free byte from `start`. This can run past `size` when concurrent
+        // allocations overflow the block, which just means that the block is full.
+        std::atomic<usize> cursor;
+        void *start;
+        usize size;
+        block_descriptor *prev;
+    };
+
+private:
+    void *try_allocate_in(const layout &layout, block_descriptor *block);
+    block_descriptor *allocate_block(usize min_size);
+    void free_block(block_descriptor *block);
+
+    std::atomic<block_descriptor *> current_block;
+    allocator *parent;
+};
+
+// Freed blocks handed back by threads that don't own the allocator they came from. Any number of
+// threads can push onto the list at once without locking, while only the owner takes blocks off,
+// always all of them at once, which keeps it safe from ABA. Blocks are linked through their first
+// bytes, like any other free list.
+struct remote_free_list {
+    /// Pushes the blocks from `first` to `last`, which must already be linked together. Returns
+    /// whether the list was empty before.
+    bool push(void *first, void *last);
+    /// Takes every block pushed so far, linked together and ending in null.
+    void *take_all();
+    bool is_empty() const;
+
+    std::atomic<void *> head = nullptr;
+};
+
+// Segregates small allocations into size classes, where each class is served from spans of
+// `SLAB_SPAN_SIZE` bytes requested from the parent. Classes are spaced 16 bytes apart up to 128
+// bytes, and then four classes per power of two up to `SLAB_MAX_SIZE`. Larger or over-aligned
+// requests are forwarded to the parent directly.
+//
+// A slab has no owning thread, so every thread shares its one lock. Frees never wait for it: they
+// take it with `try_lock` when it's free and put the slot straight back into its span, and when
+// another thread is holding it, they push the slot onto a lock-free list in its span instead,
+// which whoever allocates from the slab next merges back.
+//
+// The parent must be able to satisfy span-aligned requests, like `page_allocator` does.
+struct slab_allocator final : public allocator {
+    void *internal_alloc(const layout &layout) override;
+    void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    void internal_alloc_batch(const layout &layout, usize count, void **out_ptrs) override;
+    void internal_dealloc_batch(const layout &layout, usize count, void *const *ptrs) override;
+    allocation internal_alloc_at_least(const layout &layout) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+
+    explicit slab_allocator(allocator *parent);
+    ~slab_allocator();
+
+    /// Returns whether `layout` is served from a size class rather than the parent.
+    static bool is_small(const layout &layout);
+    /// Index of the smallest size class that can hold `size` bytes.
+    static usize size_class_of(usize size);
+    /// Size of every allocation in the size class `size_class`.
+    static usize size_class_size(usize size_class);
+    /// Usable size of a slot holding `old_layout` after resizing it to `new_size` bytes, or 0 if
+    /// the new size belongs in a different size class.
+    static usize resized_slot_size(const layout &old_layout, usize new_size);
+    /// Size of the slot at `ptr`, which must have been handed out from a size class by some slab.
+    static usize slot_size_of(const void *ptr);
+
+    /// Fills `out` with `count` slots from `size_class` while only taking the slab's lock once.
+    ///
+    /// @note This bypasses allocation tracking and poisoning, and is meant for caching layers that
+    /// hand out the slots themselves.
+    void alloc_slots(usize size_class, usize count, void **out);
+    /// Returns `count` slots to the slab while only taking the slab's lock once. Each slot's span
+    /// knows its size class, so the slots don't all have to be from the same one.
+    void dealloc_slots(usize count, void *const *ptrs);
+
+    struct span_descriptor {
+        slab_allocator *owner;
+        // Links in the list of spans of this size class that have free slots.
+        span_descriptor *prev, *next;
+        // Links in the list of every span owned by the slab, used for teardown.
+        span_descriptor *all_prev, *all_next;
+        // Intrusive list of freed slots. Slots between `bump` and `end` have never been handed
+        // out, so a fresh span doesn't need to touch any of its pages up front.
+        void *free_list;
+        void *bump;
+        void *end;
+        usize size_class;
+        usize used;
+        usize capacity;
+        // Slots freed while the slab was locked, which still count towards `used`.
+        remote_free_list remote_frees;
+        // Links in the slab's list of spans with remote frees waiting to be collected.
+        span_descriptor *next_pending;
+    };
+
+private:
+    span_descriptor *allocate_span(usize size_class);
+    void release_span(span_descriptor *span);
+    void *allocate_from_class(usize size_class);
+    void deallocate_to_span(span_descriptor *span, void *ptr);
+    void deallocate_remote(span_descriptor *span, void *ptr);
+    void collect_remote_frees();
+
+    std::mutex lock;
+    span_descriptor *partial[SLAB_SIZE_CLASS_COUNT] = {};
+    span_descriptor *spans = nullptr;
+    // Spans whose first remote free arrived since the last collection, pushed without the lock.
+    std::atomic<span_descriptor *> pending_spans = nullptr;
+    allocator *parent;
+};
+
+constexpr usize THREAD_CACHE_MAGAZINE_SIZE = 64;
+constexpr usize MAX_THREAD_CACHE_ALLOCATORS = 64;
+
+// Front-end for a `slab_allocator` that gives every thread its own magazine of free slots for
+// each size class, so that most requests never touch the slab's lock. Empty magazines are refilled
+// and full magazines are drained in batches of half their capacity.
+//
+// A slot freed on a different thread than the one that allocated it goes into the freeing
+// thread's magazine, not back to the allocating thread. Slots don't remember which cache they came
+// from, and the slab behind the caches is shared, so the slot reaches every thread again once the
+// magazine drains. If more than `MAX_THREAD_CACHE_ALLOCATORS` instances are alive at once, the
+// extra instances forward every request straight to the back-end.
+struct thread_cache_allocator final : public allocator {
+    void *internal_alloc(const layout &layout) override;
+    void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    allocation internal_alloc_at_least(const layout &layout) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+
+    explicit thread_cache_allocator(slab_allocator *backend);
+    ~thread_cache_allocator();
+
+    /// Returns all of the slots cached by the calling thread to the back-end.
+    void flush_thread_cache();
+
+    struct magazine {
+        usize count;
+        void *slots[THREAD_CACHE_MAGAZINE_SIZE];
+    };
+
+    struct thread_cache {
+        thread_cache_allocator *owner;
+        // Links in the owner's list of caches, guarded by the cache registry lock.
+        thread_cache *prev, *next;
+        magazine magazines[SLAB_SIZE_CLASS_COUNT];
+    };
+
+    // Hooks for the thread-local cache table; not meant to be called directly.
+    void flush(thread_cache *cache);
+    void release(thread_cache *cache);
+
+private:
+    thread_cache *get_thread_cache();
+    thread_cache *create_thread_cache();
+
+    isize slot;
+    u64 generation;
+    thread_cache *caches = nullptr;
+    slab_allocator *backend;
+};
+
+// Hands out slots of a single fixed layout, keeping freed slots in an intrusive free list so that
+// both alloc and dealloc are a couple of pointer moves. Slots are carved out of chunks of
+// `slots_per_chunk` slots requested from the parent, and chunks are only returned when the pool
+// is destroyed.
+//
+// Requests that don't fit in a slot are forwarded to the parent.
+//
+// The pool belongs to the first thread that allocates from it, and only that thread may allocate
+// from it from then on. Other threads may free slots back to it though, which pushes them onto a
+// lock-free list that the owner takes over once its own free list runs dry. The parent must be
+// threadsafe if blocks it serves are freed from other threads.
+struct pool_allocator final : public allocator {
+    void *internal_alloc(const layout &layout) override;
+    void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    void internal_alloc_batch(const layout &layout, usize count, void **out_ptrs) override;
+    void internal_dealloc_batch(const layout &layout, usize count, void *const *ptrs) override;
+    allocation internal_alloc_at_least(const layout &layout) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+
+    pool_allocator(allocator *parent, layout slot_layout, usize slots_per_chunk = 64);
+    ~pool_allocator();
+
+    /// Returns whether `layout` is served from a slot rather than the parent.
+    bool fits(const layout &layout) const;
+
+    /// Current slot usage of the pool, in the same terms as a memory performance query. Only the
+    /// usage fields and `reserved_bytes` are filled in. Slots freed by other threads count as in
+    /// use until the pool takes them back.
+    query_info occupancy() const;
+
+    struct chunk_header {
+        chunk_header *next;
+    };
+
+private:
+    layout chunk_layout() const;
+    void grow();
+    bool collect_remote_frees();
+    void claim_ownership();
+
+    void *free_list = nullptr;
+    // Slots freed by other threads, which still count towards `slots_in_use`.
+    remote_free_list remote_frees;
+    // Nobody until the first allocation. Other threads read it to tell whether their frees are
+    // remote.
+    std::atomic<std::thread::id> owner_thread{};
+    // Slots between `bump` and `bump_end` in the newest chunk have never been handed out.
+    void *bump = nullptr;
+    void *bump_end = nullptr;
+    chunk_header *chunks = nullptr;
+
+    layout slot_layout;
+    usize slots_per_chunk;
+    usize chunk_count = 0;
+    usize slots_in_use = 0;
+    usize maximum_slots_in_use = 0;
+    allocator *parent;
+};
+
+// Persistent heaps are mapped here unless asked otherwise. It's far away from where the loader and
+// `mmap` usually put things, so that the same address is likely to be free in every process.
+constexpr usize PERSISTENT_DEFAULT_ADDRESS = 0x200000000000;
+// One free list per power of two.
+constexpr usize PERSISTENT_SIZE_CLASS_COUNT = 64;
+
+struct persistent_header;
+
+// Carves allocations out of a file mapped with `MAP_SHARED`, keeping its own bookkeeping in the
+// file too, so that anything built in it is still there, ready to use, the next time the file is
+// opened. `root` is where to keep a pointer to whatever should be found again after reopening.
+//
+// Blocks are rounded up to powers of two and freed blocks are kept in one free list per size, so
+// nothing ever has to be walked or rebuilt on open. The file is always mapped at the address it
+// was created at, so that pointers stored in it stay valid. The allocator itself also lives in the
+// mapping, so containers that point back at their allocator can be used as-is after reopening,
+// which is why it's created with `open` and destroyed with `close` instead.
+//
+// Alignments of more than a page aren't supported. The profiler never sees blocks from earlier
+// sessions, so they can't be freed while the full profiling tier is on.
+// This allocator is a "source" and doesn't have a parent allocator.
+// NOT THREADSAFE!!!
+struct persistent_allocator final : public allocator {
+    void *internal_alloc(const layout &layout) override;
+    void internal_dealloc(const layout &layout, void *ptr) override;
+    void *internal_realloc(const layout &old_layout, const layout &new_layout, void *ptr) override;
+    allocation internal_alloc_at_least(const layout &layout) override;
+    usize internal_try_grow_in_place(const layout &old_layout, usize new_size, void *ptr) override;
+    usize internal_try_shrink_in_place(
+        const layout &old_layout, usize new_size, void *ptr) override;
+
+    /// @brief Maps the heap in the file at `path`, creating it with room for `capacity` bytes at
+    /// `address` if it doesn't exist yet.
+    ///
+    /// The capacity and address of an existing heap are the ones it was created with.
+    /// `allocation_exception` is thrown if the file can't be opened or mapped.
+    static persistent_allocator *open(const char *path,
+        usize capacity,
+        void *address = (void *)PERSISTENT_DEFAULT_ADDRESS);
+    /// @brief Writes everything back to the file and unmaps it, after which neither `alloc` nor
+    /// any of its blocks may be used.
+    ///
+    /// Returns false if the write-back failed, in which case the file may be missing changes.
+    static bool close(persistent_allocator *alloc);
+
+    /// Blocks until every change made so far has been written back to the file, and returns
+    /// whether that succeeded.
+    bool flush();
+
+    void *root() const;
+    void set_root(void *root);
+
+    /// Returns whether the heap already existed when it was opened.
+    bool was_reopened() const;
+    /// Returns whether the last process to open the heap closed it. If not, it may have stopped in
+    /// the middle of changing something.
+    bool was_closed_cleanly() const;
+
+private:
+    persistent_allocator(persistent_header *header, bool reopened, bool closed_cleanly);
+
+    void *bump(usize size_class);
+    usize resize_in_place(void *ptr, usize old_class, usize new_class);
+
+    persistent_header *header;
+    bool reopened;
+    bool closed_cleanly;
+};
+
 } // namespace vixen::heap
+
+#include "allocator/allocators.inl"
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "vixen/types.hpp"
+
+#include <atomic>
+
+/// @file
+/// @ingroup vixen_allocator
+
+namespace vixen::heap {
+
+struct allocator;
+
+// Pages are tracked in units of this many bytes, no matter what the system page size is. Bigger
+// pages just take up more than one entry.
+constexpr usize PAGE_MAP_PAGE_SHIFT = 12;
+// Page numbers are split into three equal levels, which covers 48-bit addresses.
+constexpr usize PAGE_MAP_LEVEL_BITS = 12;
+constexpr usize PAGE_MAP_LEVEL_SIZE = (usize)1 << PAGE_MAP_LEVEL_BITS;
+
+// Maps every page of the address space to a word of metadata, using a three-level radix tree over
+// the page number. Pages that were never set read as 0, and nodes for them are never allocated.
+//
+// Lookups never lock and are safe to do at the same time as updates. Nodes are requested from the
+// parent the first time something in their range is set, and only given back when the map is
+// destroyed.
+struct page_map {
+    explicit page_map(allocator *parent);
+    ~page_map();
+
+    page_map(const page_map &) = delete;
+    page_map &operator=(const page_map &) = delete;
+
+    /// Returns the value of the page containing `ptr`, or 0 if it was never set.
+    usize get(const void *ptr) const;
+    /// Sets the value of the page containing `ptr`.
+    void set(const void *ptr, usize value);
+    /// Sets the value of every page overlapping the `len` bytes starting at `ptr`.
+    void set_range(const void *ptr, usize len, usize value);
+
+    /// Calls `f(value)` for every page whose value isn't 0. Must not race with updates.
+    template <typename F>
+    void for_each(F &&f) const;
+
+    struct leaf_node {
+        std::atomic<usize> values[PAGE_MAP_LEVEL_SIZE];
+    };
+
+    struct interior_node {
+        std::atomic<leaf_node *> children[PAGE_MAP_LEVEL_SIZE];
+    };
+
+private:
+    leaf_node *get_or_create_leaf(usize page);
+
+    std::atomic<interior_node *> root[PAGE_MAP_LEVEL_SIZE] = {};
+    allocator *parent;
+};
+
+} // namespace vixen::heap
+
+#include "allocator/page_map.inl"
@@ -52,13 +52,54 @@ struct query_info {
 
     usize cum_allocation_bytes = 0;
     usize cum_deallocation_bytes = 0;
+
+    // Mappings that asked for huge pages, by what actually backed them.
+    usize explicit_huge_page_mappings = 0;
+    usize transparent_huge_page_mappings = 0;
+    usize huge_page_fallbacks = 0;
+
+    // Bytes that a pooling allocator requested from its parent to carve allocations out of.
+    usize reserved_bytes = 0;
+};
+
+/// What kind of pages back a mapping made by a page-level allocator.
+enum class page_mapping_kind {
+    regular,
+    /// Regular pages advised with `MADV_HUGEPAGE`, which the kernel may back with huge pages.
+    transparent_huge,
+    /// Pages from the `MAP_HUGETLB` pool.
+    explicit_huge,
+};
+
+/// How much bookkeeping the profiler does for an allocator's requests.
+enum class profiling_tier {
+    /// The allocator never calls into the profiler.
+    off,
+    /// Byte and allocation counts, and performance queries.
+    counters,
+    /// Counters, plus checking every request against the allocator's live allocations, with stack
+    /// traces of where each one was made.
+    full,
 };
 
+// The highest tier any allocator can use, set by the `VIXEN_PROFILING_TIER` build option. When this
+// is `off`, the profiling hooks are compiled out of the allocation paths entirely.
+#if defined(VIXEN_PROFILING_TIER)
+constexpr profiling_tier MAX_PROFILING_TIER = profiling_tier::VIXEN_PROFILING_TIER;
+#else
+constexpr profiling_tier MAX_PROFILING_TIER = profiling_tier::full;
+#endif
+
 constexpr allocator_id NOT_TRACKED_ID = {-1};
 
+/// Gives `alloc` an ID and profiles it at `MAX_PROFILING_TIER`.
 void register_allocator(allocator *alloc);
 void unregister_allocator(allocator *alloc);
 
+/// Changes how much `alloc` is profiled, up to `MAX_PROFILING_TIER`. Counters can't account for
+/// allocations made while they were off, so raise the tier before the allocator is used.
+void set_profiling_tier(allocator *alloc, profiling_tier tier);
+
 void set_allocator_name(allocator_id id, string_slice name);
 option<string_slice> get_allocator_name(allocator_id id);
 
@@ -68,11 +109,61 @@ option<string_slice> get_allocator_name(allocator_id id);
 void begin_transaction(allocator_id id);
 void end_transaction(allocator_id id);
 
+/// Keeps a transaction of `id` open for as long as it lives, so that requests that throw still end
+/// theirs. Otherwise, the allocator would look like it's still serving them, and none of its later
+/// requests on this thread would be recorded.
+struct transaction_scope {
+    allocator_id id;
+
+    explicit transaction_scope(allocator_id id) : id(id) {
+        begin_transaction(id);
+    }
+
+    ~transaction_scope() {
+        end_transaction(id);
+    }
+
+    transaction_scope(const transaction_scope &) = delete;
+    transaction_scope &operator=(const transaction_scope &) = delete;
+};
+
 void record_reset(allocator_id id);
+/// Records that every block `id` handed out in `[begin, end)` was freed by rolling back to a
+/// savepoint, while blocks outside of it are still live. Below `profiling_tier::full`, nothing
+/// knows the sizes of those blocks, so the live byte and allocation counts don't go down.
+void record_restore(allocator_id id, void *begin, void *end);
 void record_alloc(allocator_id id, layout layout, void *ptr);
 void record_dealloc(allocator_id id, layout layout, void *ptr);
+/// Records that `old_ptr` is about to be reallocated. It has to be called before the allocator can
+/// free the old block, since another thread could be handed that block and record allocating it
+/// as soon as it is. `record_realloc` finishes recording the request, or `record_realloc_failed` if
+/// it threw and the old block is still live.
+void record_realloc_start(allocator_id id, layout old_layout, void *old_ptr, layout new_layout);
 void record_realloc(
     allocator_id id, layout old_layout, void *old_ptr, layout new_layout, void *new_ptr);
+void record_realloc_failed(allocator_id id, void *old_ptr);
+/// Called by reallocations that move `old_ptr` to `new_ptr`, after the new block is allocated and
+/// before the old one is freed. Traces every reallocation of `old_ptr` this thread is in the middle
+/// of, for the same reason `record_realloc_start` comes before the free.
+void record_realloc_move(void *old_ptr, void *new_ptr);
+
+/// Records a whole batch of allocations or deallocations of `layout` as one request.
+void record_alloc_batch(allocator_id id, layout layout, usize count, void *const *ptrs);
+void record_dealloc_batch(allocator_id id, layout layout, usize count, void *const *ptrs);
+
+/// Records a block that was asked for with `requested` but handed out with `usable` bytes. Either
+/// size, or anything between, may be used to describe the block afterwards.
+void record_alloc_at_least(allocator_id id, layout requested, usize usable, void *ptr);
+/// Records that a block was resized to `new_size` without moving, with `usable` bytes available.
+void record_resize_in_place(
+    allocator_id id, layout old_layout, usize new_size, usize usable, void *ptr);
+
+/// Records that a mapping which wanted `requested` pages ended up backed by `actual` pages.
+void record_page_mapping(allocator_id id, page_mapping_kind requested, page_mapping_kind actual);
+
+/// Records that a pooling allocator requested `size` more bytes from its parent to carve
+/// allocations out of.
+void record_reserve(allocator_id id, usize size);
 
 void record_legacy_alloc(allocator_id id, usize size, void *ptr);
 void record_legacy_dealloc(allocator_id id, void *ptr);
@@ -87,4 +178,21 @@ usize get_active_allocation_max_count(allocator_id id);
 usize get_active_byte_count(allocator_id id);
 usize get_active_byte_max_count(allocator_id id);
 
+/// Mean number of allocated bytes between heap profile samples.
+constexpr usize DEFAULT_HEAP_SAMPLE_INTERVAL = 512 * 1024;
+
+/// Sets the mean number of bytes allocated between heap profile samples, and forgets the samples
+/// taken so far. Smaller intervals give more precise profiles for more overhead, and 0 turns
+/// sampling off.
+///
+/// Sample points are spread over allocated bytes at random, and only sampled allocations capture
+/// their stack, so most allocations only pay for a subtraction.
+void set_heap_sample_interval(allocator_id id, usize interval);
+
+/// Estimates how many bytes are live in an allocator from its heap profile samples.
+usize estimate_live_heap_bytes(allocator_id id);
+
+/// Logs the estimated live bytes of the `max_sites` call sites that hold the most memory.
+void print_heap_profile(allocator_id id, usize max_sites = 16);
+
 } // namespace vixen::heap
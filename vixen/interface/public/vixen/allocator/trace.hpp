@@ -0,0 +1,93 @@
+#pragma once
+
+#include "vixen/types.hpp"
+
+/// @file
+/// @ingroup vixen_allocator
+
+namespace vixen::heap {
+
+// "VIXNTRCE"
+constexpr u64 TRACE_MAGIC = 0x5649584e54524345;
+// Bumped whenever the layout of the header or of events changes.
+constexpr u32 TRACE_VERSION = 1;
+
+enum class trace_event_kind : u8 {
+    alloc,
+    dealloc,
+    /// `old_ptr` and `old_size` describe the block before it was moved or resized.
+    realloc,
+    /// Every block of a resettable allocator was freed at once.
+    reset,
+    /// One frame of the stack that `stack_id` names. `ptr` is the return address and `size` is the
+    /// frame's depth, where 0 is the innermost frame.
+    stack_frame,
+    /// Every block of an allocator in `[ptr, ptr + size)` was freed at once by rolling back to a
+    /// savepoint.
+    restore,
+};
+
+/// One allocator request, as it's laid out in a trace file. `ptr`, `size` and `align` describe the
+/// block that was allocated, freed, or reallocated into. Events are exactly one cache line, so that
+/// recording one only ever touches a single line of the thread's ring.
+struct trace_event {
+    /// Nanoseconds on the monotonic clock.
+    u64 timestamp;
+    u64 ptr;
+    u64 old_ptr;
+    u64 size;
+    u64 old_size;
+    u64 align;
+    /// The ID the allocator had when the event was recorded. IDs of unregistered allocators are
+    /// handed out again, so a `reset` or the last `dealloc` doesn't mean the ID is done for good.
+    i32 allocator;
+    /// Numbers threads in the order they first recorded an event.
+    u32 thread;
+    /// Names the stack that made the request, or is 0 when stacks aren't captured.
+    u32 stack_id;
+    trace_event_kind kind;
+    u8 reserved[3];
+};
+
+static_assert(sizeof(trace_event) == 64, "Trace events must stay one cache line.");
+
+/// Starts a trace file. Events follow it directly.
+struct trace_file_header {
+    u64 magic;
+    u32 version;
+    u32 event_size;
+    /// Number of events in the file, as of when the trace was last flushed or stopped. Events that
+    /// were still being written when the trace was flushed have a timestamp of 0.
+    u64 event_count;
+    /// Events that were recorded but didn't make it into the file.
+    u64 dropped_count;
+    u8 reserved[32];
+};
+
+static_assert(sizeof(trace_file_header) == sizeof(trace_event),
+    "Events must stay aligned to a cache line in trace files.");
+
+struct trace_options {
+    /// The file is sized for this many events up front, and events past it are dropped.
+    usize max_events = (usize)1 << 24;
+    /// Writes the stack of each request too, once for every distinct stack a thread sees. This
+    /// walks the stack on every request, so expect tracing to get several times slower.
+    bool capture_stacks = false;
+};
+
+/// Starts writing every request made to a profiled allocator to a trace file at `path`, replacing
+/// whatever was there. Requests are only traced from allocators whose profiling tier isn't `off`.
+///
+/// Each thread buffers its events in a ring of its own, and copies them into the mapped file once
+/// the ring is half full, so recording an event never takes a lock or makes a system call.
+void start_event_trace(const char *path, trace_options options = {});
+/// Writes out the events every thread has buffered, and closes the trace file.
+void stop_event_trace();
+/// Writes out the events every thread has buffered so far.
+void flush_event_trace();
+bool is_event_tracing();
+
+/// Adds `event` to the running trace, if there is one, filling in its timestamp, thread and stack.
+void record_trace_event(trace_event event);
+
+} // namespace vixen::heap
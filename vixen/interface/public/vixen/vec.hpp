@@ -16,20 +16,24 @@ constexpr const usize default_vec_capacity = 8;
 /// @brief Growable dynamically-allocated array.
 ///
 /// @warning Any reference into a vector is only valid until the vector's size changes.
-template <typename T>
+///
+/// `A` is the type of allocator the vector is bound to. By default that's any `allocator`, but
+/// naming a concrete allocator type, like `vector<T, heap::arena_allocator>`, lets the vector call
+/// into it directly instead of through its vtable.
+template <typename T, typename A = allocator>
 struct vector {
     /// Default construction of a vector results in a vector in the moved-from state.
     vector();
 
-    explicit vector(allocator *alloc);
-    vector(allocator *alloc, usize default_capacity);
-    vector(allocator *alloc, const vector<T> &other);
-    vector(vector<T> &&other);
-    vector<T> &operator=(vector<T> &&other);
+    explicit vector(A *alloc);
+    vector(A *alloc, usize default_capacity);
+    vector(A *alloc, const vector<T, A> &other);
+    vector(vector<T, A> &&other);
+    vector<T, A> &operator=(vector<T, A> &&other);
 
     ~vector();
 
-    vector<T> clone(allocator *alloc) const;
+    vector<T, A> clone(A *alloc) const;
 
     /// Appends a single item to the end of the vector.
     template <typename U>
@@ -83,7 +87,7 @@ struct vector {
 
     usize len() const;
 
-    const vector<T> &as_const() const;
+    const vector<T, A> &as_const() const;
     operator slice<const T>() const;
     operator slice<T>();
 
@@ -96,19 +100,19 @@ private:
     void set_capacity(usize cap);
 
 private:
-    allocator *alloc = nullptr;
+    A *alloc = nullptr;
     T *data = nullptr;
     usize length = 0, capacity = 0;
 };
 
-template <typename T, typename H>
-inline void hash(const vector<T> &values, H &hasher);
+template <typename T, typename A, typename H>
+inline void hash(const vector<T, A> &values, H &hasher);
 
-template <typename T>
-struct is_collection<vector<T>> : std::true_type {};
+template <typename T, typename A>
+struct is_collection<vector<T, A>> : std::true_type {};
 
-template <typename T>
-struct collection_types<vector<T>> : standard_collection_types<T> {};
+template <typename T, typename A>
+struct collection_types<vector<T, A>> : standard_collection_types<T> {};
 
 } // namespace vixen
 